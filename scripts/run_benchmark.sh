@@ -1,9 +1,44 @@
 #!/usr/bin/env bash
 set -euo pipefail
 
-echo "[占位] 运行基准测试，输出 p50/p95、tokens/s、成本等指标"
+BUILD_DIR=${BUILD_DIR:-build-bench}
+ITERS=${ITERS:-200}
 
+cmake -S . -B "$BUILD_DIR" -DCMAKE_BUILD_TYPE=Release -DAICLI_BUILD_BENCH=ON
+cmake --build "$BUILD_DIR" -j --target bench_sampler bench_ngram bench_prompt_cache
 
+echo "[bench] sampler: legacy full-sort vs partial selection (us/token)"
+"$BUILD_DIR"/bench_sampler "$ITERS"
 
+echo "[bench] prompt lookup: draft acceptance on edit-style outputs"
+"$BUILD_DIR"/bench_ngram
 
+echo "[bench] prompt preparation: full vs incremental tokenization per turn"
+"$BUILD_DIR"/bench_prompt_cache
 
+# 端到端解码吞吐：设置 MODEL 后运行，对比普通解码、提示词查找推测与（设置 DRAFT_MODEL 时）草稿模型推测
+if [ -n "${MODEL:-}" ]; then
+    cmake --build "$BUILD_DIR" -j --target aicli
+    PROMPT=${PROMPT:-"用 C++ 实现一个线程安全的 LRU 缓存，并逐行解释实现。"}
+
+    # 运行一轮对话，输出该轮 metrics 事件中的 tokens_per_s 与 accept_rate
+    run_decode() {
+        local start
+        start=$(wc -l < data/sysbox.jsonl 2>/dev/null || echo 0)
+        printf '/model %s\n%s\n/exit\n' "$MODEL" "$PROMPT" | env AICLI_SEED=42 "$@" "$BUILD_DIR"/aicli > /dev/null 2>&1
+        tail -n +"$((start + 1))" data/sysbox.jsonl | grep '"tokens_per_s"' | tail -1 |
+            sed -E 's/.*"tokens_per_s":([0-9.]+).*/\1/; t; s/.*/n\/a/'
+        tail -n +"$((start + 1))" data/sysbox.jsonl | grep -o '"accept_rate":[0-9.]*' | tail -1 | cut -d: -f2
+    }
+
+    echo "[bench] decode tokens/s (AICLI_SEED=42)"
+    printf '%-12s %14s %12s\n' mode tokens_per_s accept_rate
+    read -r base_tps < <(run_decode)
+    printf '%-12s %14s %12s\n' baseline "$base_tps" "-"
+    { read -r tps; read -r rate; } < <(run_decode AICLI_LOOKUP_NGRAM=3)
+    printf '%-12s %14s %12s\n' lookup "$tps" "${rate:--}"
+    if [ -n "${DRAFT_MODEL:-}" ]; then
+        { read -r tps; read -r rate; } < <(run_decode AICLI_DRAFT_MODEL="$DRAFT_MODEL")
+        printf '%-12s %14s %12s\n' draft "$tps" "${rate:--}"
+    fi
+fi
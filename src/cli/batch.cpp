@@ -0,0 +1,216 @@
+#include "batch.h"
+#include "batch_io.h"
+#include "sampling_config.h"
+#include "think_filter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/conversation/template.h"
+#include "core/inference/engine.h"
+#include "core/inference/engine_pool.h"
+#include "core/sysbox/sysbox.h"
+#include "utils/config.h"
+
+namespace cli {
+
+namespace {
+
+struct Item {
+    long index = 0;   // 输入文件中的行号（从 0 起）
+    std::string line;
+};
+
+struct Result {
+    double ttft_ms = -1.0;
+    double ms = 0.0;
+    int tokens = 0;   // 流式回调次数（约等于生成的 token 数）
+};
+
+std::atomic<inference::CancelToken*> g_batch_cancel{nullptr};
+
+// 第一次 Ctrl-C 取消在途请求并停止派发（未完成的行不写出，重跑时补上），第二次直接退出
+void on_sigint(int) {
+    if (inference::CancelToken* c = g_batch_cancel.exchange(nullptr)) { c->cancel(); return; }
+    std::signal(SIGINT, SIG_DFL);
+    std::raise(SIGINT);
+}
+
+} // namespace
+
+int run_batch(int argc, char** argv) {
+    std::string in_path, out_path, model;
+    int window = 0;
+    bool show_think = false;
+    for (int i = 0; i < argc; ++i) {
+        const std::string a = argv[i];
+        auto value = [&]() -> std::string { return i + 1 < argc ? argv[++i] : std::string(); };
+        if (a == "--batch") in_path = value();
+        else if (a == "--out") out_path = value();
+        else if (a == "--model") model = value();
+        else if (a == "--window") { try { window = std::stoi(value()); } catch (...) { window = -1; } }
+        else if (a == "--think") show_think = true;
+        else { in_path.clear(); break; }
+    }
+    if (in_path.empty() || out_path.empty() || window < 0) {
+        std::cout << "用法：aicli --batch <in.jsonl> --out <out.jsonl> [--model <name|path>] [--window N] [--think]\n";
+        return 1;
+    }
+
+    std::ifstream in(in_path);
+    if (!in) { std::cout << "无法读取：" << in_path << "\n"; return 1; }
+    std::unordered_set<long> done;
+    std::string err;
+    if (!load_checkpoint(out_path, done, err)) { std::cout << err << "\n"; return 1; }
+    std::vector<Item> items;
+    long n_lines = 0, skipped = 0;
+    for (std::string line; std::getline(in, line); ++n_lines) {
+        if (line.find_first_not_of(" \t\r") == std::string::npos) continue;
+        if (done.count(n_lines)) { ++skipped; continue; }
+        items.push_back({n_lines, std::move(line)});
+    }
+    if (skipped > 0) std::cout << "检查点：跳过已完成的 " << skipped << " 条\n";
+    if (items.empty()) { std::cout << "没有待处理的输入\n"; return 0; }
+
+    if (model.empty()) model = config::get_value("local_model.default_model").value_or("");
+    const std::string model_dir = config::get_env("AICLI_MODEL_DIR").value_or(config::get_value("local_model.model_dir").value_or("models"));
+    const std::string path = inference::EnginePool::resolve(model_dir, model);
+    if (path.empty()) { std::cout << "未找到模型：" << model << "\n"; return 1; }
+    std::unique_ptr<inference::Engine> eng = inference::create_local_engine();
+    std::cout << "加载模型：" << path << "\n";
+    if (!eng->load_model(path, err)) { std::cout << "加载失败：" << err << "\n"; return 1; }
+
+    // 在途窗口：每个工作线程同时只持有一个请求，调度器把它们作为并行序列合并进同一个 batch。
+    // 默认为槽位数的两倍，某条序列结束时下一条已在队列中等待，槽位不空转。
+    // 输入文本在开始前整体读入；窗口之外的行只占这份文本，不占序列槽位与 KV
+    if (window == 0) window = config::get_int("AICLI_BATCH_WINDOW", "local_model.batch_window", 0);
+    if (window <= 0) {
+        inference::EngineStats st;
+        window = eng->get_stats(st) && st.n_seq_max > 0 ? 2 * st.n_seq_max : 4;
+    }
+    window = std::min<int>(window, (int)items.size());
+
+    std::ofstream out(out_path, std::ios::app | std::ios::binary);
+    if (!out) { std::cout << "无法写入：" << out_path << "\n"; return 1; }
+
+    auto cancel = std::make_shared<inference::CancelToken>();
+    g_batch_cancel = cancel.get();
+    auto prev = std::signal(SIGINT, on_sigint);
+
+    using clock = std::chrono::steady_clock;
+    const auto t0 = clock::now();
+    std::atomic<size_t> next{0};
+    std::mutex out_mu;
+    std::vector<double> ttfts, rates;
+    long n_ok = 0, n_failed = 0, n_tokens = 0;
+    size_t n_done = 0;
+
+    // 每完成一行立即写出并刷新：进程随时被杀，已写出的行都是完整的检查点。
+    // 输入本身有误的行标 "retry":false，重跑时与成功的行一样跳过；推理失败的行重跑时重试
+    auto emit = [&](const Item& it, const std::string& id, bool ok, const std::string& text, const std::string& e, const Result& r,
+                    bool retry = true) {
+        std::string line = "{\"index\":" + std::to_string(it.index);
+        if (!id.empty()) line += ",\"id\":" + id;
+        line += std::string(",\"ok\":") + (ok ? "true" : "false");
+        if (ok) line += ",\"output\":" + json_quote(text);
+        else line += ",\"error\":" + json_quote(e);
+        if (!ok && !retry) line += ",\"retry\":false";
+        line += ",\"tokens\":" + std::to_string(r.tokens) + ",\"ttft_ms\":" + std::to_string(r.ttft_ms) + ",\"ms\":" + std::to_string(r.ms) + "}\n";
+        std::lock_guard<std::mutex> lk(out_mu);
+        out << line << std::flush;
+        ++n_done;
+        if (ok) {
+            ++n_ok;
+            n_tokens += r.tokens;
+            if (r.ttft_ms >= 0) ttfts.push_back(r.ttft_ms);
+            // 单条解码速率：首 token 之后的 token 数 / 首 token 之后的耗时
+            if (r.tokens > 1 && r.ms > r.ttft_ms) rates.push_back((r.tokens - 1) * 1000.0 / (r.ms - r.ttft_ms));
+        } else {
+            ++n_failed;
+        }
+        if (n_done % 100 == 0) std::cout << "\r进度：" << n_done << "/" << items.size() << std::flush;
+    };
+
+    auto worker = [&] {
+        std::map<std::string, std::string> f, raw;
+        for (size_t k; !cancel->cancelled() && (k = next.fetch_add(1)) < items.size();) {
+            const Item& it = items[k];
+            Result r;
+            std::string perr;
+            if (!parse_json_object(it.line, f, perr, &raw) || !f.count("prompt")) {
+                emit(it, std::string(), false, std::string(), perr.empty() ? "missing prompt" : "invalid json: " + perr, r, false);
+                continue;
+            }
+            // id 按原始 JSON 文本回写
+            const std::string id = raw.count("id") ? raw["id"] : std::string();
+            std::vector<conversation::Message> msgs{{"user", f["prompt"]}};
+            conversation::RenderOptions ropts; ropts.use_chatml = true;
+            if (f.count("system")) ropts.system_prompt = f["system"];
+            const std::string prompt = conversation::TemplateBuilder::render_chatml(msgs, ropts);
+
+            inference::GenerateOptions opt;
+            apply_sampling_config(opt);
+            opt.cancel = cancel;
+            opt.stop = {"<|im_end|>", "<|im_start|>"};
+            try {
+                if (f.count("max_tokens")) opt.max_new_tokens = std::stoi(f["max_tokens"]);
+                if (f.count("temperature")) opt.temperature = std::stof(f["temperature"]);
+            } catch (...) {
+                emit(it, id, false, std::string(), "bad max_tokens / temperature", r, false);
+                continue;
+            }
+
+            std::string text, visible;
+            ThinkFilter filter(show_think);
+            const auto ts = clock::now();
+            std::string gerr;
+            const bool ok = eng->generate(prompt, opt, [&](std::string_view piece) {
+                if (r.tokens++ == 0) r.ttft_ms = std::chrono::duration<double, std::milli>(clock::now() - ts).count();
+                filter.feed(piece, visible);
+            }, gerr);
+            r.ms = std::chrono::duration<double, std::milli>(clock::now() - ts).count();
+            // 取消的请求不写出，重跑时重新生成
+            if (!ok && cancel->cancelled()) break;
+            filter.finish(visible);
+            emit(it, id, ok, visible, gerr, r);
+        }
+    };
+    std::vector<std::thread> workers;
+    for (int w = 0; w < window; ++w) workers.emplace_back(worker);
+    for (auto& t : workers) t.join();
+    g_batch_cancel = nullptr;
+    std::signal(SIGINT, prev);
+    out.close();
+    eng->unload_model();
+
+    const double wall_s = std::chrono::duration<double>(clock::now() - t0).count();
+    const double tps = wall_s > 0 ? n_tokens / wall_s : 0.0;
+    const double p50 = percentile(ttfts, 0.50), p90 = percentile(ttfts, 0.90), p99 = percentile(ttfts, 0.99);
+    const double r50 = percentile(rates, 0.50), r10 = percentile(rates, 0.10);
+    std::printf("\r完成 %ld 条（失败 %ld，跳过 %ld），在途窗口 %d，用时 %.1f s\n", n_ok, n_failed, skipped, window, wall_s);
+    std::printf("吞吐：%.1f 条/s，%.1f tok/s（%ld tokens）\n", wall_s > 0 ? n_done / wall_s : 0.0, tps, n_tokens);
+    std::printf("TTFT ms：p50 %.1f  p90 %.1f  p99 %.1f\n", p50, p90, p99);
+    std::printf("单条 tok/s：p50 %.1f  p10 %.1f\n", r50, r10);
+    if (cancel->cancelled()) std::printf("已中断：剩余 %zu 条未完成，重新运行同一命令继续\n", items.size() - n_done);
+    sysbox::record_json("metrics", "info", std::string("{\"event\":\"batch_run\",\"ok\":") + std::to_string(n_ok) +
+                        ",\"failed\":" + std::to_string(n_failed) + ",\"skipped\":" + std::to_string(skipped) +
+                        ",\"window\":" + std::to_string(window) + ",\"s\":" + std::to_string(wall_s) +
+                        ",\"tokens_per_s\":" + std::to_string(tps) + ",\"ttft_p50_ms\":" + std::to_string(p50) +
+                        ",\"ttft_p90_ms\":" + std::to_string(p90) + ",\"ttft_p99_ms\":" + std::to_string(p99) +
+                        ",\"seq_tokens_per_s_p50\":" + std::to_string(r50) + ",\"seq_tokens_per_s_p10\":" + std::to_string(r10) +
+                        (cancel->cancelled() ? ",\"aborted\":true" : "") + "}");
+    return cancel->cancelled() ? 130 : (n_failed > 0 ? 2 : 0);
+}
+
+} // namespace cli
@@ -0,0 +1,10 @@
+#pragma once
+
+namespace cli {
+
+// aicli --batch in.jsonl --out out.jsonl [--model <name|path>] [--window N] [--think]：
+// 离线批量生成。输入每行一个 {"prompt": ..., "system"?, "max_tokens"?, "temperature"?, "id"?}，
+// 结果按完成顺序追加到 out，带输入行号 index；out 即检查点，重跑同一命令跳过已成功的行
+int run_batch(int argc, char** argv);
+
+} // namespace cli
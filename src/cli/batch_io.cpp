@@ -0,0 +1,191 @@
+#include "batch_io.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+namespace cli {
+
+namespace {
+
+void skip_ws(std::string_view s, size_t& i) {
+    while (i < s.size() && (s[i] == ' ' || s[i] == '\t' || s[i] == '\r' || s[i] == '\n')) ++i;
+}
+
+void append_utf8(std::string& out, uint32_t cp) {
+    if (cp < 0x80) out += (char)cp;
+    else if (cp < 0x800) { out += (char)(0xC0 | (cp >> 6)); out += (char)(0x80 | (cp & 0x3F)); }
+    else if (cp < 0x10000) { out += (char)(0xE0 | (cp >> 12)); out += (char)(0x80 | ((cp >> 6) & 0x3F)); out += (char)(0x80 | (cp & 0x3F)); }
+    else {
+        out += (char)(0xF0 | (cp >> 18)); out += (char)(0x80 | ((cp >> 12) & 0x3F));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F)); out += (char)(0x80 | (cp & 0x3F));
+    }
+}
+
+bool hex4(std::string_view s, size_t i, uint32_t& v) {
+    if (i + 4 > s.size()) return false;
+    v = 0;
+    for (size_t k = i; k < i + 4; ++k) {
+        const char c = s[k];
+        v <<= 4;
+        if (c >= '0' && c <= '9') v |= (uint32_t)(c - '0');
+        else if (c >= 'a' && c <= 'f') v |= (uint32_t)(c - 'a' + 10);
+        else if (c >= 'A' && c <= 'F') v |= (uint32_t)(c - 'A' + 10);
+        else return false;
+    }
+    return true;
+}
+
+// s[i] 为开引号；成功时 i 指向闭引号之后
+bool read_string(std::string_view s, size_t& i, std::string& out) {
+    out.clear();
+    for (++i; i < s.size(); ++i) {
+        const char c = s[i];
+        if (c == '"') { ++i; return true; }
+        if ((unsigned char)c < 0x20) return false;
+        if (c != '\\') { out += c; continue; }
+        if (++i >= s.size()) return false;
+        switch (s[i]) {
+        case '"': out += '"'; break;
+        case '\\': out += '\\'; break;
+        case '/': out += '/'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u': {
+            uint32_t cp = 0, lo = 0;
+            if (!hex4(s, i + 1, cp)) return false;
+            i += 4;
+            // 高代理后须紧跟低代理
+            if (cp >= 0xD800 && cp < 0xDC00 && s.substr(i + 1, 2) == "\\u" && hex4(s, i + 3, lo) && lo >= 0xDC00 && lo < 0xE000) {
+                cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+                i += 6;
+            } else if (cp >= 0xD800 && cp < 0xE000) {
+                cp = 0xFFFD;
+            }
+            append_utf8(out, cp);
+            break;
+        }
+        default: return false;
+        }
+    }
+    return false;
+}
+
+// 跳过一个非字符串值，按括号配对，跳过其中字符串内的括号
+bool skip_value(std::string_view s, size_t& i) {
+    int depth = 0;
+    std::string tmp;
+    while (i < s.size()) {
+        const char c = s[i];
+        if (c == '"') { if (!read_string(s, i, tmp)) return false; continue; }
+        if (c == '{' || c == '[') ++depth;
+        else if (c == '}' || c == ']') { if (depth == 0) return true; --depth; }
+        else if (c == ',' && depth == 0) return true;
+        ++i;
+    }
+    return depth == 0;
+}
+
+} // namespace
+
+bool parse_json_object(std::string_view s, std::map<std::string, std::string>& fields, std::string& err,
+                       std::map<std::string, std::string>* raw) {
+    fields.clear();
+    if (raw) raw->clear();
+    size_t i = 0;
+    skip_ws(s, i);
+    if (i >= s.size() || s[i] != '{') { err = "expected object"; return false; }
+    ++i;
+    skip_ws(s, i);
+    if (i < s.size() && s[i] == '}') { ++i; skip_ws(s, i); if (i == s.size()) return true; err = "trailing data"; return false; }
+    std::string key, value;
+    while (i < s.size()) {
+        if (s[i] != '"' || !read_string(s, i, key)) { err = "bad key"; return false; }
+        skip_ws(s, i);
+        if (i >= s.size() || s[i] != ':') { err = "expected ':' after " + key; return false; }
+        ++i;
+        skip_ws(s, i);
+        const size_t vb = i;
+        if (i < s.size() && s[i] == '"') {
+            if (!read_string(s, i, value)) { err = "bad string for " + key; return false; }
+            if (raw) (*raw)[key] = std::string(s.substr(vb, i - vb));
+        } else {
+            const size_t b = i;
+            if (!skip_value(s, i)) { err = "bad value for " + key; return false; }
+            size_t e = i;
+            while (e > b && (s[e - 1] == ' ' || s[e - 1] == '\t' || s[e - 1] == '\r' || s[e - 1] == '\n')) --e;
+            if (e == b) { err = "missing value for " + key; return false; }
+            value.assign(s.substr(b, e - b));
+            if (raw) (*raw)[key] = value;
+        }
+        fields[key] = value;
+        skip_ws(s, i);
+        if (i < s.size() && s[i] == ',') { ++i; skip_ws(s, i); continue; }
+        if (i < s.size() && s[i] == '}') {
+            ++i;
+            skip_ws(s, i);
+            if (i == s.size()) return true;
+            err = "trailing data";
+            return false;
+        }
+        break;
+    }
+    err = "unterminated object";
+    return false;
+}
+
+std::string json_quote(std::string_view s) {
+    std::string out = "\"";
+    out.reserve(s.size() + 8);
+    for (unsigned char c : s) {
+        if (c == '"') out += "\\\"";
+        else if (c == '\\') out += "\\\\";
+        else if (c == '\n') out += "\\n";
+        else if (c == '\r') out += "\\r";
+        else if (c == '\t') out += "\\t";
+        else if (c < 0x20) { char buf[8]; std::snprintf(buf, sizeof(buf), "\\u%04x", c); out += buf; }
+        else out += (char)c;
+    }
+    return out + "\"";
+}
+
+bool load_checkpoint(const std::string& path, std::unordered_set<long>& done, std::string& err) {
+    namespace fs = std::filesystem;
+    done.clear();
+    std::error_code ec;
+    if (!fs::exists(path, ec)) return true;
+    std::ifstream in(path, std::ios::binary);
+    if (!in) { err = "cannot read " + path; return false; }
+    const std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    in.close();
+    std::map<std::string, std::string> f;
+    std::string perr;
+    size_t pos = 0;
+    for (size_t nl; (nl = data.find('\n', pos)) != std::string::npos; pos = nl + 1) {
+        if (!parse_json_object(std::string_view(data).substr(pos, nl - pos), f, perr)) continue;
+        auto it = f.find("index");
+        if (it == f.end() || (f["ok"] != "true" && f["retry"] != "false")) continue;
+        try { done.insert(std::stol(it->second)); } catch (...) {}
+    }
+    if (pos < data.size()) {
+        fs::resize_file(path, pos, ec);
+        if (ec) { err = "cannot truncate " + path + ": " + ec.message(); return false; }
+    }
+    return true;
+}
+
+double percentile(std::vector<double>& v, double p) {
+    if (v.empty()) return 0.0;
+    std::sort(v.begin(), v.end());
+    const double idx = std::clamp(p, 0.0, 1.0) * (double)(v.size() - 1);
+    const size_t i = (size_t)idx;
+    const double frac = idx - (double)i;
+    return i + 1 < v.size() ? v[i] * (1 - frac) + v[i + 1] * frac : v[i];
+}
+
+} // namespace cli
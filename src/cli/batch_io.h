@@ -0,0 +1,26 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+namespace cli {
+
+// 解析一行 JSON 对象的顶层字段：字符串值按 JSON 转义解码（含 \uXXXX 与代理对），
+// 数字 / true / false / null / 嵌套对象与数组保留原文；raw 非空时另存各字段值的原始 JSON 文本。格式错误时返回 false
+bool parse_json_object(std::string_view text, std::map<std::string, std::string>& fields, std::string& err,
+                       std::map<std::string, std::string>* raw = nullptr);
+
+// 编码为带引号的 JSON 字符串
+std::string json_quote(std::string_view s);
+
+// 读取批处理输出文件作为检查点：收集 "ok":true 或 "retry":false（输入有误，重跑也不会成功）的行的 index。
+// 末尾未写完的半行（进程中途被杀）截掉，之后可直接追加；文件不存在视为空
+bool load_checkpoint(const std::string& path, std::unordered_set<long>& done, std::string& err);
+
+// 线性插值分位数，p 取 [0, 1]；v 会被排序
+double percentile(std::vector<double>& v, double p);
+
+} // namespace cli
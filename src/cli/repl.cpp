@@ -1,22 +1,32 @@
 #include "repl.h"
 
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
 #include <iostream>
 #include <memory>
 #include <string>
 
 #include "core/inference/engine.h"
+#include "core/inference/engine_pool.h"
 #include "core/inference/local_llama/llama_engine.h"
+#include "core/inference/tool_grammar.h"
 #include "core/conversation/session.h"
 #include "core/conversation/template.h"
 #include "core/sysbox/sysbox.h"
 #include "core/storage/sqlite_store.h"
 #include "core/tools/tools.h"
+#include "core/tools/schema.h"
 #include "utils/config.h"
 #include "core/fnshell/parser.h"
 #include "core/fnshell/evaluator.h"
 #include "core/inference/remote/openai_client.h"
 #include "core/inference/remote/gemini_client.h"
 #include "core/router/router.h"
+#include "think_filter.h"
+#include "batch_io.h"
+#include "sampling_config.h"
 
 namespace cli {
 
@@ -25,6 +35,15 @@ static std::shared_ptr<inference::Engine>& local_engine() {
     return engine;
 }
 
+// 本地模型池：/model 切换过的模型在内存预算内保持常驻
+static std::shared_ptr<inference::EnginePool>& engine_pool() {
+    static std::shared_ptr<inference::EnginePool> pool = std::make_shared<inference::EnginePool>(
+        [] { return inference::create_local_engine(); },
+        (uint64_t)std::max(0, config::get_int("AICLI_MODEL_BUDGET_MB", "local_model.memory_budget_mb", 0)) << 20,
+        config::get_env("AICLI_MODEL_DIR").value_or(config::get_value("local_model.model_dir").value_or("models")));
+    return pool;
+}
+
 static std::shared_ptr<inference::Engine>& cloud_engine() {
     static std::shared_ptr<inference::Engine> engine;
     return engine;
@@ -35,29 +54,61 @@ static std::unique_ptr<router::Router>& router_singleton() {
     return r;
 }
 
-Repl::~Repl() = default;
+// Ctrl-C：生成中只取消当前请求；空闲时按默认行为结束进程。
+// 指针在生成结束前清空，令牌要到下一轮对话开始时才释放
+static std::atomic<inference::CancelToken*> g_active_cancel{nullptr};
+
+static void on_sigint(int) {
+    if (inference::CancelToken* c = g_active_cancel.load()) { c->cancel(); return; }
+    std::signal(SIGINT, SIG_DFL);
+    std::raise(SIGINT);
+}
+
+Repl::~Repl() { wait_generation(); }
+
+void Repl::wait_generation() {
+    if (gen_thread_.joinable()) gen_thread_.join();
+}
+
+// 进程重启后从 SQLite 取回会话历史，使重新渲染的 prompt 与磁盘上的 KV 快照前缀一致
+static void load_persisted_history(conversation::SessionManager& sm, const std::string& name) {
+    if (!storage::sqlite_available() || !sm.history(name).empty()) return;
+    for (auto& m : storage::load_history(name)) sm.add_message(name, m);
+}
 
 void Repl::run() {
     tools::register_builtin_tools();
     sessions_.reset(new conversation::SessionManager());
     sessions_->ensure_session("default");
+    load_persisted_history(*sessions_, "default");
 
     std::cout << "aicli \n";
     std::cout << "输入以 '/' 开头的命令，例如 /help，其他输入将与 AI 对话。\n";
     std::cout << "输入 /exit 退出。\n";
 
+    std::signal(SIGINT, on_sigint);
     std::string line;
     while (true) {
-        std::cout << "> " << std::flush;
-        if (!std::getline(std::cin, line)) {
+        reading_ = true;
+        if (!generating_) std::cout << "> " << std::flush;
+        const bool got = (bool)std::getline(std::cin, line);
+        reading_ = false;
+        if (!got) {
             break;
         }
+        // 生成期间立即处理的命令；其余输入（含 /exit）排在当前回答之后
+        if (line == "/stop" || line == "/stats" || line == "/help") {
+            handle_command(line);
+            continue;
+        }
+        wait_generation();
         if (line.rfind('/', 0) == 0) {
             handle_command(line);
         } else {
             handle_chat(line);
         }
     }
+    wait_generation();
 }
 
 void Repl::handle_command(const std::string& line) {
@@ -69,12 +120,17 @@ void Repl::handle_command(const std::string& line) {
         std::cout << "  /help                       显示帮助\n";
         std::cout << "  /exit                       退出\n";
         std::cout << "  /config                     显示当前配置(占位)\n";
-        std::cout << "  /model <path>               加载本地 gguf 模型\n";
+        std::cout << "  /model <name|path>|list     切换/加载本地 gguf 模型（常驻模型池）\n";
+        std::cout << "  @<name> <text>              本轮使用模型池中的指定模型\n";
         std::cout << "  /session [name|list|clear|rm <name>]\n";
         std::cout << "  /render think on|off        切换显示 <think> 轨\n";
         std::cout << "  /stop                       中断当前生成\n";
+        std::cout << "  /stats                      显示本地模型 KV 占用（按会话）\n";
+        std::cout << "  /nbest <n> <text>           本地模型一次生成 n 个候选（不写入会话）\n";
+        std::cout << "  /lora [name|off]            列出 / 为当前会话选择 LoRA 适配器\n";
         std::cout << "  /tools list                 列出可用工具\n";
         std::cout << "  /tools run <name> <args-json> 运行工具\n";
+        std::cout << "  /tools auto on|off          允许模型在回答中调用工具\n";
         std::cout << "  /fn <expr>                  执行函数式 Shell 表达式\n";
         std::cout << "  /cloud openai|gemini|disable 启用/禁用云端 Provider\n";
     } else if (line == "/config") {
@@ -90,11 +146,35 @@ void Repl::handle_command(const std::string& line) {
         cmd_render(args);
     } else if (line == "/stop") {
         cmd_stop();
+    } else if (line == "/stats") {
+        cmd_stats();
+    } else if (line.rfind("/nbest", 0) == 0) {
+        cmd_nbest(line.substr(std::string("/nbest").size()));
+    } else if (line.rfind("/lora", 0) == 0) {
+        cmd_lora(line.substr(std::string("/lora").size()));
     } else if (line.rfind("/tools", 0) == 0) {
         auto rest = line.substr(std::string("/tools").size());
         auto ltrim = [](std::string& s){ s.erase(0, s.find_first_not_of(" \t")); };
         auto rtrim = [](std::string& s){ s.erase(s.find_last_not_of(" \t") + 1); };
         ltrim(rest); rtrim(rest);
+        if (rest == "auto on" || rest == "auto off") {
+            tool_calls_ = rest == "auto on";
+            if (tool_calls_ && !tool_grammar_) {
+                // 工具参数编译成调用文法，本地模型生成调用时按文法屏蔽 token
+                std::vector<inference::ToolGrammar::Tool> specs;
+                for (auto& t : tools::Registry::instance().list()) {
+                    specs.push_back({t.name, {}});
+                    for (auto& p : t.params) specs.back().params.push_back({p.name, p.type, p.required});
+                }
+                auto g = std::make_shared<inference::ToolGrammar>();
+                std::string err;
+                if (g->compile(specs, err)) tool_grammar_ = std::move(g);
+                else std::cout << "[提示] 工具文法编译失败，调用不加约束：" << err << "\n";
+            }
+            std::cout << "回答中调用工具：" << (tool_calls_ ? "ON" : "OFF") << "\n";
+            sysbox::record({"cli","info", std::string("tool_calls=") + (tool_calls_ ? "on" : "off")});
+            return;
+        }
         if (rest == "list") {
             auto v = tools::Registry::instance().list();
             for (auto& t : v) std::cout << t.name << " - " << t.description << "\n";
@@ -113,7 +193,7 @@ void Repl::handle_command(const std::string& line) {
             if (res.ok) std::cout << res.output_json << "\n"; else std::cout << "[工具错误] " << res.error << "\n";
             return;
         }
-        std::cout << "用法：/tools list 或 /tools run <name> <args-json>\n";
+        std::cout << "用法：/tools list | run <name> <args-json> | auto on|off\n";
     } else if (line.rfind("/fn", 0) == 0) {
         auto expr = line.substr(std::string("/fn").size());
         auto ltrim = [](std::string& s){ s.erase(0, s.find_first_not_of(" \t")); };
@@ -134,31 +214,33 @@ void Repl::handle_command(const std::string& line) {
     }
 }
 
-static void split_think_final(const std::string& full, bool show_think) {
-    if (!show_think) {
-        // 去除 <think>...</think> 片段
-        std::string out;
-        out.reserve(full.size());
-        size_t i = 0;
-        while (i < full.size()) {
-            size_t start = full.find("<think>", i);
-            if (start == std::string::npos) {
-                out.append(full.substr(i));
-                break;
-            }
-            out.append(full.substr(i, start - i));
-            size_t end = full.find("</think>", start);
-            if (end == std::string::npos) {
-                // 无闭合则丢弃后续
-                break;
-            }
-            i = end + 8; // 跳过 </think>
-        }
-        std::cout << out;
-    } else {
-        // 原样输出
-        std::cout << full;
+// 允许回答中调用工具时的 system prompt：列出工具与调用格式（与 Qwen 系列的 <tool_call> 约定一致）
+static std::string tool_system_prompt() {
+    std::string out = "你可以调用下列工具。需要时单独输出一段 <tool_call>{\"name\": 工具名, \"arguments\": 参数对象}</tool_call>，"
+                      "工具结果会以 <tool_response> 返回，之后再继续回答。\n工具：\n";
+    for (auto& t : tools::Registry::instance().list()) {
+        std::string params;
+        for (auto& p : t.params) params += (params.empty() ? "" : ", ") + p.name + ": " + p.type + (p.required ? "" : "（可选）");
+        out += "- " + t.name + "(" + params + ")：" + t.description + "\n";
     }
+    return out;
+}
+
+// 回答中途的工具调用：执行工具，结果按 ChatML 包成一条 user 消息接在序列末尾，再开启新的 assistant 段。
+// 包装与 TemplateBuilder 渲染 tool 消息的字节布局一致，下一轮渲染出的 prompt 与 KV 对得上
+static bool run_tool_call(const std::string& call, inference::ToolInjection& inject) {
+    const auto name = tools::extract_string_field(call, "name");
+    if (!name) return false;
+    const std::string args = tools::extract_object_field(call, "arguments").value_or("{}");
+    auto td = tools::Registry::instance().find(*name);
+    const tools::ToolResult res = td ? td->run(args) : tools::ToolResult{false, "", "unknown tool"};
+    std::cout << "\n[工具] " << *name << (res.ok ? "" : "（失败：" + res.error + "）") << "\n" << std::flush;
+    inject.open = "<|im_end|>\n<|im_start|>user\n<tool_response>\n";
+    inject.body = res.ok ? res.output_json : "{\"error\":" + json_quote(res.error) + "}";
+    // 正文里的结束标签写成 JSON 等价的 <\/tool_response>，重新渲染后仍能唯一确定工具结果段的边界
+    for (size_t p = 0; (p = inject.body.find("</tool_response>", p)) != std::string::npos; p += 2) inject.body.insert(p + 1, "\\");
+    inject.close = "\n</tool_response><|im_end|>\n<|im_start|>assistant\n";
+    return true;
 }
 
 static bool run_inline_tools(std::string& user_text) {
@@ -190,21 +272,36 @@ void Repl::handle_chat(const std::string& line) {
     if (line.empty()) {
         return;
     }
+    // "@<模型名> 内容"：本轮指定模型池中的本地模型
+    std::string model;
+    std::string text = line;
+    if (line[0] == '@') {
+        const auto sp = line.find(' ');
+        model = line.substr(1, sp == std::string::npos ? std::string::npos : sp - 1);
+        text = sp == std::string::npos ? std::string() : line.substr(sp + 1);
+        if (model.empty() || text.empty()) { std::cout << "用法：@<模型名> <内容>\n"; return; }
+    }
     // 优先使用路由器，回退到本地引擎
     auto& rt = router_singleton();
-    auto& local_eng = local_engine();
+    std::shared_ptr<inference::Engine> local_eng = local_engine();
+    if (!rt && !model.empty()) {
+        std::string err;
+        local_eng = engine_pool()->acquire(model, err);
+        if (!local_eng) { std::cout << "[错误] " << err << "\n"; return; }
+    }
     
     if (!rt && !local_eng) {
         std::cout << "[提示] 请先使用 /model 或 /cloud 配置引擎。\n";
         return;
     }
-    if (!rt && (!local_eng || !local_eng->is_loaded())) {
+    const bool local_ready = local_eng && (local_eng->is_loaded() || local_eng->is_loading());
+    if (!rt && !local_ready) {
         std::cout << "[提示] 请先使用 /model <path> 加载本地模型。\n";
         return;
     }
 
     const std::string& sname = sessions_->current();
-    std::string user_text = line;
+    std::string user_text = text;
     // 执行内联工具
     run_inline_tools(user_text);
 
@@ -213,6 +310,7 @@ void Repl::handle_chat(const std::string& line) {
     if (storage::sqlite_available()) storage::save_message(sname, umsg);
 
     conversation::RenderOptions ropts; ropts.use_chatml = true;
+    if (tool_calls_) ropts.system_prompt = tool_system_prompt();
     std::string prompt;
     if (ropts.use_chatml) {
         prompt = conversation::TemplateBuilder::render_chatml(sessions_->history(sname), ropts);
@@ -220,30 +318,108 @@ void Repl::handle_chat(const std::string& line) {
         prompt = conversation::TemplateBuilder::render_plain(sessions_->history(sname), ropts);
     }
 
+    // 生成交给工作线程，输入线程回到读取循环
+    gen_cancel_ = std::make_shared<inference::CancelToken>();
+    g_active_cancel = gen_cancel_.get();
+    generating_ = true;
+    gen_thread_ = std::thread(&Repl::generate_reply, this, std::move(local_eng), std::move(model), sname, std::move(prompt), gen_cancel_);
+}
+
+void Repl::generate_reply(std::shared_ptr<inference::Engine> local_eng, std::string model, std::string sname, std::string prompt,
+                          std::shared_ptr<inference::CancelToken> cancel) {
+    auto& rt = router_singleton();
     std::string buffer;
+    std::vector<conversation::Message> turn; // 本轮在 buffer 之前已完成的消息（工具调用及其结果）
     std::string err;
     inference::GenerateOptions opt;
+    apply_sampling_config(opt);
+    opt.cancel = cancel;
+    // prompt 按 ChatML 渲染：模型漏掉 EOS 时在下一个消息标记处停下，不再续写出 user 轮
+    opt.stop = {"<|im_end|>", "<|im_start|>"};
+    if (auto it = adapters_.find(sname); it != adapters_.end()) opt.adapter = it->second;
+    if (tool_calls_) {
+        // 工具结果直接接到本地序列末尾继续解码；历史中按 assistant（到 </tool_call> 为止）、tool、assistant（续写）分条记录
+        opt.tool_grammar = tool_grammar_;
+        opt.tool_handler = [&buffer, &turn](const std::string& call, inference::ToolInjection& inject) {
+            if (!run_tool_call(call, inject)) return false;
+            turn.push_back({"assistant", std::move(buffer)});
+            turn.push_back({"tool", inject.body});
+            buffer.clear();
+            return true;
+        };
+    }
     bool ok = false;
-    
+
+    // 边生成边输出：<think> 片段由状态机在流上过滤，标签跨 token 也能识别
+    using clock = std::chrono::steady_clock;
+    const auto t0 = clock::now();
+    clock::time_point t_first_token{}, t_first_display{};
+    ThinkFilter filter(show_think_);
+    std::string visible;
+    bool started = false;
+    int chunks = 0;
+    int64_t display_ns = 0;
+    auto display = [&](const std::string& s) {
+        if (s.empty()) return;
+        const auto t = clock::now();
+        if (!started) { std::cout << "AI："; started = true; t_first_display = t; }
+        std::cout << s << std::flush;
+        display_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - t).count();
+        ++chunks;
+    };
+    auto on_token = [&](std::string_view tok) {
+        if (t_first_token == clock::time_point{}) t_first_token = clock::now();
+        buffer += tok;
+        visible.clear();
+        filter.feed(tok, visible);
+        display(visible);
+    };
+
     if (rt) {
         // 使用路由器
-        ok = rt->generate(sname, prompt, opt, [&](const std::string& tok){ buffer += tok; }, err);
-    } else if (local_eng && local_eng->is_loaded()) {
+        ok = rt->generate_with_model(model, sname, prompt, opt, on_token, err);
+    } else {
         // 仅本地
-        ok = local_eng->generate_with_session(sname, prompt, opt, [&](const std::string& tok){ buffer += tok; }, err);
+        ok = local_eng->generate_with_session(sname, prompt, opt, on_token, err);
     }
-    
-    if (!ok) {
+    visible.clear();
+    filter.finish(visible);
+    display(visible);
+    if (started) std::cout << "\n";
+
+    g_active_cancel = nullptr;
+    const bool aborted = !ok && cancel->cancelled();
+    if (aborted) {
+        // 取消到生成返回的端到端延迟，云端请求同样计入；已输出的部分回答保留在历史中
+        std::cout << "[中断] 已停止生成\n";
+        sysbox::record_json("cli", "warn", std::string("{\"event\":\"abort\",\"abort_to_idle_ms\":") + std::to_string(cancel->ms_since_cancel()) +
+                            ",\"chars\":" + std::to_string(buffer.size()) + "}");
+    } else if (!ok) {
         std::cout << "[错误] 推理失败：" << err << "\n";
-        return;
     }
-    std::cout << "AI：";
-    split_think_final(buffer, show_think_);
-    std::cout << "\n";
+    if (!ok && (!aborted || (buffer.empty() && turn.empty()))) { finish_generation(); return; }
+    if (!started) std::cout << "AI：\n";
+    {
+        // 首 token 延迟与首个可见字符延迟（隐藏 think 时两者相差整段思考）；display_us 为每次写终端的平均耗时
+        auto ms = [&](clock::time_point t) { return t == clock::time_point{} ? -1.0 : std::chrono::duration<double, std::milli>(t - t0).count(); };
+        sysbox::record_json("cli", "info", std::string("{\"event\":\"stream\",\"ttft_ms\":") + std::to_string(ms(t_first_token)) +
+                            ",\"first_display_ms\":" + std::to_string(ms(t_first_display)) +
+                            ",\"total_ms\":" + std::to_string(ms(clock::now())) + ",\"chunks\":" + std::to_string(chunks) +
+                            ",\"display_us\":" + std::to_string(chunks > 0 ? display_ns / 1000.0 / chunks : 0.0) + "}");
+    }
+
+    turn.push_back({"assistant", std::move(buffer)});
+    for (const auto& m : turn) {
+        sessions_->add_message(sname, m);
+        if (storage::sqlite_available()) storage::save_message(sname, m);
+    }
+    finish_generation();
+}
 
-    conversation::Message amsg{"assistant", buffer};
-    sessions_->add_message(sname, amsg);
-    if (storage::sqlite_available()) storage::save_message(sname, amsg);
+// 工作线程收尾：输入线程已在等待新行时补打提示符
+void Repl::finish_generation() {
+    generating_ = false;
+    if (reading_) std::cout << "> " << std::flush;
 }
 
 void Repl::cmd_model(const std::string& args) {
@@ -251,9 +427,34 @@ void Repl::cmd_model(const std::string& args) {
     auto ltrim = [](std::string& s){ s.erase(0, s.find_first_not_of(" \t")); };
     auto rtrim = [](std::string& s){ s.erase(s.find_last_not_of(" \t") + 1); };
     std::string tmp = path; ltrim(tmp); rtrim(tmp); path = tmp;
-    if (path.empty()) { std::cout << "用法：/model <path-to-gguf>\n"; return; }
     auto& eng = local_engine(); if (!eng) { eng = inference::create_local_engine(); }
-    std::string err; if (eng->load_model(path, err)) { std::cout << "已加载模型：" << path << "\n"; sysbox::record({"cli","info","model loaded: "+path}); } else { std::cout << "加载失败：" << err << "\n"; sysbox::record({"cli","error","model load failed: "+err}); }
+    auto& pool = engine_pool();
+    if (path.empty()) {
+        if (eng->is_loading()) std::cout << "模型加载中：" << (int)(eng->load_progress() * 100) << "%\n";
+        std::cout << "用法：/model <name|path-to-gguf>|list\n";
+        return;
+    }
+    if (path == "list") {
+        std::cout << "模型池：" << (pool->used_bytes() >> 20) << " / " << (pool->budget_bytes() >> 20) << " MB\n";
+        for (auto& m : pool->list()) {
+            std::cout << "  " << m.name << "  " << (m.bytes >> 20) << " MB";
+            if (m.kv_bytes) std::cout << " + KV " << (m.kv_bytes >> 20) << " MB";
+            std::cout << "  " << (m.loading ? "加载中" : m.loaded ? "常驻" : "未加载")
+                      << (m.in_use ? "（使用中）" : "") << "\n";
+        }
+        return;
+    }
+    // 从模型池取：已常驻则直接切换，否则后台加载，REPL 不阻塞；加载期间的对话会等加载完成后开始生成
+    std::string err;
+    auto next = pool->acquire(path, err, [path](bool ok, const std::string& err) {
+        if (ok) { std::cout << "已加载模型：" << path << "\n"; sysbox::record({"cli","info","model loaded: "+path}); }
+        else { std::cout << "加载失败：" << err << "\n"; sysbox::record({"cli","error","model load failed: "+err}); }
+        std::cout.flush();
+    });
+    if (!next) { std::cout << "加载失败：" << err << "\n"; sysbox::record({"cli","error","model load failed: "+err}); return; }
+    if (next->is_loading()) std::cout << "正在后台加载模型：" << path << "\n";
+    eng = next;
+    if (auto& rt = router_singleton()) rt->set_local(eng);
 }
 
 void Repl::cmd_session(const std::string& args) {
@@ -290,6 +491,7 @@ void Repl::cmd_session(const std::string& args) {
     }
     sessions_->set_current(name);
     sessions_->ensure_session(name);
+    load_persisted_history(*sessions_, name);
     std::cout << "已切换到会话：" << name << "\n";
 }
 
@@ -306,12 +508,104 @@ void Repl::cmd_render(const std::string& args) {
 }
 
 void Repl::cmd_stop() {
-    auto& eng = local_engine(); if (eng) eng->request_abort();
-    auto& ceng = cloud_engine(); if (ceng) ceng->request_abort();
-    std::cout << "[中断] 已请求停止当前生成\n";
+    if (!generating_) { std::cout << "当前没有进行中的生成\n"; return; }
+    gen_cancel_->cancel();
     sysbox::record({"cli","warn","abort requested"});
 }
 
+void Repl::cmd_nbest(const std::string& args) {
+    const auto a = args.find_first_not_of(" \t");
+    const auto sp = a == std::string::npos ? std::string::npos : args.find(' ', a);
+    int n = 0;
+    try { if (sp != std::string::npos) n = std::stoi(args.substr(a, sp - a)); } catch (...) {}
+    const std::string text = sp == std::string::npos ? std::string() : args.substr(sp + 1);
+    if (n < 1 || text.find_first_not_of(" \t") == std::string::npos) { std::cout << "用法：/nbest <n> <内容>\n"; return; }
+    // 候选在输入线程上同步生成并占用全局中断槽，不能与后台回答并行
+    if (generating_) { std::cout << "[提示] 当前回答尚未结束，请等待完成或 /stop 后再试\n"; return; }
+    auto& eng = local_engine();
+    if (!eng || !(eng->is_loaded() || eng->is_loading())) { std::cout << "[提示] 请先使用 /model <path> 加载本地模型。\n"; return; }
+
+    // 以当前会话历史为上下文，但候选不写回历史
+    std::vector<conversation::Message> history = sessions_->history(sessions_->current());
+    history.push_back({"user", text});
+    conversation::RenderOptions ropts; ropts.use_chatml = true;
+    const std::string prompt = conversation::TemplateBuilder::render_chatml(history, ropts);
+
+    auto cancel = std::make_shared<inference::CancelToken>();
+    inference::GenerateOptions opt;
+    apply_sampling_config(opt);
+    opt.n = n;
+    opt.cancel = cancel;
+    opt.stop = {"<|im_end|>", "<|im_start|>"};
+    std::vector<std::string> out((size_t)n);
+    std::string err;
+    g_active_cancel = cancel.get();
+    const bool ok = eng->generate_n(prompt, opt, [&](int branch, std::string_view piece) { out[(size_t)branch] += piece; }, err);
+    g_active_cancel = nullptr;
+    for (int i = 0; i < n; ++i) {
+        if (out[(size_t)i].empty()) continue;
+        ThinkFilter filter(show_think_);
+        std::string visible;
+        filter.feed(out[(size_t)i], visible);
+        filter.finish(visible);
+        std::cout << "[候选 " << (i + 1) << "] " << visible << "\n";
+    }
+    if (!ok) std::cout << (cancel->cancelled() ? std::string("[中断] 已停止生成") : "[错误] 推理失败：" + err) << "\n";
+}
+
+void Repl::cmd_stats() {
+    auto& pool = engine_pool();
+    std::cout << "模型池：" << pool->list().size() << " 个模型，" << (pool->used_bytes() >> 20) << " / " << (pool->budget_bytes() >> 20) << " MB\n";
+    auto& eng = local_engine();
+    inference::EngineStats st;
+    if (!eng || !eng->get_stats(st)) { std::cout << "本地模型未加载\n"; return; }
+    auto mb = [](uint64_t b) { char buf[32]; std::snprintf(buf, sizeof(buf), "%.1f MB", b / 1048576.0); return std::string(buf); };
+    std::cout << "模型：" << st.model << "\n";
+    std::cout << "KV：" << st.kv_type_k << "/" << st.kv_type_v << "，flash_attn=" << st.flash_attn
+              << "，每 token " << (st.kv_bytes_per_token >> 10) << " KB，已用 " << mb(st.kv_used_bytes) << " / " << mb(st.kv_capacity_bytes)
+              << "（n_ctx=" << st.n_ctx << "，序列 " << st.n_seq_max << "）\n";
+    if (!st.adapters.empty()) {
+        std::cout << "权重：基座 " << mb(st.model_bytes) << "，LoRA";
+        for (auto& a : st.adapters) std::cout << " " << a.name << "=" << mb(a.bytes);
+        std::cout << "；当前 " << (st.active_adapter.empty() ? "基座" : st.active_adapter) << "，已切换 " << st.adapter_switches
+                  << " 次（平均 " << st.adapter_switch_us << " us）\n";
+    }
+    for (auto& s : st.sessions) {
+        std::cout << "  " << s.session_id << "  " << (s.resident ? std::to_string(s.tokens) + " tokens" : std::string("未驻留"));
+        if (s.shared_tokens > 0) std::cout << "（共享 " << s.shared_tokens << "）";
+        std::cout << "  " << mb(s.kv_bytes) << "\n";
+    }
+}
+
+void Repl::cmd_lora(const std::string& args) {
+    std::string a = args;
+    a.erase(0, a.find_first_not_of(" \t"));
+    a.erase(a.find_last_not_of(" \t") + 1);
+    const std::string& sname = sessions_->current();
+    auto& eng = local_engine();
+    inference::EngineStats st;
+    if (!eng || !eng->get_stats(st)) { std::cout << "本地模型未加载\n"; return; }
+    if (a.empty()) {
+        if (st.adapters.empty()) { std::cout << "未配置 LoRA 适配器（AICLI_LORA / local_model.lora）\n"; return; }
+        auto it = adapters_.find(sname);
+        for (auto& ad : st.adapters) {
+            const bool on = it != adapters_.end() && it->second == ad.name;
+            std::cout << (on ? "* " : "  ") << ad.name << "  " << (ad.bytes >> 20) << " MB  scale=" << ad.scale << "  " << ad.path << "\n";
+        }
+        return;
+    }
+    if (a == "off") {
+        adapters_.erase(sname);
+        std::cout << "会话 " << sname << " 使用基座模型\n";
+    } else {
+        const bool known = std::any_of(st.adapters.begin(), st.adapters.end(), [&](const inference::AdapterStats& ad) { return ad.name == a; });
+        if (!known) { std::cout << "未找到适配器：" << a << "\n"; return; }
+        adapters_[sname] = a;
+        std::cout << "会话 " << sname << " 使用适配器 " << a << "\n";
+    }
+    sysbox::record({"cli", "info", "lora " + sname + "=" + (a == "off" ? std::string("base") : a)});
+}
+
 void Repl::cmd_cloud(const std::string& args) {
     auto ltrim = [](std::string& s){ s.erase(0, s.find_first_not_of(" \t")); };
     auto rtrim = [](std::string& s){ s.erase(s.find_last_not_of(" \t") + 1); };
@@ -327,6 +621,7 @@ void Repl::cmd_cloud(const std::string& args) {
         std::string url = base_url ? *base_url : "https://api.openai.com/v1";
         cloud_engine() = inference::create_openai_engine(*key, url, "gpt-4o-mini");
         router_singleton() = std::make_unique<router::Router>(local_engine(), cloud_engine());
+        router_singleton()->set_pool(engine_pool());
         std::cout << "已启用 OpenAI（" << url << "，模型：gpt-4o-mini）\n";
         sysbox::record({"cli","info","cloud provider enabled: openai"});
         return;
@@ -341,6 +636,7 @@ void Repl::cmd_cloud(const std::string& args) {
         std::string url = base_url ? *base_url : "https://generativelanguage.googleapis.com/v1beta";
         cloud_engine() = inference::create_gemini_engine(*key, url, "gemini-1.5-flash");
         router_singleton() = std::make_unique<router::Router>(local_engine(), cloud_engine());
+        router_singleton()->set_pool(engine_pool());
         std::cout << "已启用 Gemini（" << url << "，模型：gemini-1.5-flash）\n";
         sysbox::record({"cli","info","cloud provider enabled: gemini"});
         return;
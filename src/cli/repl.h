@@ -1,9 +1,14 @@
 #pragma once
 
+#include <atomic>
 #include <string>
 #include <memory>
+#include <thread>
+#include <unordered_map>
 #include "core/conversation/session.h"
 
+namespace inference { class CancelToken; class Engine; class ToolGrammar; }
+
 namespace cli {
 
 class Repl {
@@ -16,6 +21,16 @@ private:
     void handle_command(const std::string& line);
     void handle_chat(const std::string& line);
 
+    // 生成在工作线程上进行，输入线程保持可响应 /stop 与 Ctrl-C；其余输入等当前生成结束后再处理
+    std::thread gen_thread_;
+    std::shared_ptr<inference::CancelToken> gen_cancel_;
+    std::atomic<bool> generating_{false};
+    std::atomic<bool> reading_{false}; // 输入线程正阻塞在读取新行上
+    void wait_generation();
+    void generate_reply(std::shared_ptr<inference::Engine> local_eng, std::string model, std::string sname, std::string prompt,
+                        std::shared_ptr<inference::CancelToken> cancel);
+    void finish_generation();
+
     // 简易引擎生命周期与调用
     void cmd_model(const std::string& args);
 
@@ -25,8 +40,16 @@ private:
 
     // 渲染控制
     bool show_think_ = false;
+    bool tool_calls_ = false; // /tools auto：允许模型在回答中调用工具
+    std::shared_ptr<const inference::ToolGrammar> tool_grammar_; // 由已注册工具的参数编译，约束调用正文
     void cmd_render(const std::string& args);
     void cmd_stop();
+    void cmd_stats();
+    void cmd_nbest(const std::string& args);
+
+    // LoRA 适配器：按会话选择，随每轮请求传给本地引擎
+    std::unordered_map<std::string, std::string> adapters_;
+    void cmd_lora(const std::string& args);
     
     // 云端 Provider
     void cmd_cloud(const std::string& args);
@@ -0,0 +1,51 @@
+#include "sampling_config.h"
+
+#include "utils/config.h"
+
+#include <string>
+#include <vector>
+
+namespace cli {
+
+static void read_float(const char* env_key, const char* dotted_key, float& out) {
+    auto v = config::get_env(env_key);
+    if (!v) v = config::get_value(dotted_key);
+    if (!v || v->empty()) return;
+    try { out = std::stof(*v); } catch (...) {}
+}
+
+// 中断串以 | 分隔，支持 \n \t \| \\ 转义
+static void read_breakers(std::vector<std::string>& out) {
+    auto v = config::get_env("AICLI_DRY_BREAKERS");
+    if (!v) v = config::get_value("sampling.dry_sequence_breakers");
+    if (!v || v->empty()) return;
+    std::vector<std::string> list(1);
+    for (size_t i = 0; i < v->size(); ++i) {
+        char c = (*v)[i];
+        if (c == '|') { list.emplace_back(); continue; }
+        if (c == '\\' && i + 1 < v->size()) {
+            c = (*v)[++i];
+            if (c == 'n') c = '\n';
+            else if (c == 't') c = '\t';
+        }
+        list.back() += c;
+    }
+    out.clear();
+    for (auto& s : list) if (!s.empty()) out.push_back(std::move(s));
+}
+
+void apply_sampling_config(inference::GenerateOptions& opt) {
+    read_float("AICLI_TEMPERATURE", "sampling.temperature", opt.temperature);
+    read_float("AICLI_TOP_P", "sampling.top_p", opt.top_p);
+    opt.top_k = config::get_int("AICLI_TOP_K", "sampling.top_k", opt.top_k);
+    read_float("AICLI_MIN_P", "sampling.min_p", opt.min_p);
+    read_float("AICLI_TYPICAL_P", "sampling.typical_p", opt.typical_p);
+    opt.penalty_last_n = config::get_int("AICLI_PENALTY_LAST_N", "sampling.penalty_last_n", opt.penalty_last_n);
+    read_float("AICLI_REPEAT_PENALTY", "sampling.repeat_penalty", opt.repeat_penalty);
+    read_float("AICLI_FREQUENCY_PENALTY", "sampling.frequency_penalty", opt.frequency_penalty);
+    read_float("AICLI_PRESENCE_PENALTY", "sampling.presence_penalty", opt.presence_penalty);
+    read_float("AICLI_DRY_MULTIPLIER", "sampling.dry_multiplier", opt.dry_multiplier);
+    read_breakers(opt.dry_sequence_breakers);
+}
+
+} // namespace cli
@@ -0,0 +1,10 @@
+#pragma once
+
+#include "core/inference/engine.h"
+
+namespace cli {
+
+// 按 环境变量 > 配置文件 sampling 节 覆盖采样参数；未配置的项保持 GenerateOptions 的默认值（各附加阶段默认关闭）
+void apply_sampling_config(inference::GenerateOptions& opt);
+
+} // namespace cli
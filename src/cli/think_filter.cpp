@@ -0,0 +1,46 @@
+#include "think_filter.h"
+
+#include <algorithm>
+
+namespace cli {
+
+static constexpr std::string_view kOpen = "<think>";
+static constexpr std::string_view kClose = "</think>";
+
+// s 的最长真后缀、同时是 tag 的前缀的长度
+static size_t partial_tag(std::string_view s, std::string_view tag) {
+    for (size_t n = std::min(s.size(), tag.size() - 1); n > 0; --n) {
+        if (s.substr(s.size() - n) == tag.substr(0, n)) return n;
+    }
+    return 0;
+}
+
+void ThinkFilter::feed(std::string_view chunk, std::string& out) {
+    if (show_) { out.append(chunk); return; }
+    carry_.append(chunk);
+    std::string_view rest = carry_;
+    while (!rest.empty()) {
+        const std::string_view tag = in_think_ ? kClose : kOpen;
+        const size_t pos = rest.find(tag);
+        if (pos != std::string_view::npos) {
+            if (!in_think_) out.append(rest.substr(0, pos));
+            rest.remove_prefix(pos + tag.size());
+            in_think_ = !in_think_;
+            continue;
+        }
+        // 没有完整标签：留下可能是标签开头的尾部，其余按状态输出或丢弃
+        const size_t keep = partial_tag(rest, tag);
+        if (!in_think_) out.append(rest.substr(0, rest.size() - keep));
+        rest.remove_prefix(rest.size() - keep);
+        break;
+    }
+    carry_.erase(0, carry_.size() - rest.size());
+}
+
+void ThinkFilter::finish(std::string& out) {
+    if (!in_think_) out.append(carry_);
+    carry_.clear();
+    in_think_ = false;
+}
+
+} // namespace cli
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+namespace cli {
+
+// 流式 <think> 过滤：逐块喂入模型输出，隐藏 <think>…</think> 片段，标签可以跨块拆分。
+// 可能是标签开头的尾部字节先留在内部，等下一块确认后再输出
+class ThinkFilter {
+public:
+    explicit ThinkFilter(bool show_think = false) : show_(show_think) {}
+
+    // 把 chunk 中可见的部分追加到 out
+    void feed(std::string_view chunk, std::string& out);
+    // 输出结束：冲掉留存的字节；未闭合的 <think> 之后的内容丢弃
+    void finish(std::string& out);
+
+    bool in_think() const { return in_think_; }
+
+private:
+    bool show_;
+    bool in_think_ = false;
+    std::string carry_;
+};
+
+} // namespace cli
@@ -0,0 +1,72 @@
+#include "tune.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "core/inference/engine_pool.h"
+#include "core/inference/local_llama/llama_engine.h"
+#include "core/inference/local_llama/thread_config.h"
+#include "core/sysbox/sysbox.h"
+#include "utils/config.h"
+
+namespace cli {
+
+int run_tune(int argc, char** argv) {
+    std::string model;
+    bool dry_run = false;
+    for (int i = 0; i < argc; ++i) {
+        const std::string a = argv[i];
+        if (a == "--dry-run") dry_run = true;
+        else if (model.empty()) model = a;
+    }
+    if (model.empty()) model = config::get_value("local_model.default_model").value_or("");
+    const std::string model_dir = config::get_env("AICLI_MODEL_DIR").value_or(config::get_value("local_model.model_dir").value_or("models"));
+    const std::string path = inference::EnginePool::resolve(model_dir, model);
+    if (path.empty()) {
+        std::cout << "用法：aicli tune [<name|path-to-gguf>] [--dry-run]\n未找到模型：" << model << "\n";
+        return 1;
+    }
+
+    inference::LlamaEngine eng;
+    std::string err;
+    std::cout << "加载模型：" << path << "\n";
+    if (!eng.load_model(path, err)) { std::cout << "加载失败：" << err << "\n"; return 1; }
+
+    // 绑核时线程数不超过绑定的核数
+    int hw = (int)std::max(1u, std::thread::hardware_concurrency());
+    std::vector<int> cpus;
+    const std::string affinity = config::get_env("AICLI_CPU_AFFINITY").value_or(config::get_value("local_model.cpu_affinity").value_or(""));
+    if (!affinity.empty() && inference::parse_cpu_list(affinity, cpus)) hw = std::min(hw, (int)cpus.size());
+    const auto candidates = inference::thread_candidates(hw);
+
+    std::vector<inference::LlamaEngine::ThreadBench> res;
+    std::cout << "扫描线程数：";
+    for (int t : candidates) std::cout << ' ' << t;
+    std::cout << std::endl;
+    if (!eng.bench_threads(candidates, 256, 32, res, err) || res.empty()) { std::cout << "基准失败：" << err << "\n"; return 1; }
+
+    std::printf("%-8s %16s %16s\n", "threads", "prefill_tok/s", "decode_tok/s");
+    for (auto& r : res) std::printf("%-8d %16.1f %16.1f\n", r.threads, r.prefill_tokens_per_s, r.decode_tokens_per_s);
+    const auto& bp = *std::max_element(res.begin(), res.end(), [](auto& a, auto& b) { return a.prefill_tokens_per_s < b.prefill_tokens_per_s; });
+    const auto& bd = *std::max_element(res.begin(), res.end(), [](auto& a, auto& b) { return a.decode_tokens_per_s < b.decode_tokens_per_s; });
+    std::cout << "最佳：threads=" << bd.threads << " threads_batch=" << bp.threads << "\n";
+    sysbox::record_json("metrics", "info", std::string("{\"event\":\"thread_tune\",\"threads\":") + std::to_string(bd.threads) +
+                        ",\"decode_tokens_per_s\":" + std::to_string(bd.decode_tokens_per_s) + ",\"threads_batch\":" + std::to_string(bp.threads) +
+                        ",\"prefill_tokens_per_s\":" + std::to_string(bp.prefill_tokens_per_s) + ",\"pinned\":" + (bd.pinned ? "true" : "false") + "}");
+    eng.unload_model();
+
+    if (dry_run) return 0;
+    if (!config::set_value("local_model.threads", std::to_string(bd.threads), err) ||
+        !config::set_value("local_model.threads_batch", std::to_string(bp.threads), err)) {
+        std::cout << "写入配置失败：" << err << "\n";
+        return 1;
+    }
+    std::cout << "已写入配置：local_model.threads / local_model.threads_batch\n";
+    return 0;
+}
+
+} // namespace cli
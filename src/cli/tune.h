@@ -0,0 +1,8 @@
+#pragma once
+
+namespace cli {
+
+// aicli tune [model] [--dry-run]：在本机上扫描线程数，把最快的 threads / threads_batch 写回配置
+int run_tune(int argc, char** argv);
+
+} // namespace cli
@@ -7,7 +7,7 @@
 namespace conversation {
 
 struct Message {
-    std::string role;  // system/user/assistant
+    std::string role;  // system/user/assistant/tool（回答中途的工具结果）
     std::string content;
 };
 
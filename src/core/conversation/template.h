@@ -35,6 +35,14 @@ public:
             out += "<|im_end|>\n";
         }
         for (const auto& m : history) {
+            // 工具结果按 Qwen 约定放在 user 段的 <tool_response> 中，与生成中途接入序列的字节布局一致；
+            // 包装须与 PromptTokenCache::kToolResponseOpen / kToolResponseClose 相同，正文才会按普通文本 tokenize
+            if (m.role == "tool") {
+                out += "<|im_start|>user\n<tool_response>\n";
+                out += m.content;
+                out += "\n</tool_response><|im_end|>\n";
+                continue;
+            }
             out += "<|im_start|>";
             out += m.role;
             out += "\n";
@@ -0,0 +1,41 @@
+#include "embed_batch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+namespace inference {
+
+std::vector<std::vector<int>> pack_embed_batches(const std::vector<int>& lengths, int n_batch, int n_seq) {
+    std::vector<std::vector<int>> bins;
+    if (n_batch <= 0 || n_seq <= 0) return bins;
+    std::vector<int> order(lengths.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return lengths[a] > lengths[b]; });
+    std::vector<int> room;  // 各 batch 剩余的 token 容量
+    size_t open = 0;        // 第一个仍可能放得下文本的 batch
+    for (int i : order) {
+        const int len = std::clamp(lengths[i], 1, n_batch);
+        size_t b = open;
+        while (b < bins.size() && (room[b] < len || (int)bins[b].size() >= n_seq)) ++b;
+        if (b == bins.size()) {
+            bins.emplace_back();
+            room.push_back(n_batch);
+        }
+        bins[b].push_back(i);
+        room[b] -= len;
+        // 长度降序：剩余容量为 0 或序列已满的前缀 batch 以后也用不上
+        while (open < bins.size() && (room[open] == 0 || (int)bins[open].size() >= n_seq)) ++open;
+    }
+    return bins;
+}
+
+void l2_normalize(float* v, int dim) {
+    double sum = 0.0;
+    for (int i = 0; i < dim; ++i) sum += (double)v[i] * v[i];
+    if (sum <= 0.0) return;
+    const float inv = (float)(1.0 / std::sqrt(sum));
+    for (int i = 0; i < dim; ++i) v[i] *= inv;
+}
+
+} // namespace inference
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <vector>
+
+namespace inference {
+
+// 嵌入批量装箱：每个 batch 的 token 总数不超过 n_batch、序列数不超过 n_seq。
+// 按长度降序做首次适配，短文本填进长文本留下的空隙，batch 数接近 token 总数 / n_batch。
+// lengths 中超过 n_batch 的按 n_batch 计（调用方负责截断）；返回各 batch 内的文本下标
+std::vector<std::vector<int>> pack_embed_batches(const std::vector<int>& lengths, int n_batch, int n_seq);
+
+// 原地 L2 归一化；零向量保持不变
+void l2_normalize(float* v, int dim);
+
+} // namespace inference
@@ -1,19 +1,153 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace inference {
 
+class ToolGrammar;
+
+// 请求级取消令牌：调用方在任意线程 cancel()，引擎在解码步之间（本地引擎也在 llama_decode 内部）检查。
+// 只读写一个无锁原子量，可在信号处理函数中调用
+class CancelToken {
+public:
+    void cancel() {
+        int64_t expected = 0;
+        const int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+        t_cancel_.compare_exchange_strong(expected, now != 0 ? now : 1);
+    }
+    bool cancelled() const { return t_cancel_.load(std::memory_order_relaxed) != 0; }
+    // 自 cancel() 起经过的毫秒数；未取消时为 -1
+    double ms_since_cancel() const {
+        const int64_t t = t_cancel_.load(std::memory_order_relaxed);
+        if (t == 0) return -1.0;
+        const auto d = std::chrono::steady_clock::now().time_since_epoch() - std::chrono::steady_clock::duration(t);
+        return std::chrono::duration<double, std::milli>(d).count();
+    }
+
+private:
+    std::atomic<int64_t> t_cancel_{0}; // cancel() 时刻（steady_clock 计数），0 表示未取消
+};
+
+// 接到序列末尾的工具结果：open / close 为对话模板标记（如结束本轮、开启 user 段与新一轮 assistant 开头），
+// 按特殊 token 解析；body 为工具输出原文，不解析特殊 token，其中的 <|im_end|> 等字样不会变成控制 token
+struct ToolInjection {
+    std::string open;
+    std::string body;
+    std::string close;
+};
+
+// 回答中途的工具调用：call 为输出中 <tool_call> 与 </tool_call> 之间的文本，inject 返回要直接接到序列末尾的内容，
+// 随后从现有 KV 继续解码。在调用 generate 的线程上执行；返回 false 时就此结束生成
+using ToolHandler = std::function<bool(const std::string& call, ToolInjection& inject)>;
+
 struct GenerateOptions {
     int max_new_tokens = 256;
     float temperature = 0.7f;
     float top_p = 0.95f;
+    // 以下附加阶段默认关闭，由调用方按配置开启（见 sampling 配置节）
+    int top_k = 0;                  // <=0 关闭
+    float min_p = 0.0f;             // 0 关闭
+    float typical_p = 1.0f;         // 1 关闭
+
+    // 重复惩罚：统计最近 penalty_last_n 个 token
+    int penalty_last_n = 64;
+    float repeat_penalty = 1.0f;    // 1 关闭
+    float frequency_penalty = 0.0f;
+    float presence_penalty = 0.0f;
+
+    // DRY 惩罚：对会延续已出现 n-gram 的 token 施加指数惩罚，multiplier=0 关闭
+    float dry_multiplier = 0.0f;
+    float dry_base = 1.75f;
+    int dry_allowed_length = 2;
+    int dry_penalty_last_n = 512;
+    // 中断串：piece 含任一中断串的 token 截断重复匹配，避免惩罚换行、字段、引号等正常结构
+    std::vector<std::string> dry_sequence_breakers = {"\n", ":", "\"", "*"};
+
+    // n-best 候选数，仅 generate_n 使用：本地引擎只 prefill 一次，各候选共享 prompt 的 KV
+    int n = 1;
+
+    // 工具调用回调，为空时不识别工具调用；目前只有本地引擎支持
+    ToolHandler tool_handler;
+    // 工具调用文法：非空时 <tool_call> 之内按文法屏蔽 token，调用正文必定能按 schema 解析
+    std::shared_ptr<const ToolGrammar> tool_grammar;
+
+    // 停止串：输出中出现任一停止串即结束生成，停止串及其后的内容不输出（可跨 token 匹配）
+    std::vector<std::string> stop;
+
+    // 取消令牌：为空时请求只能被 request_abort() 整体中断。取消后生成以 err == "aborted" 返回
+    std::shared_ptr<CancelToken> cancel;
+
+    // LoRA 适配器名（随基座模型加载，见 EngineStats::adapters），空表示基座模型；未知名称时生成失败
+    std::string adapter;
+};
+
+// 引擎状态读数（/stats）：KV 占用按会话统计
+struct SessionStats {
+    std::string session_id;
+    int tokens = 0;          // 驻留在 KV 中的 token 数
+    int shared_tokens = 0;   // 其中与其他序列共享 cell 的开头 token 数
+    uint64_t kv_bytes = 0;   // 本会话独占的 KV 字节数
+    bool resident = false;   // 是否占用 KV 序列（否则仅有磁盘快照或空状态）
 };
 
-using StreamCallback = std::function<void(const std::string&)>;
+struct AdapterStats {
+    std::string name;
+    std::string path;
+    float scale = 1.0f;
+    uint64_t bytes = 0;      // 适配器权重大小（加载时整体读入，与基座权重分开统计）
+};
+
+struct EngineStats {
+    std::string model;
+    int n_ctx = 0;
+    int n_seq_max = 0;
+    std::string kv_type_k;
+    std::string kv_type_v;
+    std::string flash_attn;          // on / off / auto
+    uint64_t kv_bytes_per_token = 0;
+    uint64_t kv_capacity_bytes = 0;  // n_ctx 个 cell 的总大小（上下文创建时一次分配）
+    uint64_t kv_used_bytes = 0;
+    std::vector<SessionStats> sessions;
+    uint64_t model_bytes = 0;        // 基座权重大小，不含适配器
+    std::vector<AdapterStats> adapters;
+    std::string active_adapter;      // 当前作用于 context 的适配器，空为基座
+    int adapter_switches = 0;        // 累计切换次数与平均每次切换耗时
+    double adapter_switch_us = 0.0;
+};
+
+// 句向量池化方式：Model 取模型元数据中的默认值（未声明时用 Last）
+enum class Pooling { Model, Mean, Cls, Last };
+
+struct EmbedOptions {
+    Pooling pooling = Pooling::Model;
+    bool normalize = true;          // L2 归一化，内积即余弦相似度
+    std::shared_ptr<CancelToken> cancel;
+};
+
+// 嵌入结果：rows 条文本 × dim 维，按行连续存放
+struct EmbeddingMatrix {
+    int rows = 0;
+    int dim = 0;
+    std::vector<float> data;
+    const float* row(int i) const { return data.data() + (size_t)i * dim; }
+};
+
+// 流式回调：piece 只在回调期间有效（本地引擎指向预构建的 piece 表），需要保留时自行拷贝
+using StreamCallback = std::function<void(std::string_view)>;
+
+// n-best 流式回调：branch 为候选序号 [0, n)，同一请求的回调串行调用
+using BranchStreamCallback = std::function<void(int branch, std::string_view)>;
+
+// 异步加载完成回调：在加载线程上调用
+using LoadCallback = std::function<void(bool ok, const std::string& err)>;
 
 class Engine {
 public:
@@ -22,6 +156,16 @@ public:
     virtual void unload_model() = 0;
     virtual bool is_loaded() const = 0;
 
+    // 后台加载模型，立即返回；加载期间提交的生成请求等待加载结束。默认同步加载
+    virtual void load_model_async(const std::string& model_path, LoadCallback done) {
+        std::string err;
+        const bool ok = load_model(model_path, err);
+        if (done) done(ok, err);
+    }
+    virtual bool is_loading() const { return false; }
+    // 加载进度 [0, 1]
+    virtual float load_progress() const { return is_loaded() ? 1.0f : 0.0f; }
+
     virtual bool generate(const std::string& prompt,
                           const GenerateOptions& options,
                           const StreamCallback& on_token,
@@ -38,13 +182,37 @@ public:
         return generate(prompt, options, on_token, err);
     }
 
+    // 无会话地生成 options.n 个候选；任一候选失败返回 false。默认逐个调用 generate
+    virtual bool generate_n(const std::string& prompt,
+                            const GenerateOptions& options,
+                            const BranchStreamCallback& on_token,
+                            std::string& err) {
+        for (int i = 0; i < std::max(1, options.n); ++i) {
+            if (!generate(prompt, options, [&](std::string_view piece) { on_token(i, piece); }, err)) return false;
+        }
+        return true;
+    }
+
+    // 批量计算文本嵌入：out 第 i 行对应 texts[i]。超出单个 batch 的文本被截断。默认不支持
+    virtual bool embed(const std::vector<std::string>& texts, const EmbedOptions& options, EmbeddingMatrix& out, std::string& err) {
+        (void)texts; (void)options; (void)out;
+        err = "embeddings not supported";
+        return false;
+    }
+
     // 重置会话：清理对应序列的 KV/状态
     virtual void reset_session(const std::string& session_id) {
         (void)session_id;
     }
 
-    // 请求取消当前推理；默认空实现
+    // 取消本引擎上所有进行中与排队的请求；单个请求用 GenerateOptions::cancel。默认空实现
     virtual void request_abort() {}
+
+    // 读取引擎状态；不支持时返回 false
+    virtual bool get_stats(EngineStats& out) {
+        (void)out;
+        return false;
+    }
 };
 
 // 获取本地引擎实例（llama 或占位实现）
@@ -0,0 +1,139 @@
+#include "engine_pool.h"
+#include "core/sysbox/sysbox.h"
+
+#include <algorithm>
+#include <filesystem>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace inference {
+
+static uint64_t physical_memory() {
+#if defined(_SC_PHYS_PAGES) && defined(_SC_PAGESIZE)
+    const long pages = sysconf(_SC_PHYS_PAGES), page = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && page > 0) return (uint64_t)pages * (uint64_t)page;
+#endif
+    return 8ull << 30;
+}
+
+EnginePool::EnginePool(Factory factory, uint64_t budget_bytes, std::string model_dir)
+    : factory_(std::move(factory)), budget_(budget_bytes ? budget_bytes : physical_memory() / 2), model_dir_(std::move(model_dir)) {}
+
+std::string EnginePool::model_name(const std::string& path) {
+    fs::path p(path);
+    return p.extension() == ".gguf" ? p.stem().string() : p.filename().string();
+}
+
+std::string EnginePool::resolve(const std::string& model_dir, const std::string& name_or_path) {
+    std::error_code ec;
+    if (fs::is_regular_file(name_or_path, ec)) return name_or_path;
+    if (model_dir.empty()) return {};
+    for (const std::string& f : {name_or_path + ".gguf", name_or_path}) {
+        fs::path p = fs::path(model_dir) / f;
+        if (fs::is_regular_file(p, ec)) return p.string();
+    }
+    return {};
+}
+
+// 加载失败的条目既未加载也不在加载中，直接移出池
+void EnginePool::prune_failed(std::vector<std::shared_ptr<Engine>>& dropped) {
+    entries_.erase(std::remove_if(entries_.begin(), entries_.end(), [&](Entry& e) {
+        if (e.engine->is_loaded() || e.engine->is_loading() || e.engine.use_count() > 1) return false;
+        dropped.push_back(std::move(e.engine));
+        return true;
+    }), entries_.end());
+}
+
+// 按 LRU 卸载空闲模型，直到再放得下 need 字节；无可淘汰时返回 false
+bool EnginePool::evict_for(uint64_t need, std::vector<std::shared_ptr<Engine>>& dropped) {
+    auto used = [&] { uint64_t n = 0; for (auto& e : entries_) n += e.footprint(); return n; };
+    while (used() + need > budget_) {
+        auto victim = entries_.end();
+        for (auto it = entries_.begin(); it != entries_.end(); ++it) {
+            if (it->engine.use_count() > 1 || it->engine->is_loading()) continue;
+            if (victim == entries_.end() || it->last_used < victim->last_used) victim = it;
+        }
+        if (victim == entries_.end()) return false;
+        sysbox::record_json("inference", "info", std::string("{\"event\":\"pool_evict\",\"model\":\"") + victim->name +
+                            "\",\"mb\":" + std::to_string(victim->footprint() >> 20) + "}");
+        dropped.push_back(std::move(victim->engine));
+        entries_.erase(victim);
+    }
+    return true;
+}
+
+std::shared_ptr<Engine> EnginePool::acquire(const std::string& name_or_path, std::string& err, LoadCallback done) {
+    const std::string path = resolve(name_or_path);
+    if (path.empty()) { err = "model not found: " + name_or_path; return nullptr; }
+    const std::string name = model_name(path);
+    std::shared_ptr<Engine> eng;
+    std::vector<std::shared_ptr<Engine>> dropped; // 在锁外析构
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        prune_failed(dropped);
+        for (auto& e : entries_) {
+            if (e.name != name) continue;
+            e.last_used = ++clock_;
+            eng = e.engine;
+            break;
+        }
+        if (!eng) {
+            std::error_code ec;
+            const uint64_t bytes = fs::file_size(path, ec);
+            // 单个模型超出预算时仍允许加载，但必须先腾空其余空闲模型
+            if (!evict_for(std::min(bytes, budget_), dropped) || (bytes > budget_ && !entries_.empty())) {
+                err = "model memory budget exceeded (" + std::to_string(budget_ >> 20) + " MB)";
+                return nullptr;
+            }
+            eng = std::shared_ptr<Engine>(factory_());
+            auto kv = std::make_shared<std::atomic<uint64_t>>(0);
+            entries_.push_back({name, path, bytes, ++clock_, eng, kv});
+            sysbox::record_json("inference", "info", std::string("{\"event\":\"pool_load\",\"model\":\"") + name +
+                                "\",\"mb\":" + std::to_string(bytes >> 20) + ",\"budget_mb\":" + std::to_string(budget_ >> 20) + "}");
+            // KV 在加载时按 n_ctx 一次分配，加载完成后计入常驻大小；回调运行期间引擎必然存活（析构会等待加载线程）
+            Engine* raw = eng.get();
+            eng->load_model_async(path, [raw, kv, done = std::move(done)](bool ok, const std::string& e) {
+                EngineStats st;
+                if (ok && raw->get_stats(st)) kv->store(st.kv_capacity_bytes);
+                if (done) done(ok, e);
+            });
+            return eng;
+        }
+    }
+    // 同名模型仍在加载中时不回调，由发起加载的那次 acquire 回调
+    if (done && !eng->is_loading()) done(eng->is_loaded(), eng->is_loaded() ? std::string() : "model not loaded");
+    return eng;
+}
+
+void EnginePool::unload(const std::string& name) {
+    std::shared_ptr<Engine> victim;
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        auto it = std::find_if(entries_.begin(), entries_.end(), [&](const Entry& e) { return e.name == name; });
+        if (it == entries_.end()) return;
+        victim = std::move(it->engine);
+        entries_.erase(it);
+    }
+    victim->unload_model();
+}
+
+std::vector<EnginePool::ModelInfo> EnginePool::list() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    std::vector<ModelInfo> out;
+    for (auto& e : entries_) {
+        out.push_back({e.name, e.path, e.bytes, e.kv_bytes->load(), e.engine->is_loaded(), e.engine->is_loading(), e.engine.use_count() > 1});
+    }
+    return out;
+}
+
+uint64_t EnginePool::used_bytes() const {
+    std::lock_guard<std::mutex> lk(mu_);
+    uint64_t n = 0;
+    for (auto& e : entries_) n += e.footprint();
+    return n;
+}
+
+} // namespace inference
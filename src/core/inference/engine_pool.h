@@ -0,0 +1,70 @@
+#pragma once
+
+#include "core/inference/engine.h"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace inference {
+
+// 本地模型池：按模型名（model_dir 下 gguf 文件名去掉扩展名）缓存已加载的引擎，
+// 常驻大小（权重 + 加载后一次分配的 KV 容量）超出内存预算时按 LRU 卸载空闲模型。被调用方持有（use_count > 1）或加载中的模型不淘汰
+class EnginePool {
+public:
+    using Factory = std::function<std::unique_ptr<Engine>()>;
+
+    struct ModelInfo {
+        std::string name;
+        std::string path;
+        uint64_t bytes = 0;      // 权重（gguf 文件大小）
+        uint64_t kv_bytes = 0;   // KV 容量，加载完成后才计入
+        bool loaded = false;
+        bool loading = false;
+        bool in_use = false;
+    };
+
+    // budget_bytes 为 0 时取物理内存的一半
+    EnginePool(Factory factory, uint64_t budget_bytes, std::string model_dir);
+
+    // 模型名 → 文件路径：已存在的路径原样返回，否则在 model_dir 中查找 <name>.gguf 或 <name>；找不到返回空
+    std::string resolve(const std::string& name_or_path) const { return resolve(model_dir_, name_or_path); }
+    static std::string resolve(const std::string& model_dir, const std::string& name_or_path);
+    static std::string model_name(const std::string& path);
+
+    // 取常驻引擎，或为其腾出预算后开始后台加载；done 在加载结束时回调（已常驻时立即回调，
+    // 同名模型已在加载中时不回调）。返回的引擎可能仍在加载中，生成请求会等待加载完成
+    std::shared_ptr<Engine> acquire(const std::string& name_or_path, std::string& err, LoadCallback done = nullptr);
+
+    void unload(const std::string& name);
+    std::vector<ModelInfo> list() const;
+    uint64_t used_bytes() const;
+    uint64_t budget_bytes() const { return budget_; }
+
+private:
+    struct Entry {
+        std::string name;
+        std::string path;
+        uint64_t bytes = 0;
+        uint64_t last_used = 0;
+        std::shared_ptr<Engine> engine;
+        std::shared_ptr<std::atomic<uint64_t>> kv_bytes; // 由加载回调在加载线程上写入
+        uint64_t footprint() const { return bytes + kv_bytes->load(); }
+    };
+    // 移出池的引擎放进 dropped，由调用方在释放 mu_ 之后析构（析构会卸载模型、落盘会话 KV）
+    void prune_failed(std::vector<std::shared_ptr<Engine>>& dropped);
+    bool evict_for(uint64_t need, std::vector<std::shared_ptr<Engine>>& dropped);
+
+    Factory factory_;
+    uint64_t budget_;
+    std::string model_dir_;
+    mutable std::mutex mu_;
+    std::vector<Entry> entries_;
+    uint64_t clock_ = 0;
+};
+
+} // namespace inference
@@ -0,0 +1,170 @@
+#include "kv_persist.h"
+#include "utils/config.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+
+namespace inference {
+
+static constexpr char KV_MAGIC[4] = {'A', 'I', 'K', 'V'};
+static constexpr uint32_t KV_VERSION = 2; // v2: 增加 n_keep / n_discarded
+
+static uint64_t fnv1a(const void* data, size_t n, uint64_t h = 1469598103934665603ull) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < n; ++i) { h ^= p[i]; h *= 1099511628211ull; }
+    return h;
+}
+
+static std::string hex64(uint64_t v) {
+    char buf[17];
+    std::snprintf(buf, sizeof(buf), "%016llx", (unsigned long long)v);
+    return buf;
+}
+
+std::string model_fingerprint(const std::string& model_path) {
+    std::ifstream ifs(model_path, std::ios::binary);
+    if (!ifs.is_open()) return hex64(fnv1a(model_path.data(), model_path.size()));
+    ifs.seekg(0, std::ios::end);
+    const uint64_t size = (uint64_t)ifs.tellg();
+    uint64_t h = fnv1a(&size, sizeof(size));
+    static constexpr uint64_t CHUNK = 4ull << 20;
+    std::vector<char> buf(CHUNK);
+    auto mix = [&](uint64_t off, uint64_t n) {
+        ifs.seekg((std::streamoff)off);
+        ifs.read(buf.data(), (std::streamsize)n);
+        h = fnv1a(buf.data(), (size_t)ifs.gcount(), h);
+    };
+    mix(0, std::min(size, CHUNK));
+    if (size > CHUNK) mix(size - std::min(size - CHUNK, CHUNK), std::min(size - CHUNK, CHUNK));
+    return hex64(h);
+}
+
+std::string session_kv_path(const std::string& fingerprint, const std::string& session_id) {
+    std::string dir = config::get_env("AICLI_DATA_DIR").value_or("data");
+    // 会话名可能含任意字符：保留安全字符并附加哈希避免冲突
+    std::string name;
+    for (char c : session_id) {
+        const bool safe = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-' || c == '_';
+        name += safe ? c : '_';
+    }
+    name += "-" + hex64(fnv1a(session_id.data(), session_id.size())).substr(0, 8);
+    return (fs::path(dir) / "kv" / fingerprint / (name + ".kv")).string();
+}
+
+bool write_kv_snapshot(const std::string& path, const KvSnapshot& snap, std::string& err) {
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+    const std::string tmp = path + ".tmp";
+    {
+        std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+        if (!ofs.is_open()) { err = "open failed: " + tmp; return false; }
+        const uint64_t n_tokens = snap.tokens.size();
+        const uint64_t n_state = snap.state.size();
+        ofs.write(KV_MAGIC, sizeof(KV_MAGIC));
+        ofs.write(reinterpret_cast<const char*>(&KV_VERSION), sizeof(KV_VERSION));
+        ofs.write(reinterpret_cast<const char*>(&n_tokens), sizeof(n_tokens));
+        ofs.write(reinterpret_cast<const char*>(&n_state), sizeof(n_state));
+        ofs.write(reinterpret_cast<const char*>(&snap.n_keep), sizeof(snap.n_keep));
+        ofs.write(reinterpret_cast<const char*>(&snap.n_discarded), sizeof(snap.n_discarded));
+        ofs.write(reinterpret_cast<const char*>(snap.tokens.data()), (std::streamsize)(n_tokens * sizeof(int32_t)));
+        ofs.write(reinterpret_cast<const char*>(snap.state.data()), (std::streamsize)n_state);
+        if (!ofs) { err = "write failed: " + tmp; return false; }
+    }
+    fs::rename(tmp, path, ec);
+    if (ec) { err = "rename failed: " + ec.message(); fs::remove(tmp, ec); return false; }
+    return true;
+}
+
+bool read_kv_snapshot(const std::string& path, KvSnapshot& snap, std::string& err) {
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs.is_open()) { err = "not found"; return false; }
+    char magic[4]; uint32_t version = 0; uint64_t n_tokens = 0, n_state = 0;
+    ifs.read(magic, sizeof(magic));
+    ifs.read(reinterpret_cast<char*>(&version), sizeof(version));
+    ifs.read(reinterpret_cast<char*>(&n_tokens), sizeof(n_tokens));
+    ifs.read(reinterpret_cast<char*>(&n_state), sizeof(n_state));
+    ifs.read(reinterpret_cast<char*>(&snap.n_keep), sizeof(snap.n_keep));
+    ifs.read(reinterpret_cast<char*>(&snap.n_discarded), sizeof(snap.n_discarded));
+    if (!ifs || std::memcmp(magic, KV_MAGIC, sizeof(magic)) != 0 || version != KV_VERSION) { err = "bad header"; return false; }
+    // 先按文件实际大小校验长度字段，损坏的头部不会触发超大分配
+    std::error_code ec;
+    const uint64_t size = fs::file_size(path, ec);
+    const uint64_t header = sizeof(KV_MAGIC) + sizeof(version) + sizeof(n_tokens) + sizeof(n_state) +
+                            sizeof(snap.n_keep) + sizeof(snap.n_discarded);
+    if (ec || size < header || n_tokens > (size - header) / sizeof(int32_t) ||
+        n_state != size - header - n_tokens * sizeof(int32_t)) {
+        err = "size mismatch";
+        return false;
+    }
+    snap.tokens.resize(n_tokens);
+    snap.state.resize(n_state);
+    ifs.read(reinterpret_cast<char*>(snap.tokens.data()), (std::streamsize)(n_tokens * sizeof(int32_t)));
+    ifs.read(reinterpret_cast<char*>(snap.state.data()), (std::streamsize)n_state);
+    if (!ifs) { err = "truncated"; return false; }
+    return true;
+}
+
+KvWriter::~KvWriter() {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        stop_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) thread_.join();
+}
+
+void KvWriter::enqueue(const std::string& path, std::shared_ptr<const KvSnapshot> snap, Done done) {
+    {
+        std::lock_guard<std::mutex> lk(mu_);
+        pending_[path] = snap;
+        auto it = std::find_if(queue_.begin(), queue_.end(), [&](const Job& j) { return j.path == path; });
+        if (it != queue_.end()) {
+            it->snap = std::move(snap);
+            it->done = std::move(done);
+        } else {
+            queue_.push_back({path, std::move(snap), std::move(done)});
+        }
+        if (!thread_.joinable()) thread_ = std::thread([this] { run(); });
+    }
+    cv_.notify_one();
+}
+
+std::shared_ptr<const KvSnapshot> KvWriter::pending(const std::string& path) const {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto it = pending_.find(path);
+    return it == pending_.end() ? nullptr : it->second;
+}
+
+void KvWriter::flush() {
+    std::unique_lock<std::mutex> lk(mu_);
+    idle_cv_.wait(lk, [&] { return queue_.empty() && !busy_; });
+}
+
+// 析构时先写完队列中剩余的快照再退出
+void KvWriter::run() {
+    std::unique_lock<std::mutex> lk(mu_);
+    for (;;) {
+        cv_.wait(lk, [&] { return stop_ || !queue_.empty(); });
+        if (queue_.empty()) return;
+        Job job = std::move(queue_.front());
+        queue_.pop_front();
+        busy_ = true;
+        lk.unlock();
+        std::string err;
+        write_kv_snapshot(job.path, *job.snap, err);
+        if (job.done) job.done(err);
+        lk.lock();
+        // 写出期间同一路径又有新快照入队时保留新的
+        auto it = pending_.find(job.path);
+        if (it != pending_.end() && it->second == job.snap) pending_.erase(it);
+        busy_ = false;
+        if (queue_.empty()) idle_cv_.notify_all();
+    }
+}
+
+} // namespace inference
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace inference {
+
+// 会话 KV 快照：tokens 与序列中的 KV 位置一一对应，state 为 llama_state_seq_get_data 的输出
+struct KvSnapshot {
+    std::vector<int32_t> tokens;
+    std::vector<uint8_t> state;
+    int32_t n_keep = 0;      // 上下文平移时保留的开头 token 数
+    int32_t n_discarded = 0; // 已从 n_keep 之后丢弃的 token 数（原始 prompt 坐标）
+};
+
+// 模型文件指纹：文件大小 + 首尾各 4MiB 内容的 FNV-1a，避免对数 GB 的模型做全量哈希
+std::string model_fingerprint(const std::string& model_path);
+
+// 快照路径：<data_dir>/kv/<fingerprint>/<session>.kv，data_dir 取 AICLI_DATA_DIR（默认 data）
+std::string session_kv_path(const std::string& fingerprint, const std::string& session_id);
+
+// 先写临时文件再 rename，避免进程中断留下半截快照
+bool write_kv_snapshot(const std::string& path, const KvSnapshot& snap, std::string& err);
+bool read_kv_snapshot(const std::string& path, KvSnapshot& snap, std::string& err);
+
+// 快照后台写入：调度线程只拷出序列状态并入队，落盘在独立线程完成，不阻塞解码步
+class KvWriter {
+public:
+    // 写完后在写入线程上回调，err 为空表示成功
+    using Done = std::function<void(const std::string& err)>;
+
+    ~KvWriter();
+
+    // 同一路径尚未开始写的旧快照直接被替换
+    void enqueue(const std::string& path, std::shared_ptr<const KvSnapshot> snap, Done done = nullptr);
+    // 尚未落盘的快照；恢复时优先于磁盘上的文件
+    std::shared_ptr<const KvSnapshot> pending(const std::string& path) const;
+    // 阻塞到队列清空
+    void flush();
+
+private:
+    struct Job {
+        std::string path;
+        std::shared_ptr<const KvSnapshot> snap;
+        Done done;
+    };
+    void run();
+
+    mutable std::mutex mu_;
+    std::condition_variable cv_, idle_cv_;
+    std::deque<Job> queue_;
+    std::unordered_map<std::string, std::shared_ptr<const KvSnapshot>> pending_;
+    bool busy_ = false, stop_ = false;
+    std::thread thread_;
+};
+
+} // namespace inference
@@ -1,4 +1,12 @@
 #include "llama_engine.h"
+#include "sampler.h"
+#include "kv_persist.h"
+#include "ngram_index.h"
+#include "thread_config.h"
+#include "core/inference/prompt_cache.h"
+#include "core/inference/stop_matcher.h"
+#include "core/inference/tool_grammar.h"
+#include "core/inference/embed_batch.h"
 #include "utils/logging.h"
 #include "utils/config.h"
 #include "core/sysbox/sysbox.h"
@@ -12,53 +20,565 @@
 #include <unordered_map>
 #include <mutex>
 #include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <filesystem>
 
 #if AICLI_WITH_LLAMA
 #include "llama.h"
+#include "ggml-cpu.h"
 #endif
 
 namespace inference {
 
+#if AICLI_WITH_LLAMA
+// 跨序列共享前缀的最小长度：更短的前缀直接 prefill 更划算
+static constexpr int kPrefixShareMin = 32;
+// 多个适配器都有请求时，每个适配器连续解码的步数上限
+static constexpr int kAdapterQuantum = 8;
+
+// 模型池中可同时存在多个引擎，llama 后端按引用计数初始化/释放
+static std::mutex g_backend_mu;
+static int g_backend_refs = 0;
+
+static void backend_acquire(bool& held) {
+    if (held) return;
+    std::lock_guard<std::mutex> lk(g_backend_mu);
+    if (g_backend_refs++ == 0) llama_backend_init();
+    held = true;
+}
+
+static void backend_release(bool& held) {
+    if (!held) return;
+    std::lock_guard<std::mutex> lk(g_backend_mu);
+    if (--g_backend_refs == 0) llama_backend_free();
+    held = false;
+}
+
+// KV cache 元素类型：f16 为 llama 默认，q8_0 / q4_0 分别约为其 1/2、1/4
+static bool kv_type_from_name(const std::string& name, ggml_type& t) {
+    static const std::pair<const char*, ggml_type> kTypes[] = {
+        {"f32", GGML_TYPE_F32}, {"f16", GGML_TYPE_F16}, {"bf16", GGML_TYPE_BF16},
+        {"q8_0", GGML_TYPE_Q8_0}, {"q4_0", GGML_TYPE_Q4_0}, {"q4_1", GGML_TYPE_Q4_1},
+        {"q5_0", GGML_TYPE_Q5_0}, {"q5_1", GGML_TYPE_Q5_1}, {"iq4_nl", GGML_TYPE_IQ4_NL},
+    };
+    for (auto& [n, v] : kTypes) if (name == n) { t = v; return true; }
+    return false;
+}
+
+static uint64_t kv_row_bytes(ggml_type t, int64_t n) {
+    return (uint64_t)(ggml_type_size(t) * n / ggml_blck_size(t));
+}
+#endif
+
 struct LlamaEngine::Impl {
-    bool loaded = false;
+    std::atomic<bool> loaded{false};
     std::string model_path;
+    // 后台加载：loading 期间提交的请求在 load_cv 上等待
+    std::thread loader;
+    std::atomic<bool> loading{false};
+    std::atomic<bool> cancel_load{false}; // 由 llama 的进度回调返回 false 中止加载
+    std::atomic<float> progress{0.0f};
+    std::mutex load_mu;
+    std::condition_variable load_cv;
+
+    void wait_loading() {
+        std::unique_lock<std::mutex> lk(load_mu);
+        load_cv.wait(lk, [&]{ return !loading.load(); });
+    }
+    // 取消并回收上一次后台加载；在加载线程自身上调用时（load_model 内部的 unload）跳过
+    void join_loader() {
+        if (!loader.joinable() || loader.get_id() == std::this_thread::get_id()) return;
+        cancel_load = true;
+        loader.join();
+        cancel_load = false;
+    }
 #if AICLI_WITH_LLAMA
     llama_model* model = nullptr;
     llama_context* ctx = nullptr;
     const llama_vocab* vocab = nullptr;
     int n_ctx = 4096;
-    int n_threads = std::max(1u, std::thread::hardware_concurrency());
+    int n_seq_max = 8; // 共享 KV 中可同时驻留的序列（会话）数，同时也是并发槽位数
+    int n_ubatch = 512; // 每步 batch 上限（解码 token + prefill 分块），同时作为 llama 的 n_batch/n_ubatch
+    int n_threads = std::max(1u, std::thread::hardware_concurrency());       // 解码（单 token）线程数
+    int n_threads_batch = std::max(1u, std::thread::hardware_concurrency()); // prefill（多 token）线程数
+    std::vector<int> cpus;                      // 绑核的 CPU 列表，空表示不绑核
+    ggml_threadpool* tp = nullptr;              // 绑核时的解码 / prefill 线程池
+    ggml_threadpool* tp_batch = nullptr;
+    ggml_type type_k = GGML_TYPE_F16;           // KV cache 的 K / V 元素类型
+    ggml_type type_v = GGML_TYPE_F16;
+    llama_flash_attn_type flash_attn = LLAMA_FLASH_ATTN_TYPE_AUTO;
+    uint64_t kv_cell_bytes = 0;                 // 每个 KV cell（一个 token 在所有层）的字节数
+    int ctx_keep = -1;       // 上下文平移时保留的开头 token 数，-1 表示保留到第一条消息（system）结束
+    int ctx_recent = -1;     // 平移后保留的最近 token 数，-1 表示 n_ctx/2
+    bool can_shift = false;  // KV 是否支持位置平移（llama_memory_seq_add）
+    llama_token im_end = -1; // ChatML 消息结束符，用于定位 system prompt 的边界
     std::string arch;
     std::string chat_template;
     struct SessionState {
         int n_past = 0;
         std::vector<llama_token> last_tokens;
+        llama_seq_id seq = -1;   // 在共享 KV 中的序列号，-1 表示未驻留
+        uint64_t last_used = 0;  // LRU 时间戳
+        bool busy = false;       // 正被某个槽位使用，不可淘汰
+        bool disk_checked = false; // 已尝试过从磁盘快照恢复
+        int n_keep = 0;          // 平移时保留的开头 token 数，首次平移时确定
+        int n_discarded = 0;     // 已丢弃的中段长度：原始 prompt 的 [n_keep, n_keep + n_discarded) 不在 KV 中
+        int n_shared = 0;        // 开头从其他序列复制而来、与之共享 cell 的 token 数
+        int adapter = -1;        // 这条 KV 是在哪个 LoRA 适配器下算出的，-1 为基座
     };
     std::unordered_map<std::string, SessionState> sessions;
-    std::string active_session; // 当前上下文对应的会话
+    // 会话 prompt 的增量 tokenize 缓存：键与 sessions 相同（会话@适配器），在调用方线程上使用，由 tok_mu 保护；
+    // 会话被淘汰或重置时删除。tok_mu 内不再取 mu，调度线程可在持有 mu 时取 tok_mu
+    std::unordered_map<std::string, PromptTokenCache> prompt_caches;
+    std::mutex tok_mu;
+    std::vector<llama_seq_id> free_seqs; // 空闲序列号
+    uint64_t use_clock = 0;
+    SamplerWorkspace sampler_ws; // 按 n_vocab 预分配，所有槽位在调度线程上串行复用
+    std::vector<char> piece_arena;   // 全词表 token piece 连续存放，load_model 时构建
+    std::vector<uint32_t> piece_off; // piece_off[id]..piece_off[id+1] 为 token id 的 piece
+    // 工具调用文法：词表索引在首次用到文法时按 piece 表建立；掩码按文法缓存，只在调度线程上访问
+    GrammarVocab grammar_vocab;
+    std::vector<std::unique_ptr<GrammarMasks>> grammar_masks;
+    // DRY 中断 token 表：按中断串集合缓存，节点地址稳定，槽位的采样链直接持有指针；只在调度线程上访问
+    std::map<std::vector<std::string>, std::vector<uint8_t>> dry_breakers;
     std::mutex mu;
-    std::atomic<bool> abort_requested{false};
+    int prefix_saved = 0;    // 前缀共享累计省下的 prefill token 数
+    // 推测解码：草稿模型的序列号与目标序列一一对应，draft_hist[s] 为草稿 KV 中序列 s 的 tokens
+    llama_model* draft_model = nullptr;
+    llama_context* draft_ctx = nullptr;
+    std::vector<std::vector<llama_token>> draft_hist;
+    llama_batch draft_batch{};
+    int draft_k = 4;         // 每步每条序列最多提议的草稿 token 数
+    int lookup_ngram = 0;    // 提示词查找推测的 n-gram 长度，0 关闭
+    bool backend = false;    // 是否持有 llama 后端引用
+    bool kv_persist = true;  // 淘汰/卸载时把会话 KV 落盘，下次对话时按需恢复
+    bool cold = false;       // 加载后尚未完成第一个请求，其首 token 延迟单独标记
+    int progress_step = -1;  // 已上报的加载进度（10% 为一档）
+    std::string model_fp;    // 模型文件指纹，快照按它分目录
+    KvWriter kv_writer;      // 快照后台写入
+    // LoRA 适配器：随基座模型加载一次。llama 的适配器作用于整个 context，因此每步只解码同一适配器的请求，
+    // 不同适配器的请求按步轮转；会话在各适配器下的 KV 分开存放（会话键加 @适配器名）
+    struct Adapter {
+        std::string name;
+        std::string path;
+        float scale = 1.0f;
+        uint64_t bytes = 0;
+        llama_adapter_lora* lora = nullptr;
+    };
+    std::vector<Adapter> adapters;
+    int cur_adapter = -1;        // 当前作用于 context 的适配器，-1 为基座
+    int adapter_steps = 0;       // 当前适配器已连续解码的步数
+    int adapter_switches = 0;
+    int64_t adapter_switch_ns = 0;
+    // 嵌入：独立的 embeddings context，首次 embed 时创建，不占用生成 context 的 KV 与序列号。
+    // 在调用方线程上使用，由 embed_mu 串行化；池化方式变化时重建
+    std::mutex embed_mu;
+    llama_context* embed_ctx = nullptr;
+    Pooling embed_pooling = Pooling::Model;
+    int embed_batch = 2048;  // 每个 batch 的 token 上限，同时是单条文本的截断长度
+    int embed_seqs = 64;     // 每个 batch 的序列（文本）数上限
 
+    // 调度请求：调用方线程提交后阻塞等待，由调度线程完成 prefill/解码并回调 on_token
+    struct Request {
+        std::string session_id;          // 空表示无会话（使用槽位的临时序列）
+        std::vector<llama_token> tokens; // 完整 prompt
+        GenerateOptions options;
+        const StreamCallback* on_token = nullptr;
+        std::chrono::steady_clock::time_point t_submit;
+        bool done = false;
+        bool ok = false;
+        std::string err;
+        int gen_tokens = 0;
+        int adapter = -1;                // LoRA 适配器下标，-1 为基座
+        // 工具调用：调度线程写入 tool_call 后置 ToolCalled，调用方线程执行回调、把 tokenize 后的结果放进 tool_tokens
+        // 再置 ToolReady（或 ToolDeclined）；均在 mu 下读写
+        enum ToolState { ToolIdle, ToolCalled, ToolReady, ToolDeclined } tool_state = ToolIdle;
+        std::string tool_call;
+        std::vector<llama_token> tool_tokens;
+        int tool_calls = 0;
+        int tool_injected = 0;           // 累计接入序列的工具结果 token 数
+        int branch = 0;                  // n-best 候选序号
+        bool forked = false;             // 是否从首个候选的 prefill 结果分叉而来
+        std::vector<Request*> forks;     // 等待本请求 prefill 完成后分叉的其他候选
+    };
+    // 活跃槽位：占用一条序列与一份采样链，随请求复用
+    struct Slot {
+        Request* req = nullptr;
+        SessionState* st = nullptr;
+        SessionState temp;           // 无会话请求的临时序列
+        SamplerChain sampler;
+        int n_prompt_done = 0;       // 已进入 KV 的 prompt token 数
+        llama_token pending = -1;    // 已采样、待下一步喂入的 token
+        int out_idx = -1;            // 本步 batch 中取 logits 的下标
+        int n_batched = 0;           // 本步放入 batch 的 token 数
+        int n_prefill = 0;           // 本次需要 prefill 的 token 数（扣除复用前缀）
+        int n_spec = 0;              // 本步允许的草稿 token 数
+        std::vector<llama_token> draft; // 本步待校验的草稿，容量 draft_k，调度期间不再分配
+        int draft_idx = -1;          // 草稿 batch 中取 logits 的下标
+        int n_drafted = 0;           // 本请求累计提议 / 命中的草稿 token 数
+        int n_accepted = 0;
+        NgramIndex lookup;           // prompt + 已生成 token 的 n-gram 索引，用于提示词查找推测
+        StopMatcher stop;            // 停止串自动机，请求未设置停止串时为空
+        std::string stop_out;        // 停止串匹配后可输出的文本，复用缓冲
+        bool in_tool = false;        // 输出正处于 <tool_call> 之内
+        std::string tool_text;       // 工具调用识别缓冲：调用外只留可能是开标签前缀的尾部，调用内为调用正文
+        bool tool_wait = false;      // 等待调用方执行工具，期间不参与 batch
+        bool tool_resume = false;    // 工具结果已就绪，待接入序列
+        bool closing = false;        // 调用被拒绝：pending（</tool_call> 末尾 token）解码进 KV 后即结束，不再采样
+        std::chrono::steady_clock::time_point t_tool;
+        bool held = false;           // 与本步适配器不同，本步不进 batch
+        GrammarMasks* grammar = nullptr; // 本次调用生效的文法掩码，调用外或放弃约束时为空
+        int g_state = -1;            // 调用正文在文法 DFA 中的状态
+        int n_masked = 0;            // 本请求按文法屏蔽采样的 token 数与取掩码耗时
+        int64_t mask_ns = 0;
+        std::chrono::steady_clock::time_point t_start;
+        std::chrono::steady_clock::time_point t_decode; // prefill 完成、开始解码的时刻
+    };
+    std::vector<Slot> slots;
+    std::deque<Request*> queue;
+    std::vector<Request*> inflight;  // 已提交、尚未返回的请求，request_abort() 逐个取消
+    std::vector<std::string> pending_resets;
+    EngineStats* pending_stats = nullptr; // 待调度线程填写的会话统计
+    std::condition_variable cv;      // 唤醒调度线程
+    std::condition_variable done_cv; // 唤醒等待结果的调用方
+    std::thread worker;
+    bool stopping = false;
+    llama_batch batch{};
+    int n_batch = 0;
+    // 忙碌期聚合吞吐
+    std::chrono::steady_clock::time_point busy_since;
+    int busy_tokens = 0;
+    int busy_max_active = 0;
+    int64_t busy_step_ns = 0;    // step 总耗时
+    int busy_switches = 0;       // 忙碌期内的适配器切换次数
+    int64_t busy_decode_ns = 0;  // 其中 llama_decode（含草稿模型）耗时
+    int64_t busy_sample_ns = 0;  // 其中采样耗时
+
+    // llama_decode 期间由计算线程调用：batch 内所有请求都已取消时提前结束本次 decode（返回 2），
+    // 否则只能等这一步算完，由调度循环在步间结束被取消的请求。decode 期间槽位不变，读取无需加锁
     static bool ggml_abort_trampoline(void* ud) {
         Impl* self = reinterpret_cast<Impl*>(ud);
-        return self->abort_requested.load(std::memory_order_relaxed);
+        bool any = false;
+        for (auto& sl : self->slots) {
+            if (!sl.req) continue;
+            if (!sl.req->options.cancel->cancelled()) return false;
+            any = true;
+        }
+        return any;
     }
 
-    bool reinit_context(std::string& err) {
-        if (!model) { err = "model not loaded"; return false; }
-        if (ctx) { llama_free(ctx); ctx = nullptr; }
+    static uint32_t request_seed() {
+        if (auto sv = config::get_env("AICLI_SEED")) { try { return (uint32_t)std::stoul(*sv); } catch (...) {} }
+        std::random_device rd; return rd();
+    }
+
+    llama_memory_t mem() const { return llama_get_memory(ctx); }
+
+    std::string_view piece_of(llama_token id) const {
+        if (id < 0 || (size_t)id + 1 >= piece_off.size()) return {};
+        return std::string_view(piece_arena.data() + piece_off[id], piece_off[id + 1] - piece_off[id]);
+    }
+
+    // 计入忙碌期的 decode 耗时，用于得出解码循环在 llama_decode 之外的每 token 开销
+    int32_t timed_decode(llama_context* c, llama_batch& b) {
+        const auto t0 = std::chrono::steady_clock::now();
+        const int32_t r = llama_decode(c, b);
+        busy_decode_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+        return r;
+    }
+
+    // 主模型与草稿模型共用的权重加载参数
+    static llama_model_params model_params() {
+        llama_model_params mparams = llama_model_default_params();
+        // mmap 让权重按需换页、可被多进程共享；mlock 把权重锁在内存里避免被换出
+        mparams.use_mmap = config::get_int("AICLI_MMAP", "local_model.use_mmap", 1) != 0;
+        mparams.use_mlock = config::get_int("AICLI_MLOCK", "local_model.use_mlock", 0) != 0;
+        // gpu_layers: auto（或负数）保持 llama 默认
+        const int gpu_layers = config::get_int("AICLI_GPU_LAYERS", "local_model.gpu_layers", -1);
+        if (gpu_layers >= 0) mparams.n_gpu_layers = gpu_layers;
+        return mparams;
+    }
+
+    // 主模型与草稿模型共用的 context 参数
+    llama_context_params context_params() {
         llama_context_params cparams = llama_context_default_params();
         cparams.n_ctx = n_ctx;
+        cparams.n_seq_max = n_seq_max;
+        cparams.n_batch = n_ubatch;
+        cparams.n_ubatch = n_ubatch;
+        cparams.n_threads = n_threads;
+        cparams.n_threads_batch = n_threads_batch;
+        cparams.type_k = type_k;
+        cparams.type_v = type_v;
+        cparams.flash_attn_type = flash_attn;
+        cparams.kv_unified = true; // 所有序列共享同一块 KV，单个会话可用满 n_ctx
         cparams.abort_callback = (ggml_abort_callback) &Impl::ggml_abort_trampoline;
         cparams.abort_callback_data = this;
-        ctx = llama_init_from_model(model, cparams);
-        if (!ctx) { err = "failed to recreate context"; return false; }
-        vocab = llama_model_get_vocab(model);
-        sessions.clear();
-        active_session.clear();
-        abort_requested.store(false, std::memory_order_relaxed);
+        return cparams;
+    }
+
+    bool create_context(std::string& err) {
+        ctx = llama_init_from_model(model, context_params());
+        if (!ctx) { err = "failed to create context"; return false; }
+        if (!cpus.empty()) attach_threadpools();
+        free_seqs.clear();
+        for (int s = n_seq_max - 1; s >= 0; --s) free_seqs.push_back(s);
+        return true;
+    }
+
+    // 嵌入 context：一个 batch 一次算完（非因果模型要求整条序列落在同一个 ubatch 内），序列间共享 KV。
+    // 模型未声明池化方式或声明为 none 时按 last 池化
+    bool create_embed_context(Pooling pooling, std::string& err) {
+        if (embed_ctx && embed_pooling == pooling) return true;
+        if (embed_ctx) { llama_free(embed_ctx); embed_ctx = nullptr; }
+        llama_context_params cparams = context_params();
+        cparams.n_ctx = embed_batch;
+        cparams.n_batch = embed_batch;
+        cparams.n_ubatch = embed_batch;
+        cparams.n_seq_max = embed_seqs;
+        cparams.n_threads = n_threads_batch;
+        cparams.embeddings = true;
+        cparams.pooling_type = pooling == Pooling::Mean ? LLAMA_POOLING_TYPE_MEAN : pooling == Pooling::Cls ? LLAMA_POOLING_TYPE_CLS :
+                               pooling == Pooling::Last ? LLAMA_POOLING_TYPE_LAST : LLAMA_POOLING_TYPE_UNSPECIFIED;
+        // 生成 context 的中止回调遍历调度槽位，不能在调用方线程上跑；嵌入在 batch 之间检查取消
+        cparams.abort_callback = nullptr;
+        cparams.abort_callback_data = nullptr;
+        embed_ctx = llama_init_from_model(model, cparams);
+        if (embed_ctx && llama_pooling_type(embed_ctx) == LLAMA_POOLING_TYPE_NONE) {
+            llama_free(embed_ctx);
+            cparams.pooling_type = LLAMA_POOLING_TYPE_LAST;
+            embed_ctx = llama_init_from_model(model, cparams);
+        }
+        if (!embed_ctx) { err = "failed to create embedding context"; return false; }
+        embed_pooling = pooling;
+        return true;
+    }
+
+    // 以下会话/序列簿记只在调度线程上访问（unload 在调度线程退出后才落盘会话），不加锁；
+    // mu 只保护 queue / pending_resets / stopping 与请求完成通知
+
+    void release_seq(SessionState& st) {
+        if (st.seq < 0) return;
+        llama_memory_seq_rm(mem(), st.seq, -1, -1);
+        free_seqs.push_back(st.seq);
+        st.seq = -1; st.n_past = 0; st.last_tokens.clear();
+        st.n_keep = st.n_discarded = st.n_shared = 0;
+    }
+
+    // 平移保留的开头：显式配置优先，否则保留到第一个 <|im_end|> 及其后的换行
+    int keep_len(const std::vector<llama_token>& tokens) const {
+        int keep = 1; // 至少保留 BOS
+        if (ctx_keep >= 0) {
+            keep = ctx_keep;
+        } else if (im_end >= 0) {
+            auto it = std::find(tokens.begin(), tokens.end(), im_end);
+            if (it != tokens.end()) keep = (int)(it - tokens.begin()) + 2;
+        }
+        return std::max(0, std::min({keep, (int)tokens.size(), n_ctx / 2}));
+    }
+
+    // 平移后保留的最近窗口；保证平移后至少空出 n_ctx/4 供继续生成
+    int recent_len(int n_keep) const {
+        const int r = ctx_recent >= 0 ? ctx_recent : n_ctx / 2;
+        return std::max(1, std::min(r, n_ctx * 3 / 4 - n_keep));
+    }
+
+    // 丢弃序列中 [n_keep, n_keep + d) 的 KV，并把其后的位置就地左移，同步 last_tokens；
+    // d 超出已驻留部分时只处理驻留部分。不支持平移时截到 n_keep，剩余部分交给 prefill 补齐
+    void shift_kv(SessionState& st, int d) {
+        int from = st.n_keep;
+        const int to = std::min(st.n_past, st.n_keep + d);
+        if (st.seq < 0 || to <= from) return;
+        if (can_shift && llama_memory_seq_rm(mem(), st.seq, from, to)) {
+            llama_memory_seq_add(mem(), st.seq, to, st.n_past, -(to - from));
+            st.last_tokens.erase(st.last_tokens.begin() + from, st.last_tokens.begin() + to);
+            st.n_past -= to - from;
+            st.n_shared = std::min(st.n_shared, from);
+            return;
+        }
+        if (!llama_memory_seq_rm(mem(), st.seq, from, -1)) {
+            llama_memory_seq_rm(mem(), st.seq, -1, -1);
+            from = 0;
+        }
+        st.n_shared = std::min(st.n_shared, from);
+        st.n_past = from;
+        st.last_tokens.resize(from);
+    }
+
+    void record_shift(const std::string& id, const SessionState& st, int d) {
+        sysbox::record_json("inference", "info", std::string("{\"event\":\"ctx_shift\",\"session\":\"") + id +
+                            "\",\"keep\":" + std::to_string(st.n_keep) + ",\"discarded\":" + std::to_string(d) +
+                            ",\"n_past\":" + std::to_string(st.n_past) + "}");
+    }
+
+    // 解码中触及 n_ctx：丢弃保留开头之后、最近窗口之前的中段，位置平移后继续生成
+    bool shift_context(Slot& sl) {
+        SessionState& st = *sl.st;
+        if (!can_shift || st.seq < 0) return false;
+        if (st.n_discarded == 0) st.n_keep = keep_len(st.last_tokens);
+        const int d = st.n_past - st.n_keep - recent_len(st.n_keep);
+        if (d <= 0) return false;
+        shift_kv(st, d);
+        if (st.n_past + 1 > n_ctx) return false;
+        st.n_discarded += d;
+        record_shift(sl.req->session_id, st, d);
+        return true;
+    }
+
+    // 会话 KV 落盘：序列状态 + 与 KV 位置对应的 tokens。这里只拷出状态，文件由 kv_writer 在后台写；
+    // copy_ms 为占用调度线程的时间，ms 含排队与写盘
+    void save_session(const std::string& id, SessionState& st) {
+        if (!kv_persist || st.seq < 0 || st.n_past == 0) return;
+        auto t0 = std::chrono::steady_clock::now();
+        auto snap = std::make_shared<KvSnapshot>();
+        snap->tokens.assign(st.last_tokens.begin(), st.last_tokens.end());
+        snap->n_keep = st.n_keep;
+        snap->n_discarded = st.n_discarded;
+        snap->state.resize(llama_state_seq_get_size(ctx, st.seq));
+        const size_t n = llama_state_seq_get_data(ctx, snap->state.data(), snap->state.size(), st.seq);
+        if (n == 0) {
+            sysbox::record({"inference", "warn", "kv save failed: " + id + " state copy"});
+            return;
+        }
+        snap->state.resize(n);
+        st.disk_checked = false;
+        auto copy_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+        const int tokens = st.n_past;
+        kv_writer.enqueue(session_kv_path(model_fp, id), std::move(snap), [id, tokens, n, copy_ms, t0](const std::string& err) {
+            if (!err.empty()) {
+                sysbox::record({"inference", "warn", "kv save failed: " + id + " " + err});
+                return;
+            }
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+            sysbox::record_json("inference", "info", std::string("{\"event\":\"kv_save\",\"session\":\"") + id +
+                                "\",\"tokens\":" + std::to_string(tokens) + ",\"bytes\":" + std::to_string(n) +
+                                ",\"copy_ms\":" + std::to_string(copy_ms) + ",\"ms\":" + std::to_string(ms) + "}");
+        });
+    }
+
+    // 未驻留会话的首个请求：若有快照，读入一条新序列，省去整段历史的 prefill
+    void restore_session(const std::string& id, SessionState& st) {
+        st.disk_checked = true;
+        if (!kv_persist) return;
+        auto t0 = std::chrono::steady_clock::now();
+        // 后台尚未写完的快照直接从内存恢复
+        const std::string path = session_kv_path(model_fp, id);
+        std::shared_ptr<const KvSnapshot> pending = kv_writer.pending(path);
+        KvSnapshot loaded; std::string err;
+        if (!pending && !read_kv_snapshot(path, loaded, err)) return;
+        const KvSnapshot& snap = pending ? *pending : loaded;
+        if (snap.tokens.empty() || !make_resident(st, (int)snap.tokens.size(), err)) return;
+        if (llama_state_seq_set_data(ctx, snap.state.data(), snap.state.size(), st.seq) == 0) {
+            llama_memory_seq_rm(mem(), st.seq, -1, -1);
+            sysbox::record({"inference", "warn", "kv restore failed: " + id});
+            return;
+        }
+        st.last_tokens.assign(snap.tokens.begin(), snap.tokens.end());
+        st.n_past = (int)snap.tokens.size();
+        st.n_keep = snap.n_keep;
+        st.n_discarded = snap.n_discarded;
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+        sysbox::record_json("inference", "info", std::string("{\"event\":\"kv_restore\",\"session\":\"") + id +
+                            "\",\"tokens\":" + std::to_string(st.n_past) + ",\"ms\":" + std::to_string(ms) + "}");
+    }
+
+    // 淘汰最久未用的空闲驻留会话（整条序列）；无可淘汰时返回 false
+    bool evict_lru() {
+        SessionState* victim = nullptr; const std::string* victim_id = nullptr;
+        for (auto& kv : sessions) {
+            SessionState& st = kv.second;
+            if (st.busy || st.seq < 0) continue;
+            if (!victim || st.last_used < victim->last_used) { victim = &st; victim_id = &kv.first; }
+        }
+        if (!victim) return false;
+        sysbox::record_json("inference", "info", std::string("{\"event\":\"kv_evict\",\"session\":\"") + *victim_id +
+                            "\",\"tokens\":" + std::to_string(victim->n_past) + "}");
+        save_session(*victim_id, *victim);
+        release_seq(*victim);
+        {
+            std::lock_guard<std::mutex> lk(tok_mu);
+            prompt_caches.erase(*victim_id);
+        }
+        return true;
+    }
+
+    // 共享前缀只按提供方计一次；提供方被淘汰后会少算，由 llama_decode 返回 1 时的淘汰重试兜底
+    int resident_cells() const {
+        int n = 0;
+        for (auto& kv : sessions) if (kv.second.seq >= 0) n += kv.second.n_past - kv.second.n_shared;
+        for (auto& sl : slots) if (sl.temp.seq >= 0) n += sl.temp.n_past - sl.temp.n_shared;
+        return n;
+    }
+
+    // 在其他驻留序列中找与 tokens 公共前缀最长（且超过 best）的一条，best 更新为该长度；
+    // 平移过的序列只有保留开头与新 prefill 的 KV 等价。至少留最后一个 token 给本序列计算 logits
+    SessionState* find_prefix_donor(const SessionState& self, const std::vector<llama_token>& tokens, int& best) {
+        SessionState* donor = nullptr;
+        auto consider = [&](SessionState& o) {
+            // 不同适配器算出的 KV 不能共享
+            if (&o == &self || o.seq < 0 || o.adapter != self.adapter) return;
+            int lim = std::min(o.n_past, (int)tokens.size() - 1);
+            if (o.n_discarded > 0) lim = std::min(lim, o.n_keep);
+            if (lim <= best) return;
+            int n = 0;
+            while (n < lim && o.last_tokens[n] == tokens[n]) ++n;
+            if (n > best) { best = n; donor = &o; }
+        };
+        for (auto& kv : sessions) consider(kv.second);
+        for (auto& sl : slots) consider(sl.temp);
+        return donor;
+    }
+
+    // 为 st 分配序列号，并保证共享 KV 还能再容纳 extra 个 cell；不够时按 LRU 淘汰空闲会话
+    bool make_resident(SessionState& st, int extra, std::string& err) {
+        st.last_used = ++use_clock;
+        if (st.seq < 0) {
+            if (free_seqs.empty() && !evict_lru()) { err = "no free sequence"; return false; }
+            st.seq = free_seqs.back(); free_seqs.pop_back();
+            st.n_past = 0; st.last_tokens.clear();
+        }
+        if (st.n_past + extra > n_ctx) { err = "context overflow"; return false; }
+        while (resident_cells() + extra > n_ctx) {
+            if (!evict_lru()) break;
+        }
         return true;
     }
+
+    void fill_session_stats(EngineStats& out) const;
+    void attach_threadpools();
+    ggml_threadpool* new_pinned_pool(int n) const;
+    void free_threadpools();
+    void build_piece_table();
+    void warmup();
+    bool load_draft(const std::string& path, std::string& err);
+    bool draft_vocab_matches(const llama_vocab* dv, std::string& err) const;
+    void free_draft();
+    void load_adapters();
+    void free_adapters();
+    int find_adapter(const std::string& name) const {
+        for (size_t i = 0; i < adapters.size(); ++i) if (adapters[i].name == name) return (int)i;
+        return -1;
+    }
+    void select_adapter();
+    void reset_draft();
+    void propose_draft();
+    void start_scheduler();
+    void stop_scheduler();
+    bool submit(Request* reqs, int n = 1);
+    void abandon(Request* req, const std::string& err);
+    void scheduler_loop();
+    bool admit(Slot& slot, Request* req);
+    void prepare_sampling(Slot& slot, Request* req);
+    void fork_branches(Slot& src);
+    GrammarMasks* masks_for(const std::shared_ptr<const ToolGrammar>& grammar);
+    const uint8_t* dry_breakers_for(const GenerateOptions& o);
+    bool scan_tool_call(Slot& slot, std::string_view piece);
+    void begin_tool_call(Slot& slot);
+    void resume_tool_call(Slot& slot);
+    void step();
+    void finish(Slot& slot, bool ok, const std::string& err);
 #endif
 };
 
@@ -67,7 +587,7 @@ LlamaEngine::~LlamaEngine() { unload_model(); }
 
 bool LlamaEngine::load_model(const std::string& model_path, std::string& err) {
 #if AICLI_WITH_LLAMA
-    sysbox::ScopedTimer t("inference", "load_model");
+    const auto t0 = std::chrono::steady_clock::now();
     if (impl_->loaded) {
         unload_model();
     }
@@ -80,38 +600,111 @@ bool LlamaEngine::load_model(const std::string& model_path, std::string& err) {
             }
         },
         nullptr);
-    // 从环境变量读取 n_ctx / n_threads
-    if (auto v = config::get_env("AICLI_CTX")) {
-        try { impl_->n_ctx = std::stoi(*v); } catch (...) {}
+    // 从环境变量读取 n_ctx / 线程数；线程数 <= 0 表示按核数
+    impl_->n_ctx = config::get_int("AICLI_CTX", "local_model.context_length", impl_->n_ctx);
+    const int hw = (int)std::max(1u, std::thread::hardware_concurrency());
+    impl_->n_threads = config::get_int("AICLI_THREADS", "local_model.threads", 0);
+    if (impl_->n_threads <= 0) impl_->n_threads = hw;
+    impl_->n_threads_batch = config::get_int("AICLI_THREADS_BATCH", "local_model.threads_batch", 0);
+    if (impl_->n_threads_batch <= 0) impl_->n_threads_batch = hw;
+    const std::string affinity = config::get_env("AICLI_CPU_AFFINITY").value_or(config::get_value("local_model.cpu_affinity").value_or(""));
+    if (!affinity.empty() && !parse_cpu_list(affinity, impl_->cpus)) {
+        sysbox::record({"inference", "warn", "invalid cpu_affinity: " + affinity});
+        impl_->cpus.clear();
+    }
+    if (auto v = config::get_env("AICLI_MAX_SEQS")) {
+        try { impl_->n_seq_max = std::max(1, std::stoi(*v)); } catch (...) {}
+    }
+    // 每步至少要放得下所有序列的解码 token 再加一段 prefill
+    impl_->n_ubatch = std::max(impl_->n_seq_max + 1, config::get_int("AICLI_UBATCH", "local_model.ubatch", impl_->n_ubatch));
+    impl_->embed_batch = std::max(64, config::get_int("AICLI_EMBED_BATCH", "local_model.embed_batch", impl_->embed_batch));
+    // llama 单个 context 的序列数上限为 256
+    impl_->embed_seqs = std::clamp(config::get_int("AICLI_EMBED_SEQS", "local_model.embed_seqs", impl_->embed_seqs), 1, 256);
+    if (auto v = config::get_env("AICLI_KV_PERSIST")) {
+        impl_->kv_persist = !(*v == "0" || *v == "off" || *v == "false");
+    }
+    impl_->ctx_keep = config::get_int("AICLI_CTX_KEEP", "local_model.ctx_keep", impl_->ctx_keep);
+    impl_->ctx_recent = config::get_int("AICLI_CTX_RECENT", "local_model.ctx_recent", impl_->ctx_recent);
+    // KV cache 类型与 flash attention；量化的 V cache 依赖 flash attention
+    const std::string tk = config::get_env("AICLI_KV_TYPE_K").value_or(config::get_value("local_model.kv_type_k").value_or("f16"));
+    const std::string tv = config::get_env("AICLI_KV_TYPE_V").value_or(config::get_value("local_model.kv_type_v").value_or("f16"));
+    if (!kv_type_from_name(tk, impl_->type_k) || !kv_type_from_name(tv, impl_->type_v)) {
+        err = "unsupported kv cache type: " + tk + "/" + tv;
+        return false;
     }
-    if (auto v = config::get_env("AICLI_THREADS")) {
-        try { impl_->n_threads = std::stoi(*v); } catch (...) {}
+    const std::string fa = config::get_env("AICLI_FLASH_ATTN").value_or(config::get_value("local_model.flash_attn").value_or("auto"));
+    impl_->flash_attn = fa == "on" || fa == "1" || fa == "true" ? LLAMA_FLASH_ATTN_TYPE_ENABLED
+                      : fa == "off" || fa == "0" || fa == "false" ? LLAMA_FLASH_ATTN_TYPE_DISABLED : LLAMA_FLASH_ATTN_TYPE_AUTO;
+    const bool v_quant = impl_->type_v != GGML_TYPE_F16 && impl_->type_v != GGML_TYPE_F32 && impl_->type_v != GGML_TYPE_BF16;
+    if (v_quant && impl_->flash_attn == LLAMA_FLASH_ATTN_TYPE_DISABLED) {
+        sysbox::record({"inference", "warn", "quantized V cache requires flash attention, enabling it"});
+        impl_->flash_attn = LLAMA_FLASH_ATTN_TYPE_ENABLED;
     }
+    // 不同 KV 类型的快照不能互相恢复，按类型分目录
+    impl_->model_fp = model_fingerprint(model_path);
+    if (impl_->type_k != GGML_TYPE_F16 || impl_->type_v != GGML_TYPE_F16) impl_->model_fp += "-" + tk + "-" + tv;
 
-    llama_backend_init();
+    backend_acquire(impl_->backend);
 
-    llama_model_params mparams = llama_model_default_params();
+    llama_model_params mparams = impl_->model_params();
+    impl_->progress = 0.0f;
+    impl_->progress_step = -1;
+    mparams.progress_callback = [](float p, void* ud) {
+        Impl* self = reinterpret_cast<Impl*>(ud);
+        self->progress = p;
+        const int step = (int)(p * 10);
+        if (step > self->progress_step) {
+            self->progress_step = step;
+            sysbox::record_json("inference", "info", std::string("{\"event\":\"load_progress\",\"progress\":") + std::to_string(p) + "}");
+        }
+        return !self->cancel_load.load();
+    };
+    mparams.progress_callback_user_data = impl_.get();
     impl_->model = llama_model_load_from_file(model_path.c_str(), mparams);
     if (!impl_->model) {
-        err = "failed to load model";
-        llama_backend_free();
+        err = impl_->cancel_load ? "load cancelled" : "failed to load model";
+        backend_release(impl_->backend);
         return false;
     }
+    const auto t_weights = std::chrono::steady_clock::now();
 
-    llama_context_params cparams = llama_context_default_params();
-    cparams.n_ctx = impl_->n_ctx;
-    cparams.abort_callback = (ggml_abort_callback) &Impl::ggml_abort_trampoline;
-    cparams.abort_callback_data = impl_.get();
-    impl_->ctx = llama_init_from_model(impl_->model, cparams);
-    if (!impl_->ctx) {
-        err = "failed to create context";
+    if (!impl_->create_context(err)) {
         llama_model_free(impl_->model);
         impl_->model = nullptr;
-        llama_backend_free();
+        backend_release(impl_->backend);
         return false;
     }
 
     impl_->vocab = llama_model_get_vocab(impl_->model);
+    impl_->sampler_ws.reserve(llama_vocab_n_tokens(impl_->vocab));
+    impl_->build_piece_table();
+    impl_->can_shift = llama_memory_can_shift(impl_->mem());
+    {
+        // 每个 cell 在每层存 n_embd_gqa 维的 K 与 V
+        const int n_head = std::max(1, llama_model_n_head(impl_->model));
+        const int64_t n_embd_gqa = (int64_t)llama_model_n_embd(impl_->model) / n_head * llama_model_n_head_kv(impl_->model);
+        impl_->kv_cell_bytes = (uint64_t)llama_model_n_layer(impl_->model) *
+                               (kv_row_bytes(impl_->type_k, n_embd_gqa) + kv_row_bytes(impl_->type_v, n_embd_gqa));
+    }
+    // 可选草稿模型：加载失败只告警，按普通解码运行
+    impl_->draft_k = std::max(1, config::get_int("AICLI_DRAFT_K", "local_model.draft_k", impl_->draft_k));
+    impl_->lookup_ngram = std::max(0, config::get_int("AICLI_LOOKUP_NGRAM", "local_model.lookup_ngram", impl_->lookup_ngram));
+    std::string draft_path = config::get_env("AICLI_DRAFT_MODEL").value_or(config::get_value("local_model.draft_model").value_or(""));
+    if (!draft_path.empty()) {
+        std::string derr;
+        if (impl_->load_draft(draft_path, derr)) {
+            logging::log(logging::Level::Info, "[llama] draft model loaded: " + draft_path);
+        } else {
+            sysbox::record({"inference", "warn", "draft model disabled: " + derr});
+        }
+    }
+    impl_->load_adapters();
+    {
+        llama_token t[4];
+        const char* im_end = "<|im_end|>";
+        const int n = llama_tokenize(impl_->vocab, im_end, (int)std::strlen(im_end), t, 4, false, true);
+        impl_->im_end = n == 1 ? t[0] : -1;
+    }
 
     // 读取元数据：architecture 与 chat_template（若存在）
     impl_->arch.clear();
@@ -127,7 +720,35 @@ bool LlamaEngine::load_model(const std::string& model_path, std::string& err) {
         int vn = llama_model_meta_val_str(impl_->model, "tokenizer.chat_template", buf.data(), BUF_SZ);
         if (vn > 0) impl_->chat_template.assign(buf.data(), buf.data() + vn);
     }
-    impl_->abort_requested.store(false, std::memory_order_relaxed);
+
+    // 预热：空跑一次解码，让权重页与计算图在首个真实请求之前就绪
+    const auto t_warm = std::chrono::steady_clock::now();
+    const bool warm = config::get_int("AICLI_WARMUP", "local_model.warmup", 1) != 0;
+    if (warm) impl_->warmup();
+    using namespace std::chrono;
+    const auto t1 = steady_clock::now();
+
+    // 量化方式由 GGUF 文件决定，配置里的 quant 只用于记录比对
+    char desc[128] = {0};
+    llama_model_desc(impl_->model, desc, sizeof(desc));
+    const std::string quant = config::get_value("local_model.quant").value_or("");
+    uint64_t lora_bytes = 0;
+    for (auto& a : impl_->adapters) lora_bytes += a.bytes;
+    sysbox::record_json("metrics", "info", std::string("{\"event\":\"model_load\",\"ms\":") + std::to_string(duration_cast<milliseconds>(t1 - t0).count()) +
+                        ",\"weights_ms\":" + std::to_string(duration_cast<milliseconds>(t_weights - t0).count()) +
+                        ",\"warmup_ms\":" + std::to_string(duration_cast<milliseconds>(t1 - t_warm).count()) +
+                        ",\"rss_mb\":" + std::to_string(sysbox::process_rss_bytes() >> 20) +
+                        ",\"model_mb\":" + std::to_string(llama_model_size(impl_->model) >> 20) +
+                        (impl_->adapters.empty() ? std::string() : ",\"adapters\":" + std::to_string(impl_->adapters.size()) + ",\"lora_mb\":" + std::to_string(lora_bytes >> 20)) +
+                        ",\"mmap\":" + (mparams.use_mmap ? "true" : "false") + ",\"mlock\":" + (mparams.use_mlock ? "true" : "false") +
+                        ",\"gpu_layers\":" + std::to_string(mparams.n_gpu_layers) + ",\"warmup\":" + (warm ? "true" : "false") +
+                        ",\"threads\":" + std::to_string(impl_->n_threads) + ",\"threads_batch\":" + std::to_string(impl_->n_threads_batch) +
+                        ",\"pinned\":" + (impl_->tp ? "true" : "false") +
+                        ",\"kv_type_k\":\"" + tk + "\",\"kv_type_v\":\"" + tv + "\",\"kv_mb\":" + std::to_string((impl_->kv_cell_bytes * impl_->n_ctx) >> 20) +
+                        ",\"desc\":\"" + desc + "\",\"quant\":\"" + quant + "\"}");
+    impl_->progress = 1.0f;
+    impl_->cold = true;
+    impl_->start_scheduler();
 #endif
     impl_->model_path = model_path;
     impl_->loaded = true;
@@ -136,20 +757,61 @@ bool LlamaEngine::load_model(const std::string& model_path, std::string& err) {
     return true;
 }
 
+void LlamaEngine::load_model_async(const std::string& model_path, LoadCallback done) {
+    impl_->join_loader();
+    {
+        std::lock_guard<std::mutex> lk(impl_->load_mu);
+        impl_->loading = true;
+    }
+    impl_->progress = 0.0f;
+    impl_->loader = std::thread([this, model_path, done = std::move(done)] {
+        std::string err;
+        const bool ok = load_model(model_path, err);
+        {
+            std::lock_guard<std::mutex> lk(impl_->load_mu);
+            impl_->loading = false;
+        }
+        impl_->load_cv.notify_all();
+        if (done) done(ok, err);
+    });
+}
+
+bool LlamaEngine::is_loading() const { return impl_->loading; }
+
+float LlamaEngine::load_progress() const { return impl_->loaded ? 1.0f : impl_->progress.load(); }
+
 void LlamaEngine::unload_model() {
+    impl_->join_loader();
 #if AICLI_WITH_LLAMA
-    { std::lock_guard<std::mutex> lk(impl_->mu); impl_->sessions.clear(); impl_->active_session.clear(); }
+    impl_->stop_scheduler();
+    {
+        std::lock_guard<std::mutex> lk(impl_->mu);
+        if (impl_->ctx) for (auto& kv : impl_->sessions) impl_->save_session(kv.first, kv.second);
+        impl_->sessions.clear(); impl_->free_seqs.clear();
+    }
+    impl_->kv_writer.flush();
+    {
+        // token id 随模型而变，缓存不能跨模型复用
+        std::lock_guard<std::mutex> lk(impl_->tok_mu);
+        impl_->prompt_caches.clear();
+    }
+    impl_->free_draft();
+    {
+        std::lock_guard<std::mutex> lk(impl_->embed_mu);
+        if (impl_->embed_ctx) { llama_free(impl_->embed_ctx); impl_->embed_ctx = nullptr; }
+    }
     if (impl_->ctx) {
         llama_free(impl_->ctx);
         impl_->ctx = nullptr;
     }
+    impl_->free_adapters();
+    impl_->free_threadpools();
     if (impl_->model) {
         llama_model_free(impl_->model);
         impl_->model = nullptr;
     }
     impl_->vocab = nullptr;
-    llama_backend_free();
-    impl_->abort_requested.store(false, std::memory_order_relaxed);
+    backend_release(impl_->backend);
 #endif
     if (impl_->loaded) {
         logging::log(logging::Level::Info, "[llama] model unloaded");
@@ -161,86 +823,998 @@ void LlamaEngine::unload_model() {
 bool LlamaEngine::is_loaded() const { return impl_->loaded; }
 
 #if AICLI_WITH_LLAMA
-static std::string token_to_piece(const llama_vocab* vocab, int token_id) {
-    char buf[8192];
-    int n = llama_token_to_piece(vocab, token_id, buf, sizeof(buf), /*lstrip*/0, /*special*/true);
-    if (n < 0) return std::string();
-    return std::string(buf, buf + n);
-}
-
-static int sample_top_p_temperature(const float* logits, int n_vocab, float temperature, float top_p, std::mt19937& rng) {
-    // 复制并缩放 logits
-    std::vector<float> scaled(logits, logits + n_vocab);
-    if (temperature > 0.0f) {
-        const float invT = 1.0f / temperature;
-        for (int i = 0; i < n_vocab; ++i) scaled[i] *= invT;
-    }
-    float max_logit = *std::max_element(scaled.begin(), scaled.end());
-    std::vector<float> probs(n_vocab);
-    double sum = 0.0;
-    for (int i = 0; i < n_vocab; ++i) {
-        float v = scaled[i] - max_logit;
-        float ev = std::exp(v);
-        probs[i] = ev;
-        sum += ev;
-    }
-    if (sum <= 0.0) {
-        int best = 0; float bestv = logits[0];
-        for (int i = 1; i < n_vocab; ++i) if (logits[i] > bestv) { bestv = logits[i]; best = i; }
-        return best;
-    }
-    for (int i = 0; i < n_vocab; ++i) probs[i] = (float)(probs[i] / sum);
-
-    std::vector<int> idx(n_vocab);
-    for (int i = 0; i < n_vocab; ++i) idx[i] = i;
-    std::sort(idx.begin(), idx.end(), [&](int a, int b){ return probs[a] > probs[b]; });
-
-    double acc = 0.0;
-    int cutoff = n_vocab;
-    for (int i = 0; i < n_vocab; ++i) {
-        acc += probs[idx[i]];
-        if (acc >= top_p) { cutoff = i + 1; break; }
-    }
-    if (cutoff < 1) cutoff = 1;
-
-    std::uniform_real_distribution<double> uni(0.0, 1.0);
-    double r = uni(rng);
-    double c = 0.0;
-    for (int i = 0; i < cutoff; ++i) {
-        int id = idx[i];
-        c += probs[id];
-        if (r <= c) return id;
-    }
-    return idx[0];
+// 整个词表的 piece 预先拼进一块连续内存，解码时按偏移取 string_view
+void LlamaEngine::Impl::build_piece_table() {
+    const int n_vocab = llama_vocab_n_tokens(vocab);
+    // 文法索引引用旧的 piece 表，随之作废
+    grammar_masks.clear();
+    grammar_vocab = GrammarVocab();
+    dry_breakers.clear();
+    piece_arena.clear();
+    piece_off.assign((size_t)n_vocab + 1, 0);
+    char buf[256];
+    for (int id = 0; id < n_vocab; ++id) {
+        int n = llama_token_to_piece(vocab, id, buf, sizeof(buf), /*lstrip*/0, /*special*/true);
+        if (n > (int)sizeof(buf)) {
+            std::string big((size_t)n, '\0');
+            n = llama_token_to_piece(vocab, id, big.data(), n, 0, true);
+            if (n > 0) piece_arena.insert(piece_arena.end(), big.data(), big.data() + n);
+        } else if (n > 0) {
+            piece_arena.insert(piece_arena.end(), buf, buf + n);
+        }
+        piece_off[id + 1] = (uint32_t)piece_arena.size();
+    }
+    piece_arena.shrink_to_fit();
+}
+
+static int batch_add(llama_batch& b, llama_token tok, llama_pos pos, llama_seq_id seq, bool logits) {
+    const int i = b.n_tokens++;
+    b.token[i] = tok; b.pos[i] = pos;
+    b.n_seq_id[i] = 1; b.seq_id[i][0] = seq;
+    b.logits[i] = logits;
+    return i;
+}
+
+// 调度线程上执行：会话簿记归调度线程所有，统计在这里读取
+void LlamaEngine::Impl::fill_session_stats(EngineStats& out) const {
+    out.sessions.clear();
+    out.kv_used_bytes = 0;
+    out.active_adapter = cur_adapter >= 0 ? adapters[cur_adapter].name : std::string();
+    out.adapter_switches = adapter_switches;
+    out.adapter_switch_us = adapter_switches > 0 ? adapter_switch_ns / 1000.0 / adapter_switches : 0.0;
+    auto add = [&](const std::string& id, const SessionState& st) {
+        SessionStats s;
+        s.session_id = id;
+        s.resident = st.seq >= 0;
+        s.tokens = s.resident ? st.n_past : 0;
+        s.shared_tokens = s.resident ? st.n_shared : 0;
+        s.kv_bytes = (uint64_t)(s.tokens - s.shared_tokens) * kv_cell_bytes;
+        out.kv_used_bytes += s.kv_bytes;
+        out.sessions.push_back(std::move(s));
+    };
+    for (auto& kv : sessions) add(kv.first, kv.second);
+    for (auto& sl : slots) if (sl.temp.seq >= 0) add("(临时)", sl.temp);
+    std::sort(out.sessions.begin(), out.sessions.end(), [](const SessionStats& a, const SessionStats& b) { return a.kv_bytes > b.kv_bytes; });
+}
+
+// 绑核线程池：线程依次固定到 cpus 中的核，线程数不超过核数；解码与 prefill 各建一个，两者不同时运行，可共用同一组核
+ggml_threadpool* LlamaEngine::Impl::new_pinned_pool(int n) const {
+    ggml_threadpool_params p = ggml_threadpool_params_default(std::min(n, (int)cpus.size()));
+    std::fill(std::begin(p.cpumask), std::end(p.cpumask), false);
+    for (int c : cpus) if (c < GGML_MAX_N_THREADS) p.cpumask[c] = true;
+    p.strict_cpu = true;
+    return ggml_threadpool_new(&p);
+}
+
+void LlamaEngine::Impl::attach_threadpools() {
+    tp = new_pinned_pool(n_threads);
+    tp_batch = new_pinned_pool(n_threads_batch);
+    if (!tp || !tp_batch) {
+        sysbox::record({"inference", "warn", "cpu affinity disabled: failed to create threadpool"});
+        free_threadpools();
+        return;
+    }
+    llama_attach_threadpool(ctx, tp, tp_batch);
+}
+
+void LlamaEngine::Impl::free_threadpools() {
+    if (tp) { ggml_threadpool_free(tp); tp = nullptr; }
+    if (tp_batch) { ggml_threadpool_free(tp_batch); tp_batch = nullptr; }
+}
+
+// 在序列 0 上解码一个 BOS 后清空 KV：触发权重换页与计算图分配，草稿模型同样处理
+void LlamaEngine::Impl::warmup() {
+    llama_token bos = llama_vocab_bos(vocab);
+    if (bos < 0) bos = 0;
+    for (llama_context* c : {ctx, draft_ctx}) {
+        if (!c) continue;
+        llama_batch b = llama_batch_init(1, 0, 1);
+        batch_add(b, bos, 0, 0, true);
+        if (llama_decode(c, b) == 0) llama_synchronize(c);
+        llama_batch_free(b);
+        llama_memory_clear(llama_get_memory(c), true);
+    }
+}
+
+// 草稿 token 按 id 直接交给目标模型验证：两边每个 id 的 piece 与 BOS/EOS/EOG/控制属性都必须一致，只比词表大小不够
+bool LlamaEngine::Impl::draft_vocab_matches(const llama_vocab* dv, std::string& err) const {
+    const int n_vocab = llama_vocab_n_tokens(vocab);
+    if (llama_vocab_n_tokens(dv) != n_vocab) { err = "draft model vocab size mismatch"; return false; }
+    if (llama_vocab_bos(dv) != llama_vocab_bos(vocab) || llama_vocab_eos(dv) != llama_vocab_eos(vocab)) {
+        err = "draft model special tokens mismatch";
+        return false;
+    }
+    std::string buf(256, '\0');
+    for (int id = 0; id < n_vocab; ++id) {
+        int n = llama_token_to_piece(dv, id, buf.data(), (int32_t)buf.size(), 0, true);
+        if (n > (int)buf.size()) { buf.resize((size_t)n); n = llama_token_to_piece(dv, id, buf.data(), n, 0, true); }
+        const std::string_view piece(buf.data(), (size_t)std::max(n, 0));
+        if (piece != piece_of(id) || llama_vocab_is_eog(dv, id) != llama_vocab_is_eog(vocab, id) ||
+            llama_vocab_is_control(dv, id) != llama_vocab_is_control(vocab, id)) {
+            err = "draft model vocab mismatch at token " + std::to_string(id);
+            return false;
+        }
+    }
+    return true;
+}
+
+// 草稿模型与目标模型共享词表与权重加载参数，context 形状一致（同样的 n_ctx / 序列数 / batch）
+bool LlamaEngine::Impl::load_draft(const std::string& path, std::string& err) {
+    draft_model = llama_model_load_from_file(path.c_str(), model_params());
+    if (!draft_model) { err = "failed to load draft model"; return false; }
+    if (!draft_vocab_matches(llama_model_get_vocab(draft_model), err)) {
+        free_draft();
+        return false;
+    }
+    draft_ctx = llama_init_from_model(draft_model, context_params());
+    if (!draft_ctx) { err = "failed to create draft context"; free_draft(); return false; }
+    draft_hist.assign(n_seq_max, {});
+    draft_batch = llama_batch_init(n_ubatch, 0, 1);
+    return true;
+}
+
+void LlamaEngine::Impl::free_draft() {
+    if (draft_ctx) { llama_batch_free(draft_batch); draft_batch = {}; llama_free(draft_ctx); draft_ctx = nullptr; }
+    if (draft_model) { llama_model_free(draft_model); draft_model = nullptr; }
+    draft_hist.clear();
+}
+
+// 配置 AICLI_LORA / local_model.lora：逗号分隔的 name=path[:scale]，省略 name= 时取文件名。
+// 适配器权重加载时整体读入，大小按文件计；加载失败的适配器只告警跳过
+void LlamaEngine::Impl::load_adapters() {
+    const std::string spec = config::get_env("AICLI_LORA").value_or(config::get_value("local_model.lora").value_or(""));
+    size_t pos = 0;
+    while (pos < spec.size()) {
+        size_t end = spec.find(',', pos);
+        if (end == std::string::npos) end = spec.size();
+        std::string item = spec.substr(pos, end - pos);
+        pos = end + 1;
+        item.erase(0, item.find_first_not_of(" \t"));
+        item.erase(item.find_last_not_of(" \t") + 1);
+        if (item.empty()) continue;
+        Adapter a;
+        const size_t eq = item.find('=');
+        a.path = eq == std::string::npos ? item : item.substr(eq + 1);
+        const size_t colon = a.path.rfind(':');
+        if (colon != std::string::npos && a.path.find_first_of("/\\", colon) == std::string::npos) {
+            try { a.scale = std::stof(a.path.substr(colon + 1)); a.path.resize(colon); } catch (...) {}
+        }
+        a.name = eq == std::string::npos ? std::filesystem::path(a.path).stem().string() : item.substr(0, eq);
+        if (find_adapter(a.name) >= 0 || adapters.size() >= 63) {
+            sysbox::record({"inference", "warn", "lora adapter skipped: " + a.name});
+            continue;
+        }
+        const auto t0 = std::chrono::steady_clock::now();
+        a.lora = llama_adapter_lora_init(model, a.path.c_str());
+        if (!a.lora) {
+            sysbox::record({"inference", "warn", "failed to load lora adapter: " + a.path});
+            continue;
+        }
+        std::error_code ec;
+        a.bytes = std::filesystem::file_size(a.path, ec);
+        const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+        sysbox::record_json("inference", "info", std::string("{\"event\":\"lora_load\",\"name\":\"") + a.name + "\",\"mb\":" +
+                            std::to_string(a.bytes >> 20) + ",\"scale\":" + std::to_string(a.scale) + ",\"ms\":" + std::to_string(ms) + "}");
+        adapters.push_back(std::move(a));
+    }
+}
+
+void LlamaEngine::Impl::free_adapters() {
+    for (auto& a : adapters) llama_adapter_lora_free(a.lora);
+    adapters.clear();
+    cur_adapter = -1;
+    adapter_steps = adapter_switches = 0;
+    adapter_switch_ns = 0;
+}
+
+// 每步开头选定本步的适配器：当前适配器仍有请求时最多连续 kAdapterQuantum 步，之后轮到下一个有请求在等的适配器。
+// 切换只改 context 上挂的适配器（下一次 decode 重建计算图），不动基座权重与 KV
+void LlamaEngine::Impl::select_adapter() {
+    uint64_t want = 0; // 第 a+1 位：适配器 a 有请求可解码
+    for (auto& sl : slots) if (sl.req && !sl.tool_wait) want |= 1ull << (sl.req->adapter + 1);
+    const uint64_t cur = 1ull << (cur_adapter + 1);
+    if (!want || want == cur || ((want & cur) && adapter_steps < kAdapterQuantum)) { ++adapter_steps; return; }
+    const int n = (int)adapters.size() + 1;
+    int next = cur_adapter;
+    for (int i = 1; i <= n; ++i) {
+        const int b = (cur_adapter + 1 + i) % n;
+        if (want & (1ull << b)) { next = b - 1; break; }
+    }
+    const auto t0 = std::chrono::steady_clock::now();
+    llama_clear_adapter_lora(ctx);
+    if (next >= 0) llama_set_adapter_lora(ctx, adapters[next].lora, adapters[next].scale);
+    adapter_switch_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t0).count();
+    ++adapter_switches;
+    ++busy_switches;
+    cur_adapter = next;
+    adapter_steps = 1;
+}
+
+// 草稿 KV 放不下或解码失败：整体清空，下一步按需重新补齐
+void LlamaEngine::Impl::reset_draft() {
+    llama_memory_clear(llama_get_memory(draft_ctx), true);
+    for (auto& h : draft_hist) h.clear();
+    for (auto& sl : slots) sl.draft.clear();
+}
+
+// 为每个 n_spec > 0 的解码中序列贪心提议至多 n_spec 个草稿 token。
+// 草稿 KV 只与目标序列的 last_tokens 比较最长公共前缀并补齐差额，
+// 因此目标侧的分叉裁剪、上下文平移、序列号复用都无需另行通知草稿模型
+void LlamaEngine::Impl::propose_draft() {
+    llama_memory_t dmem = llama_get_memory(draft_ctx);
+    const int n_vocab = llama_vocab_n_tokens(vocab);
+    const int eos = llama_vocab_eos(vocab);
+    auto collect = [&]() {
+        for (auto& sl : slots) {
+            if (sl.draft_idx < 0) continue;
+            const float* logits = llama_get_logits_ith(draft_ctx, sl.draft_idx);
+            if (logits) sl.draft.push_back(sample_greedy(logits, n_vocab));
+            else sl.n_spec = 0;
+        }
+    };
+    for (auto& sl : slots) {
+        if (!sl.req || sl.n_spec <= 0) continue;
+        auto& h = draft_hist[sl.st->seq];
+        const auto& lt = sl.st->last_tokens;
+        size_t lcp = 0;
+        while (lcp < h.size() && lcp < lt.size() && h[lcp] == lt[lcp]) ++lcp;
+        if (lcp < h.size()) { llama_memory_seq_rm(dmem, sl.st->seq, (llama_pos)lcp, -1); h.resize(lcp); }
+    }
+
+    // 补齐：缺的历史与 pending 一起喂入，多条序列合并成 batch，pending 处取 logits 得到第一个草稿
+    while (true) {
+        draft_batch.n_tokens = 0;
+        for (auto& sl : slots) {
+            sl.draft_idx = -1;
+            if (!sl.req || sl.n_spec <= 0) continue;
+            auto& h = draft_hist[sl.st->seq];
+            const auto& lt = sl.st->last_tokens;
+            while (h.size() <= lt.size() && draft_batch.n_tokens < n_batch) {
+                const bool last = h.size() == lt.size();
+                const llama_token t = last ? sl.pending : lt[h.size()];
+                const int i = batch_add(draft_batch, t, (llama_pos)h.size(), sl.st->seq, last);
+                if (last) sl.draft_idx = i;
+                h.push_back(t);
+            }
+        }
+        if (draft_batch.n_tokens == 0) break;
+        if (timed_decode(draft_ctx, draft_batch) != 0) { reset_draft(); return; }
+        collect();
+    }
+
+    // 之后每轮每条序列只喂上一轮的草稿
+    while (true) {
+        draft_batch.n_tokens = 0;
+        for (auto& sl : slots) {
+            sl.draft_idx = -1;
+            if (!sl.req || sl.draft.empty() || (int)sl.draft.size() >= sl.n_spec || sl.draft.back() == eos) continue;
+            auto& h = draft_hist[sl.st->seq];
+            sl.draft_idx = batch_add(draft_batch, sl.draft.back(), (llama_pos)h.size(), sl.st->seq, true);
+            h.push_back(sl.draft.back());
+        }
+        if (draft_batch.n_tokens == 0) break;
+        if (timed_decode(draft_ctx, draft_batch) != 0) { reset_draft(); return; }
+        collect();
+    }
+}
+
+void LlamaEngine::Impl::start_scheduler() {
+    n_batch = (int)llama_n_batch(ctx);
+    batch = llama_batch_init(n_batch, 0, 1); // 整个调度生命周期只分配一次
+    slots.clear();
+    slots.resize(n_seq_max);
+    if (draft_ctx || lookup_ngram > 0) for (auto& sl : slots) sl.draft.reserve(draft_k);
+    stopping = false;
+    worker = std::thread([this]{ scheduler_loop(); });
+}
+
+void LlamaEngine::Impl::stop_scheduler() {
+    if (!worker.joinable()) return;
+    {
+        std::lock_guard<std::mutex> lk(mu);
+        stopping = true;
+    }
+    cv.notify_all();
+    worker.join();
+    done_cv.notify_all(); // 唤醒等待统计的调用方
+    llama_batch_free(batch);
+    batch = {};
+}
+
+static bool tokenize_append(const llama_vocab* vocab, std::string_view text, bool add_bos, bool special, std::vector<llama_token>& out);
+
+// n > 1 时 reqs[0] 进入队列，其余挂在它的 forks 上，等它的 prompt 算完后分叉；全部完成才返回
+bool LlamaEngine::Impl::submit(Request* reqs, int n) {
+    std::unique_lock<std::mutex> lk(mu);
+    if (stopping || !worker.joinable()) { reqs[0].err = "model not loaded"; return false; }
+    const auto now = std::chrono::steady_clock::now();
+    for (int i = 0; i < n; ++i) {
+        reqs[i].t_submit = now;
+        reqs[i].branch = i;
+        if (i > 0) reqs[0].forks.push_back(&reqs[i]);
+        inflight.push_back(&reqs[i]);
+    }
+    queue.push_back(&reqs[0]);
+    cv.notify_all();
+    // 等待期间由本线程执行工具调用，调度线程不被工具阻塞
+    while (true) {
+        Request* call = nullptr;
+        done_cv.wait(lk, [&]{
+            for (int i = 0; i < n; ++i) {
+                if (!reqs[i].done && reqs[i].tool_state == Request::ToolCalled) { call = &reqs[i]; return true; }
+            }
+            return std::all_of(reqs, reqs + n, [](const Request& r) { return r.done; });
+        });
+        if (!call) break;
+        const std::string text = std::move(call->tool_call);
+        call->tool_state = Request::ToolIdle; // 执行期间不再重复领取
+        lk.unlock();
+        ToolInjection inject;
+        std::vector<llama_token> toks;
+        // 只有模板标记按特殊 token 解析：工具输出（文件内容、命令输出）里的标记字样不能伪造出新的对话轮次
+        const bool go = call->options.tool_handler(text, inject) && tokenize_append(vocab, inject.open, false, true, toks) &&
+                        tokenize_append(vocab, inject.body, false, false, toks) && tokenize_append(vocab, inject.close, false, true, toks);
+        lk.lock();
+        call->tool_tokens = std::move(toks);
+        call->tool_state = go ? Request::ToolReady : Request::ToolDeclined;
+        cv.notify_all();
+    }
+    bool ok = true;
+    for (int i = 0; i < n; ++i) {
+        inflight.erase(std::find(inflight.begin(), inflight.end(), &reqs[i]));
+        ok = ok && reqs[i].ok;
+    }
+    return ok;
+}
+
+// 持有 mu 时调用：请求未进入槽位就结束，连同尚未分叉的候选一起返回
+void LlamaEngine::Impl::abandon(Request* req, const std::string& err) {
+    req->ok = false; req->err = err; req->done = true;
+    for (Request* f : req->forks) { f->ok = false; f->err = err; f->done = true; }
+    req->forks.clear();
+    done_cv.notify_all();
+}
+
+void LlamaEngine::Impl::finish(Slot& slot, bool ok, const std::string& err) {
+    Request* req = slot.req;
+    if (ok && !slot.stop.empty() && !slot.stop.matched()) {
+        // 未命中停止串而结束：留存的尾部字节属于正文
+        slot.stop_out.clear();
+        slot.stop.finish(slot.stop_out);
+        if (!slot.stop_out.empty()) (*req->on_token)(slot.stop_out);
+    }
+    if (ok) {
+        using namespace std::chrono;
+        const auto now = steady_clock::now();
+        const double ms = (double)duration_cast<milliseconds>(now - slot.t_start).count();
+        const double prefill_ms = (double)duration_cast<milliseconds>(slot.t_decode - slot.t_start).count();
+        const double decode_ms = (double)duration_cast<milliseconds>(now - slot.t_decode).count();
+        // 首 token 延迟含排队；加载后的第一个请求标记 cold，用于观察预热效果
+        const double ttft_ms = (double)duration_cast<milliseconds>(slot.t_decode - req->t_submit).count();
+        const bool was_cold = cold;
+        cold = false;
+        sysbox::add_duration_sample("inference.ttft.ms", ttft_ms);
+        // prefill 与 decode 吞吐分开统计
+        double tps = decode_ms > 0 ? (req->gen_tokens * 1000.0 / decode_ms) : 0.0;
+        double prefill_tps = prefill_ms > 0 ? (slot.n_prefill * 1000.0 / prefill_ms) : 0.0;
+        auto [p50,p95] = sysbox::add_duration_sample("inference.generate.ms", ms);
+        sysbox::record_json("metrics","info", std::string("{\"tokens\":") + std::to_string(req->gen_tokens) + ",\"ms\":" + std::to_string(ms) + ",\"tokens_per_s\":" + std::to_string(tps) +
+                            ",\"prefill_tokens\":" + std::to_string(slot.n_prefill) + ",\"prefill_ms\":" + std::to_string(prefill_ms) + ",\"prefill_tokens_per_s\":" + std::to_string(prefill_tps) +
+                            ",\"p50\":" + std::to_string(p50) + ",\"p95\":" + std::to_string(p95) +
+                            ",\"ttft_ms\":" + std::to_string(ttft_ms) + (was_cold ? ",\"cold\":true" : "") + (slot.stop.matched() ? ",\"stop\":true" : "") +
+                            (req->tool_calls > 0 ? ",\"tool_calls\":" + std::to_string(req->tool_calls) + ",\"tool_tokens\":" + std::to_string(req->tool_injected) : std::string()) +
+                            (slot.n_masked > 0 ? ",\"grammar_tokens\":" + std::to_string(slot.n_masked) +
+                                                 ",\"mask_us_per_token\":" + std::to_string(slot.mask_ns / 1000.0 / slot.n_masked) : std::string()) +
+                            (req->branch > 0 ? ",\"branch\":" + std::to_string(req->branch) + (req->forked ? ",\"forked\":true" : "") : std::string()) +
+                            (slot.n_drafted > 0 ? ",\"draft_tokens\":" + std::to_string(slot.n_drafted) + ",\"draft_accepted\":" + std::to_string(slot.n_accepted) +
+                                                  ",\"accept_rate\":" + std::to_string((double)slot.n_accepted / slot.n_drafted) : std::string()) + "}");
+    } else if (req->options.cancel->cancelled()) {
+        // 取消到槽位空闲的延迟：步间检查时不超过一个解码步，decode 内被中断时更短
+        const double ms = req->options.cancel->ms_since_cancel();
+        sysbox::add_duration_sample("inference.abort.ms", ms);
+        sysbox::record_json("metrics","info", std::string("{\"event\":\"abort\",\"session\":\"") + req->session_id +
+                            "\",\"gen_tokens\":" + std::to_string(req->gen_tokens) + ",\"abort_to_idle_ms\":" + std::to_string(ms) + "}");
+    }
+    std::lock_guard<std::mutex> lk(mu);
+    slot.st->busy = false;
+    if (slot.st == &slot.temp) release_seq(slot.temp);
+    slot.req = nullptr; slot.st = nullptr; slot.pending = -1;
+    req->ok = ok; req->err = err;
+    req->done = true;
+    // prompt 未算完就结束：等待分叉的候选随之失败
+    for (Request* f : req->forks) { f->ok = false; f->err = err.empty() ? "branch not started" : err; f->done = true; }
+    req->forks.clear();
+    done_cv.notify_all();
+}
+
+// 调度线程上执行：为请求绑定会话序列，计算可复用前缀并裁掉分叉部分
+bool LlamaEngine::Impl::admit(Slot& slot, Request* req) {
+    slot.req = req;
+    slot.t_start = std::chrono::steady_clock::now();
+    slot.pending = -1;
+    slot.n_drafted = slot.n_accepted = 0;
+    std::string err;
+    int lcp = 0, shared = 0;
+    {
+        SessionState* st = req->session_id.empty() ? &slot.temp : &sessions[req->session_id];
+        slot.st = st;
+        st->busy = true;
+        if (!req->session_id.empty() && st->seq < 0 && !st->disk_checked) restore_session(req->session_id, *st);
+        st->adapter = req->adapter;
+        std::vector<llama_token>& tokens = req->tokens;
+        if (st->n_discarded > 0) {
+            // 会话此前平移过：新 prompt 去掉同一段中段后才与 last_tokens（KV 坐标）对齐；
+            // 开头对不上或历史变短说明历史被改写，放弃平移记录，由下面的 LCP 决定复用多少
+            const int k = st->n_keep, end = k + st->n_discarded;
+            if ((int)tokens.size() > end && (int)st->last_tokens.size() >= k &&
+                std::equal(st->last_tokens.begin(), st->last_tokens.begin() + k, tokens.begin())) {
+                tokens.erase(tokens.begin() + k, tokens.begin() + end);
+            } else {
+                st->n_keep = st->n_discarded = 0;
+            }
+        }
+        const int n_last = (int)st->last_tokens.size();
+        while (lcp < n_last && lcp < (int)tokens.size() && st->last_tokens[lcp] == tokens[lcp]) { ++lcp; }
+        // 至少重算最后一个 token 以获得本序列的 logits
+        if (lcp == (int)tokens.size()) --lcp;
+        if (st->seq >= 0 && lcp < st->n_past) {
+            // 历史在 lcp 处分叉：只裁掉该序列 lcp 之后的 KV；不支持部分删除时整条重来
+            if (!llama_memory_seq_rm(mem(), st->seq, lcp, -1)) {
+                llama_memory_seq_rm(mem(), st->seq, -1, -1);
+                lcp = 0;
+            }
+            st->n_past = lcp;
+            st->last_tokens.resize(lcp);
+            st->n_shared = std::min(st->n_shared, lcp);
+        }
+        if (st->seq < 0) lcp = 0;
+        // prompt 放不进窗口（需给生成留出余量）：保留开头与最近部分，丢弃中段
+        const int limit = n_ctx - std::min(std::max(1, req->options.max_new_tokens), n_ctx / 4);
+        if ((int)tokens.size() > limit) {
+            if (st->n_discarded == 0) st->n_keep = keep_len(tokens);
+            const int d = (int)tokens.size() - st->n_keep - std::min(recent_len(st->n_keep), limit - st->n_keep);
+            shift_kv(*st, d);
+            tokens.erase(tokens.begin() + st->n_keep, tokens.begin() + st->n_keep + d);
+            st->n_discarded += d;
+            if (st->seq >= 0) lcp = st->n_past;
+            record_shift(req->session_id, *st, d);
+        }
+        // 其他序列已有更长的相同前缀（典型为同一 system prompt）：复制其 cell 而不是重新 prefill。
+        // 找到的提供方在腾挪空间期间临时标记为忙，避免刚选中就被淘汰
+        int best = lcp + kPrefixShareMin - 1;
+        SessionState* donor = find_prefix_donor(*st, tokens, best);
+        const bool donor_busy = donor ? donor->busy : false;
+        if (donor) donor->busy = true;
+        make_resident(*st, (int)tokens.size() - (donor ? best : lcp), err);
+        if (donor) {
+            donor->busy = donor_busy;
+            if (err.empty() && st->n_past == lcp) {
+                // unified KV 中 seq_cp 只给已有 cell 追加序列号，不复制数据
+                llama_memory_seq_cp(mem(), donor->seq, st->seq, lcp, best);
+                st->last_tokens.insert(st->last_tokens.end(), tokens.begin() + lcp, tokens.begin() + best);
+                st->n_past = best;
+                st->n_shared = best;
+                shared = best - lcp;
+                lcp = best;
+                prefix_saved += shared;
+            }
+        }
+    }
+    if (!err.empty()) { finish(slot, false, err); return false; }
+    slot.n_prompt_done = lcp;
+    slot.n_prefill = (int)req->tokens.size() - lcp;
+    if (!req->session_id.empty() || shared > 0) {
+        sysbox::record_json("inference", "info", std::string("{\"event\":\"prefill\",\"session\":\"") + req->session_id +
+                            "\",\"reused\":" + std::to_string(lcp - shared) + ",\"shared\":" + std::to_string(shared) +
+                            ",\"prefill\":" + std::to_string((int)req->tokens.size() - lcp) + ",\"shared_total\":" + std::to_string(prefix_saved) + "}");
+    }
+
+    prepare_sampling(slot, req);
+    return true;
+}
+
+// 采样链按请求配置一次，并用 prompt 尾部预热惩罚窗口；各候选的种子依序号错开
+void LlamaEngine::Impl::prepare_sampling(Slot& slot, Request* req) {
+    const GenerateOptions& o = req->options;
+    slot.sampler.configure(o, llama_vocab_n_tokens(vocab), request_seed() + (uint32_t)req->branch, dry_breakers_for(o));
+    const int warm = std::max(o.penalty_last_n, o.dry_multiplier > 0.0f ? o.dry_penalty_last_n : 0);
+    const size_t from = req->tokens.size() > (size_t)warm ? req->tokens.size() - warm : 0;
+    for (size_t i = from; i < req->tokens.size(); ++i) slot.sampler.accept(req->tokens[i]);
+    // 本请求的生成不再触发 last_tokens 扩容
+    slot.st->last_tokens.reserve(req->tokens.size() + o.max_new_tokens + draft_k + 1);
+    if (lookup_ngram > 0) {
+        slot.lookup.reset(lookup_ngram, req->tokens.size() + o.max_new_tokens);
+        for (llama_token t : req->tokens) slot.lookup.append(t);
+    }
+    slot.stop.build(o.stop);
+    slot.in_tool = slot.tool_wait = slot.tool_resume = slot.closing = false;
+    slot.tool_text.clear();
+    slot.grammar = nullptr;
+    slot.g_state = -1;
+    slot.n_masked = 0;
+    slot.mask_ns = 0;
+}
+
+// 调度线程上、prompt 最后一块 decode 之后调用：把 src 的整条 KV 共享给等待中的候选。
+// 分叉出的槽位复制 src 本步的簿记状态，随后与 src 一样从同一行 logits 采样首个 token，不再各自 prefill
+void LlamaEngine::Impl::fork_branches(Slot& src) {
+    Request* leader = src.req;
+    const int n_kv = src.st->n_past + src.n_batched;
+    std::vector<Request*> rest;
+    for (Request* f : leader->forks) {
+        Slot* dst = nullptr;
+        for (auto& sl : slots) if (!sl.req) { dst = &sl; break; }
+        std::string err;
+        if (!dst || !make_resident(dst->temp, 0, err)) { rest.push_back(f); continue; }
+        SessionState& st = dst->temp;
+        st.adapter = src.st->adapter;
+        // unified KV 中 seq_cp 只给已有 cell 追加序列号；这些 cell 记在 src 名下
+        llama_memory_seq_cp(mem(), src.st->seq, st.seq, 0, n_kv);
+        st.last_tokens = src.st->last_tokens;
+        st.n_past = src.st->n_past;
+        st.n_shared = n_kv;
+        st.busy = true;
+        f->tokens = leader->tokens; // admit 可能为平移改写过 prompt
+        f->forked = true;
+        dst->req = f;
+        dst->st = &st;
+        dst->t_start = std::chrono::steady_clock::now();
+        dst->pending = -1;
+        dst->n_drafted = dst->n_accepted = 0;
+        dst->n_prompt_done = src.n_prompt_done;
+        dst->n_batched = src.n_batched;
+        dst->out_idx = src.out_idx;
+        dst->n_prefill = 0;
+        dst->draft.clear();
+        prepare_sampling(*dst, f);
+    }
+    leader->forks.clear();
+    if (rest.empty()) return;
+    // 槽位或序列不够的候选按普通请求排在队首，自行 prefill
+    std::lock_guard<std::mutex> lk(mu);
+    queue.insert(queue.begin(), rest.begin(), rest.end());
+}
+
+void LlamaEngine::Impl::step() {
+    const int eos = llama_vocab_eos(vocab);
+    batch.n_tokens = 0;
+
+    // 先放所有解码中序列的下一个 token（推测解码时连同草稿），再用剩余预算装入待 prefill 的 prompt 分块；
+    // 长 prompt 因此被切成多步完成，每步之间都会检查中断，并与其他会话的解码交错进行
+    int n_decoding = 0;
+    if (!adapters.empty()) select_adapter();
+    for (auto& sl : slots) {
+        sl.out_idx = -1; sl.n_batched = 0; sl.n_spec = 0;
+        sl.draft.clear();
+        sl.held = sl.req && sl.req->adapter != cur_adapter;
+        if (!sl.req || sl.pending < 0 || sl.tool_wait || sl.held) continue;
+        if (sl.st->n_past + 1 > n_ctx && !shift_context(sl)) { finish(sl, false, "context overflow"); continue; }
+        ++n_decoding;
+    }
+    if ((draft_ctx || lookup_ngram > 0) && n_decoding > 0) {
+        // 草稿数受 batch 容量、剩余上下文与剩余生成额度限制
+        const int k = std::min(draft_k, n_batch / n_decoding - 1);
+        for (auto& sl : slots) {
+            if (!sl.req || sl.pending < 0 || sl.tool_wait || sl.held || sl.closing) continue;
+            sl.n_spec = std::max(0, std::min({k, n_ctx - sl.st->n_past - 1, sl.req->options.max_new_tokens - sl.req->gen_tokens - 1}));
+            // 先做不花算力的提示词查找，命中的序列不再调用草稿模型
+            if (lookup_ngram > 0 && sl.n_spec > 0 && sl.lookup.propose(sl.n_spec, sl.draft) > 0) sl.n_spec = 0;
+        }
+        if (draft_ctx) propose_draft();
+    }
+    for (auto& sl : slots) {
+        if (!sl.req || sl.pending < 0 || sl.tool_wait || sl.held) continue;
+        sl.out_idx = batch_add(batch, sl.pending, sl.st->n_past, sl.st->seq, true);
+        for (int i = 0; i < (int)sl.draft.size(); ++i) batch_add(batch, sl.draft[i], sl.st->n_past + 1 + i, sl.st->seq, true);
+        sl.n_batched = 1 + (int)sl.draft.size();
+    }
+    for (auto& sl : slots) {
+        if (!sl.req || sl.pending >= 0 || sl.held) continue;
+        const int n_prompt = (int)sl.req->tokens.size();
+        const int take = std::min(n_prompt - sl.n_prompt_done, n_batch - batch.n_tokens);
+        if (take <= 0) continue;
+        for (int i = 0; i < take; ++i) {
+            const int ti = sl.n_prompt_done + i;
+            const int bi = batch_add(batch, sl.req->tokens[ti], sl.st->n_past + i, sl.st->seq, ti == n_prompt - 1);
+            if (ti == n_prompt - 1) sl.out_idx = bi;
+        }
+        sl.n_batched = take;
+    }
+    if (batch.n_tokens == 0) return;
+
+    while (resident_cells() + batch.n_tokens > n_ctx && evict_lru()) {}
+    int32_t r = 0;
+    while (true) {
+        r = timed_decode(ctx, batch);
+        if (r != 1) break;
+        // 找不到连续 KV 槽：淘汰空闲会话后重试
+        if (!evict_lru()) break;
+    }
+    if (r != 0) {
+        const std::string err = r == 2 ? "aborted" : "decode failed (batch)";
+        for (auto& sl : slots) {
+            if (!sl.req || sl.n_batched == 0) continue;
+            llama_memory_seq_rm(mem(), sl.st->seq, sl.st->n_past, -1);
+            finish(sl, false, err);
+        }
+        return;
+    }
+
+    // n-best：prompt 刚算完的请求先分叉，分叉出的槽位在下面与它走同样的簿记与采样
+    for (auto& sl : slots) {
+        if (sl.req && sl.out_idx >= 0 && sl.pending < 0 && !sl.req->forks.empty()) fork_branches(sl);
+    }
+
+    for (auto& sl : slots) {
+        if (!sl.req || sl.n_batched == 0) continue;
+        {
+            SessionState& st = *sl.st;
+            if (sl.pending >= 0) {
+                st.last_tokens.push_back(sl.pending);
+                sl.pending = -1;
+                ++st.n_past;
+            } else {
+                const auto first = sl.req->tokens.begin() + sl.n_prompt_done;
+                st.last_tokens.insert(st.last_tokens.end(), first, first + sl.n_batched);
+                sl.n_prompt_done += sl.n_batched;
+                st.n_past += sl.n_batched;
+            }
+            st.last_used = ++use_clock;
+        }
+        if (sl.out_idx < 0) {
+            // prompt 尚未补齐：多段 prefill 逐段上报进度
+            sysbox::record_json("inference", "info", std::string("{\"event\":\"prefill_progress\",\"session\":\"") + sl.req->session_id +
+                                "\",\"done\":" + std::to_string(sl.n_prefill - ((int)sl.req->tokens.size() - sl.n_prompt_done)) +
+                                ",\"total\":" + std::to_string(sl.n_prefill) + "}");
+            continue;
+        }
+        // 已输出的 </tool_call> 已进入 KV，last_tokens 与调用方保存的文本一致
+        if (sl.closing) { finish(sl, true, ""); continue; }
+        if (sl.req->gen_tokens == 0) sl.t_decode = std::chrono::steady_clock::now();
+
+        // 逐位置校验草稿：用同一条采样链在位置 i 的 logits 上采样，与草稿 i 相同则接受并继续，
+        // 否则以采样结果作为下一步的 pending。与逐 token 解码消耗相同的随机数，输出一致
+        const int n_draft = (int)sl.draft.size();
+        int n_acc = 0;
+        bool done = false, ok = true, tool = false;
+        for (int i = 0;; ++i) {
+            const float* logits = llama_get_logits_ith(ctx, sl.out_idx + i);
+            if (!logits) { done = true; ok = false; break; }
+            const auto ts = std::chrono::steady_clock::now();
+            const uint64_t* allowed = nullptr;
+            if (sl.g_state >= 0) {
+                // 工具调用之内：取当前文法状态的允许集合（首次访问时计算），无可走 token 时放弃约束
+                allowed = sl.grammar->allowed(sl.g_state);
+                sl.mask_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - ts).count();
+                ++sl.n_masked;
+                if (!allowed) sl.g_state = -1;
+            }
+            const int next_id = sl.sampler.sample(logits, sampler_ws, allowed);
+            busy_sample_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - ts).count();
+            if (next_id == eos) { done = true; break; }
+            sl.sampler.accept(next_id);
+            if (lookup_ngram > 0) sl.lookup.append(next_id);
+            const std::string_view piece = piece_of(next_id);
+            ++sl.req->gen_tokens;
+            ++busy_tokens;
+            if (!sl.stop.empty()) {
+                // 停止串可能跨 token：只输出确认不属于停止串的部分，命中即结束，停止串本身不输出
+                sl.stop_out.clear();
+                const bool hit = sl.stop.feed(piece, sl.stop_out);
+                if (!sl.stop_out.empty()) (*sl.req->on_token)(sl.stop_out);
+                if (hit) { done = true; break; }
+            } else if (!piece.empty()) {
+                (*sl.req->on_token)(piece);
+            }
+            if (sl.req->gen_tokens >= sl.req->options.max_new_tokens) { done = true; break; }
+            if (sl.req->options.tool_handler && scan_tool_call(sl, piece)) {
+                // 工具调用闭合：末尾 token 作为 pending 暂不解码，命中的草稿随下面的裁剪一并丢弃
+                sl.pending = next_id;
+                tool = true;
+                break;
+            }
+            if (i < n_draft && next_id == sl.draft[i]) {
+                // 命中的草稿已随本步 batch 写入 KV
+                sl.st->last_tokens.push_back(next_id);
+                ++sl.st->n_past;
+                ++n_acc;
+                continue;
+            }
+            sl.pending = next_id;
+            break;
+        }
+        if (n_draft > 0) {
+            // 未命中的草稿也已写入 KV，裁掉以保持 KV 与 last_tokens 一致
+            llama_memory_seq_rm(mem(), sl.st->seq, sl.st->n_past, -1);
+            sl.n_drafted += n_draft;
+            sl.n_accepted += n_acc;
+        }
+        if (done) finish(sl, ok, ok ? "" : "no logits");
+        else if (tool) begin_tool_call(sl);
+    }
+}
+
+// 在输出流上识别 <tool_call>…</tool_call>；调用闭合时返回 true，调用正文留在 tool_text 中
+bool LlamaEngine::Impl::scan_tool_call(Slot& slot, std::string_view piece) {
+    static constexpr std::string_view kOpen = "<tool_call>", kClose = "</tool_call>";
+    std::string& buf = slot.tool_text;
+    buf.append(piece);
+    if (slot.g_state >= 0) slot.g_state = slot.grammar->grammar().walk(slot.g_state, piece);
+    if (!slot.in_tool) {
+        const size_t p = buf.find(kOpen);
+        if (p == std::string::npos) {
+            // 只保留可能是开标签前缀的尾部
+            if (buf.size() >= kOpen.size()) buf.erase(0, buf.size() - (kOpen.size() - 1));
+            return false;
+        }
+        buf.erase(0, p + kOpen.size());
+        slot.in_tool = true;
+        if (slot.req->options.tool_grammar) {
+            // 开标签之后已输出的部分先走一遍文法，已经不合文法时本次调用不加约束
+            slot.grammar = masks_for(slot.req->options.tool_grammar);
+            slot.g_state = slot.grammar ? slot.grammar->grammar().walk(slot.grammar->grammar().start(), buf) : -1;
+        }
+    }
+    const size_t q = buf.find(kClose);
+    if (q == std::string::npos) return false;
+    buf.resize(q);
+    slot.in_tool = false;
+    slot.grammar = nullptr;
+    slot.g_state = -1;
+    return true;
+}
+
+// 文法掩码按文法对象缓存；词表索引首次用到时建立，控制 token 与 EOG 不进入索引，调用之内永远不被采样
+GrammarMasks* LlamaEngine::Impl::masks_for(const std::shared_ptr<const ToolGrammar>& grammar) {
+    for (auto& m : grammar_masks) if (m->grammar_ptr() == grammar) return m.get();
+    if (grammar_vocab.empty()) {
+        const int n_vocab = llama_vocab_n_tokens(vocab);
+        std::vector<std::string_view> pieces((size_t)n_vocab);
+        for (int id = 0; id < n_vocab; ++id) {
+            if (!llama_vocab_is_control(vocab, id) && !llama_vocab_is_eog(vocab, id)) pieces[id] = piece_of(id);
+        }
+        grammar_vocab.build(pieces);
+    }
+    if (grammar_masks.size() >= 4) {
+        // 淘汰没有槽位正在使用的文法
+        grammar_masks.erase(std::remove_if(grammar_masks.begin(), grammar_masks.end(), [&](const std::unique_ptr<GrammarMasks>& m) {
+            for (auto& sl : slots) if (sl.grammar == m.get()) return false;
+            return true;
+        }), grammar_masks.end());
+    }
+    grammar_masks.push_back(std::make_unique<GrammarMasks>(grammar, grammar_vocab));
+    return grammar_masks.back().get();
+}
+
+// piece 中含任一中断串的 token 记为中断 token；控制 token 总是中断（轮次边界不参与重复匹配）
+const uint8_t* LlamaEngine::Impl::dry_breakers_for(const GenerateOptions& o) {
+    if (o.dry_multiplier <= 0.0f) return nullptr;
+    auto it = dry_breakers.find(o.dry_sequence_breakers);
+    if (it == dry_breakers.end()) {
+        const int n_vocab = llama_vocab_n_tokens(vocab);
+        std::vector<uint8_t> flags((size_t)n_vocab, 0);
+        for (int id = 0; id < n_vocab; ++id) {
+            if (llama_vocab_is_control(vocab, id) || llama_vocab_is_eog(vocab, id)) { flags[id] = 1; continue; }
+            const std::string_view piece = piece_of(id);
+            for (auto& b : o.dry_sequence_breakers) {
+                if (!b.empty() && piece.find(b) != std::string_view::npos) { flags[id] = 1; break; }
+            }
+        }
+        it = dry_breakers.emplace(o.dry_sequence_breakers, std::move(flags)).first;
+    }
+    return it->second.data();
+}
+
+// 暂停槽位，把调用交给阻塞在 submit 中的调用方线程执行；调度线程继续服务其他序列
+void LlamaEngine::Impl::begin_tool_call(Slot& slot) {
+    slot.tool_wait = true;
+    slot.t_tool = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lk(mu);
+    slot.req->tool_call.swap(slot.tool_text);
+    slot.tool_text.clear();
+    slot.req->tool_state = Request::ToolCalled;
+    done_cv.notify_all();
+}
+
+// 工具结果接到序列末尾：pending 与结果 token 作为新的一段 prompt 走分块 prefill，
+// 最后一块的 logits 接着采样。已有 KV 原样保留，不重新渲染、不重算历史
+void LlamaEngine::Impl::resume_tool_call(Slot& slot) {
+    slot.tool_resume = false;
+    Request* req = slot.req;
+    if (req->tool_state == Request::ToolDeclined) {
+        // 调用闭合的 token 已经流式输出：下一步照常解码它再结束，KV 不缺这一段
+        slot.closing = true;
+        std::lock_guard<std::mutex> lk(mu);
+        req->tool_state = Request::ToolIdle;
+        return;
+    }
+    const int n = 1 + (int)req->tool_tokens.size();
+    // 结果放不下（需给后续生成留出余量）：与 prompt 过长时相同，丢弃保留开头之后的中段历史，位置平移后接入
+    SessionState& st = *slot.st;
+    const int limit = n_ctx - std::min(std::max(1, req->options.max_new_tokens - req->gen_tokens), n_ctx / 4);
+    if (st.n_past + n > limit) {
+        if (st.n_discarded == 0) st.n_keep = keep_len(st.last_tokens);
+        const int d = st.n_past + n - limit;
+        if (!can_shift || st.seq < 0 || st.n_past - st.n_keep < d) { finish(slot, false, "context overflow"); return; }
+        shift_kv(st, d);
+        st.n_discarded += d;
+        record_shift(req->session_id, st, d);
+    }
+    slot.n_prompt_done = (int)req->tokens.size();
+    req->tokens.push_back(slot.pending);
+    req->tokens.insert(req->tokens.end(), req->tool_tokens.begin(), req->tool_tokens.end());
+    for (llama_token t : req->tool_tokens) {
+        slot.sampler.accept(t);
+        if (lookup_ngram > 0) slot.lookup.append(t);
+    }
+    slot.pending = -1;
+    slot.n_prefill += n;
+    ++req->tool_calls;
+    req->tool_injected += n - 1;
+    const double wait_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - slot.t_tool).count();
+    sysbox::record_json("inference", "info", std::string("{\"event\":\"tool_call\",\"session\":\"") + req->session_id +
+                        "\",\"tokens\":" + std::to_string(n - 1) + ",\"wait_ms\":" + std::to_string(wait_ms) +
+                        ",\"n_past\":" + std::to_string(slot.st->n_past) + "}");
+    std::lock_guard<std::mutex> lk(mu);
+    req->tool_state = Request::ToolIdle;
+}
+
+void LlamaEngine::Impl::scheduler_loop() {
+    while (true) {
+        int active = 0;
+        {
+            std::unique_lock<std::mutex> lk(mu);
+            cv.wait(lk, [&]{
+                if (stopping || !queue.empty() || !pending_resets.empty() || pending_stats) return true;
+                // 等待工具结果的槽位不算活跃，避免空转
+                for (auto& sl : slots) if (sl.req && (!sl.tool_wait || sl.req->tool_state >= Request::ToolReady)) return true;
+                return false;
+            });
+            if (stopping) break;
+
+            // 会话重置：仅处理当前没有请求在跑的会话，其余留到下一轮；会话在各适配器下的 KV 一并清除
+            for (auto it = pending_resets.begin(); it != pending_resets.end();) {
+                std::vector<std::string> keys{*it};
+                for (auto& a : adapters) keys.push_back(*it + "@" + a.name);
+                bool busy = false;
+                for (auto& k : keys) {
+                    auto sit = sessions.find(k);
+                    busy |= sit != sessions.end() && sit->second.busy;
+                }
+                if (busy) { ++it; continue; }
+                for (auto& k : keys) {
+                    auto sit = sessions.find(k);
+                    if (sit != sessions.end()) { release_seq(sit->second); sessions.erase(sit); }
+                    std::error_code ec;
+                    std::filesystem::remove(session_kv_path(model_fp, k), ec);
+                }
+                it = pending_resets.erase(it);
+            }
+            if (pending_stats) {
+                fill_session_stats(*pending_stats);
+                pending_stats = nullptr;
+                done_cv.notify_all();
+            }
+            for (auto& sl : slots) {
+                if (sl.req && sl.tool_wait && sl.req->tool_state >= Request::ToolReady) { sl.tool_wait = false; sl.tool_resume = true; }
+            }
+            // 排队中已取消的请求直接返回，不占槽位
+            for (auto it = queue.begin(); it != queue.end();) {
+                if (!(*it)->options.cancel->cancelled()) { ++it; continue; }
+                abandon(*it, "aborted");
+                it = queue.erase(it);
+            }
+        }
+
+        // 已取消的请求在步间结束，其余槽位照常解码
+        for (auto& sl : slots) if (sl.req && sl.req->options.cancel->cancelled()) finish(sl, false, "aborted");
+        for (auto& sl : slots) if (sl.req && sl.tool_resume) resume_tool_call(sl);
+        for (auto& sl : slots) if (sl.req) ++active;
+
+        // 接纳新请求：同一会话同时只跑一个请求，其余保持排队顺序
+        for (auto& sl : slots) {
+            if (sl.req) continue;
+            Request* next = nullptr;
+            {
+                std::lock_guard<std::mutex> lk(mu);
+                for (auto it = queue.begin(); it != queue.end(); ++it) {
+                    auto sit = (*it)->session_id.empty() ? sessions.end() : sessions.find((*it)->session_id);
+                    if (sit != sessions.end() && sit->second.busy) continue;
+                    next = *it; queue.erase(it); break;
+                }
+            }
+            if (!next) break;
+            if (admit(sl, next) && active++ == 0) {
+                busy_since = std::chrono::steady_clock::now();
+                busy_tokens = 0; busy_max_active = 0;
+                busy_step_ns = busy_decode_ns = busy_sample_ns = 0;
+                busy_switches = 0;
+            }
+        }
+        busy_max_active = std::max(busy_max_active, active);
+
+        const auto t_step = std::chrono::steady_clock::now();
+        step();
+        busy_step_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - t_step).count();
+
+        bool idle = true;
+        for (auto& sl : slots) if (sl.req) { idle = false; break; }
+        if (idle && busy_tokens > 0) {
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - busy_since).count();
+            double tps = ms > 0 ? (busy_tokens * 1000.0 / ms) : 0.0;
+            // 每 token 开销：step 耗时扣除 llama_decode 与采样，余下为 batch 组装、簿记与回调
+            const double overhead_us = (busy_step_ns - busy_decode_ns - busy_sample_ns) / 1000.0 / busy_tokens;
+            const double sample_us = busy_sample_ns / 1000.0 / busy_tokens;
+            sysbox::record_json("metrics","info", std::string("{\"event\":\"batch_busy\",\"tokens\":") + std::to_string(busy_tokens) + ",\"ms\":" + std::to_string(ms) + ",\"aggregate_tokens_per_s\":" + std::to_string(tps) + ",\"max_active\":" + std::to_string(busy_max_active) +
+                                ",\"sample_us_per_token\":" + std::to_string(sample_us) + ",\"overhead_us_per_token\":" + std::to_string(overhead_us) +
+                                (busy_switches > 0 ? ",\"adapter_switches\":" + std::to_string(busy_switches) : std::string()) + "}");
+            busy_tokens = 0;
+        }
+    }
+
+    // 退出：未完成的请求全部失败返回
+    for (auto& sl : slots) if (sl.req) finish(sl, false, "model unloaded");
+    std::lock_guard<std::mutex> lk(mu);
+    for (Request* q : queue) abandon(q, "model unloaded");
+    queue.clear();
+    done_cv.notify_all();
+}
+#endif
+
+#if AICLI_WITH_LLAMA
+// 直接 tokenize 到 out 的尾部；预估容量不足时按 llama_tokenize 返回的所需数量重试一次。
+// special 为 false 时文本中的特殊 token 字样按普通文本切分
+static bool tokenize_append(const llama_vocab* vocab, std::string_view text, bool add_bos, bool special, std::vector<llama_token>& out) {
+    const size_t base = out.size();
+    out.resize(base + text.size() + 2);
+    int n = llama_tokenize(vocab, text.data(), (int)text.size(), out.data() + base, (int)(out.size() - base), add_bos, special);
+    if (n < 0) {
+        out.resize(base + (size_t)(-n));
+        n = llama_tokenize(vocab, text.data(), (int)text.size(), out.data() + base, -n, add_bos, special);
+    }
+    out.resize(n < 0 ? base : base + (size_t)n);
+    return n >= 0;
+}
+
+static PromptTokenCache::Tokenizer prompt_tokenizer(const llama_vocab* vocab) {
+    return [vocab](std::string_view text, bool add_bos, bool special, std::vector<int32_t>& out) {
+        return tokenize_append(vocab, text, add_bos, special, out);
+    };
+}
+
+// 渲染后的整段 prompt：按会话缓存同样的切段规则 tokenize，历史中工具结果的正文不解析特殊 token
+static bool tokenize_prompt(const llama_vocab* vocab, std::string_view prompt, std::vector<llama_token>& out) {
+    PromptTokenCache once;
+    int reused = 0;
+    return once.tokenize(prompt, prompt_tokenizer(vocab), out, reused);
 }
 #endif
 
 bool LlamaEngine::generate(const std::string& prompt, const GenerateOptions& options, const StreamCallback& on_token, std::string& err) {
+    impl_->wait_loading();
     if (!impl_->loaded) { err = "model not loaded"; return false; }
 #if AICLI_WITH_LLAMA
-    auto t0 = std::chrono::steady_clock::now();
-    if (!impl_->model || !impl_->ctx || !impl_->vocab) { err = "llama runtime not initialized"; return false; }
-    if (!impl_->reinit_context(err)) return false; // ensure pos start from 0
-    std::vector<llama_token> tokens; { const bool add_bos = true; const bool parse_special = true; std::vector<llama_token> tmp(1024 + prompt.size()); int n = llama_tokenize(impl_->vocab, prompt.c_str(), (int)prompt.size(), tmp.data(), (int)tmp.size(), add_bos, parse_special); if (n < 0) { err = "tokenize failed"; return false; } tmp.resize(n); tokens = std::move(tmp); }
-    int n_past = 0; { llama_batch batch = llama_batch_init((int)tokens.size(), 0, 1); for (int i = 0; i < (int)tokens.size(); ++i) { batch.token[i] = tokens[i]; batch.pos[i] = n_past + i; batch.n_seq_id[i] = 1; batch.seq_id[i][0] = 0; batch.logits[i] = (i == (int)tokens.size() - 1); } batch.n_tokens = (int)tokens.size(); int32_t r = llama_decode(impl_->ctx, batch); llama_batch_free(batch); if (r != 0) { err = "decode failed (prefill)"; return false; } n_past += (int)tokens.size(); }
-    const int eos = llama_vocab_eos(impl_->vocab); const int n_vocab = llama_vocab_n_tokens(impl_->vocab); std::mt19937 rng; if (auto sv = config::get_env("AICLI_SEED")) { try { rng.seed((uint32_t)std::stoul(*sv)); } catch (...) { std::random_device rd; rng.seed(rd()); } } else { std::random_device rd; rng.seed(rd()); }
-    float temperature = options.temperature; float top_p = options.top_p;
-    int gen_tokens = 0;
-    for (int i = 0; i < options.max_new_tokens; ++i) {
-        if (impl_->abort_requested.load(std::memory_order_relaxed)) { err = "aborted"; return false; }
-        const float* logits = llama_get_logits(impl_->ctx); if (!logits) { err = "no logits"; return false; }
-        int next_id; if (temperature <= 0.0001f) { int best_id = 0; float best_val = logits[0]; for (int t = 1; t < n_vocab; ++t) if (logits[t] > best_val) { best_val = logits[t]; best_id = t; } next_id = best_id; } else { if (top_p <= 0.0f || top_p > 1.0f) top_p = 0.95f; next_id = sample_top_p_temperature(logits, n_vocab, temperature, top_p, rng); }
-        if (next_id == eos) break; std::string piece = token_to_piece(impl_->vocab, next_id); if (!piece.empty()) on_token(piece);
-        llama_batch step = llama_batch_init(1, 0, 1); step.token[0] = (llama_token)next_id; step.pos[0] = n_past; step.n_seq_id[0] = 1; step.seq_id[0][0] = 0; step.logits[0] = true; step.n_tokens = 1; int32_t r = llama_decode(impl_->ctx, step); llama_batch_free(step); if (r != 0) { err = "decode failed (loop)"; return false; } n_past += 1; ++gen_tokens; }
-    auto t1 = std::chrono::steady_clock::now();
-    double ms = std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count();
-    double tps = ms > 0 ? (gen_tokens * 1000.0 / ms) : 0.0;
-    auto [p50,p95] = sysbox::add_duration_sample("inference.generate.ms", ms);
-    sysbox::record_json("metrics","info", std::string("{\"tokens\":") + std::to_string(gen_tokens) + ",\"ms\":" + std::to_string(ms) + ",\"tokens_per_s\":" + std::to_string(tps) + ",\"p50\":" + std::to_string(p50) + ",\"p95\":" + std::to_string(p95) + "}");
+    // 无会话请求占用槽位的临时序列，结束后释放；其他会话的 KV 保持驻留
+    return generate_with_session("", prompt, options, on_token, err);
 #else
-    std::string fake = "[llama-stub] 你说：" + prompt + " -> 我理解了。"; for (char c : fake) { on_token(std::string(1, c)); std::this_thread::sleep_for(std::chrono::milliseconds(2)); } (void)options; (void)err;
-#endif
+    // 占位实现不加载适配器
+    if (!options.adapter.empty()) { err = "unknown adapter: " + options.adapter; return false; }
+    std::string fake = "[llama-stub] 你说：" + prompt + " -> 我理解了。";
+    StopMatcher stop(options.stop);
+    std::string out;
+    for (char c : fake) {
+        if (options.cancel && options.cancel->cancelled()) { err = "aborted"; return false; }
+        out.clear();
+        const bool hit = stop.feed(std::string_view(&c, 1), out);
+        if (!out.empty()) on_token(out);
+        if (hit) return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    out.clear();
+    stop.finish(out);
+    if (!out.empty()) on_token(out);
     return true;
+#endif
 }
 
 bool LlamaEngine::generate_with_session(const std::string& session_id,
@@ -250,117 +1824,272 @@ bool LlamaEngine::generate_with_session(const std::string& session_id,
                                         std::string& err) {
 #if !AICLI_WITH_LLAMA
     // 无依赖回退
+    (void)session_id;
     return generate(prompt, options, on_token, err);
 #else
+    impl_->wait_loading();
     if (!impl_->model || !impl_->ctx || !impl_->vocab) { err = "llama runtime not initialized"; return false; }
 
-    // 会话切换：若切换到新的会话，先重建上下文，再初始化该会话状态
-    {
-        std::unique_lock<std::mutex> lk(impl_->mu);
-        const bool switched = (impl_->active_session != session_id);
-        lk.unlock();
-        if (switched) {
-            if (!impl_->reinit_context(err)) return false;
-            std::unique_lock<std::mutex> lk2(impl_->mu);
-            impl_->active_session = session_id;
-            auto& st_new = impl_->sessions[session_id];
-            st_new.n_past = 0;
-            st_new.last_tokens.clear();
-            lk2.unlock();
-        }
+    // 提交给调度线程：与其他会话的请求合并进同一个 batch 解码
+    Impl::Request req;
+    if (!options.adapter.empty() && (req.adapter = impl_->find_adapter(options.adapter)) < 0) {
+        err = "unknown adapter: " + options.adapter;
+        return false;
+    }
+    // 会话在不同适配器下的 KV 不通用，按 会话@适配器 分开驻留与落盘
+    req.session_id = session_id.empty() || req.adapter < 0 ? session_id : session_id + "@" + options.adapter;
+    const llama_vocab* vocab = impl_->vocab;
+    if (session_id.empty()) {
+        if (!tokenize_prompt(vocab, prompt, req.tokens)) { err = "tokenize failed"; return false; }
+    } else {
+        // 会话 prompt 只 tokenize 与上一轮不同的尾部消息
+        std::lock_guard<std::mutex> lk(impl_->tok_mu);
+        int reused = 0;
+        if (!impl_->prompt_caches[req.session_id].tokenize(prompt, prompt_tokenizer(vocab), req.tokens, reused)) { err = "tokenize failed"; return false; }
     }
+    if (req.tokens.empty()) { err = "empty prompt"; return false; }
+    req.options = options;
+    if (!req.options.cancel) req.options.cancel = std::make_shared<CancelToken>();
+    req.on_token = &on_token;
+    if (!impl_->submit(&req)) { err = req.err; return false; }
+    return true;
+#endif
+}
 
-    // tokenize prompt
+bool LlamaEngine::generate_n(const std::string& prompt, const GenerateOptions& options, const BranchStreamCallback& on_token, std::string& err) {
+#if !AICLI_WITH_LLAMA
+    return Engine::generate_n(prompt, options, on_token, err);
+#else
+    impl_->wait_loading();
+    if (!impl_->model || !impl_->ctx || !impl_->vocab) { err = "llama runtime not initialized"; return false; }
+    const int n = std::max(1, options.n);
+    const int adapter = options.adapter.empty() ? -1 : impl_->find_adapter(options.adapter);
+    if (!options.adapter.empty() && adapter < 0) { err = "unknown adapter: " + options.adapter; return false; }
     std::vector<llama_token> tokens;
-    {
-        const bool add_bos = true; const bool parse_special = true;
-        std::vector<llama_token> tmp(1024 + prompt.size());
-        int n = llama_tokenize(impl_->vocab, prompt.c_str(), (int)prompt.size(), tmp.data(), (int)tmp.size(), add_bos, parse_special);
-        if (n < 0) { err = "tokenize failed"; return false; }
-        tmp.resize(n); tokens = std::move(tmp);
-    }
+    if (!tokenize_prompt(impl_->vocab, prompt, tokens)) { err = "tokenize failed"; return false; }
+    if (tokens.empty()) { err = "empty prompt"; return false; }
 
-    // 计算与上一次的最长公共前缀；若历史变化，重建上下文
-    int lcp = 0; size_t prev_hist_size = 0;
-    {
-        std::unique_lock<std::mutex> lk2(impl_->mu);
-        auto it = impl_->sessions.find(session_id);
-        if (it == impl_->sessions.end()) { impl_->sessions[session_id] = {}; it = impl_->sessions.find(session_id); }
-        auto& st = it->second;
-        prev_hist_size = st.last_tokens.size();
-        while (lcp < (int)st.last_tokens.size() && lcp < (int)tokens.size() && st.last_tokens[lcp] == tokens[lcp]) { ++lcp; }
-        lk2.unlock();
-    }
-    if ((size_t)lcp < prev_hist_size) {
-        if (!impl_->reinit_context(err)) return false;
-        std::unique_lock<std::mutex> lk3(impl_->mu);
-        auto& st = impl_->sessions[session_id];
-        st.n_past = 0; st.last_tokens.clear();
-        lk3.unlock();
-        lcp = 0;
-    }
-
-    // 先补齐差额 tokens
-    if (lcp < (int)tokens.size()) {
-        llama_batch batch = llama_batch_init((int)(tokens.size() - lcp), 0, 1);
-        for (int i = lcp; i < (int)tokens.size(); ++i) {
-            int bi = i - lcp;
-            batch.token[bi] = tokens[i];
-            int base_pos = 0; {
-                std::unique_lock<std::mutex> lk4(impl_->mu);
-                base_pos = impl_->sessions[session_id].n_past;
-            }
-            batch.pos[bi] = base_pos + bi;
-            batch.n_seq_id[bi] = 1;
-            batch.seq_id[bi][0] = 0;
-            batch.logits[bi] = (i == (int)tokens.size() - 1);
-        }
-        batch.n_tokens = (int)(tokens.size() - lcp);
-        if (llama_decode(impl_->ctx, batch) != 0) { llama_batch_free(batch); err = "decode failed (prefill session)"; return false; }
-        llama_batch_free(batch);
-        std::unique_lock<std::mutex> lk5(impl_->mu);
-        impl_->sessions[session_id].n_past += (int)(tokens.size() - lcp);
-        lk5.unlock();
+    std::vector<Impl::Request> reqs((size_t)n);
+    std::vector<StreamCallback> callbacks;
+    callbacks.reserve((size_t)n);
+    auto cancel = options.cancel ? options.cancel : std::make_shared<CancelToken>();
+    for (int i = 0; i < n; ++i) {
+        callbacks.emplace_back([&on_token, i](std::string_view piece) { on_token(i, piece); });
+        reqs[i].tokens = tokens; // 槽位不够时候选退回普通请求，需要自己的 prompt
+        reqs[i].options = options;
+        reqs[i].options.cancel = cancel;
+        reqs[i].adapter = adapter;
+        reqs[i].on_token = &callbacks[i];
     }
-
-    {
-        std::unique_lock<std::mutex> lk6(impl_->mu);
-        impl_->sessions[session_id].last_tokens = tokens;
+    const auto t0 = std::chrono::steady_clock::now();
+    const bool ok = impl_->submit(reqs.data(), n);
+    int forked = 0, gen = 0;
+    for (auto& r : reqs) {
+        forked += r.forked ? 1 : 0;
+        gen += r.gen_tokens;
+        if (!r.ok && err.empty()) err = r.err;
     }
+    const auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - t0).count();
+    // forked 为共享首个候选 prefill 的候选数；其余候选（槽位不够）各自 prefill
+    sysbox::record_json("metrics", "info", std::string("{\"event\":\"nbest\",\"n\":") + std::to_string(n) + ",\"forked\":" + std::to_string(forked) +
+                        ",\"prompt_tokens\":" + std::to_string(tokens.size()) + ",\"gen_tokens\":" + std::to_string(gen) +
+                        ",\"ms\":" + std::to_string(ms) + ",\"tokens_per_s\":" + std::to_string(ms > 0 ? gen * 1000.0 / ms : 0.0) + "}");
+    return ok;
+#endif
+}
 
-    const int eos = llama_vocab_eos(impl_->vocab); const int n_vocab = llama_vocab_n_tokens(impl_->vocab);
+bool LlamaEngine::embed(const std::vector<std::string>& texts, const EmbedOptions& options, EmbeddingMatrix& out, std::string& err) {
+    out = EmbeddingMatrix{};
+#if !AICLI_WITH_LLAMA
+    return Engine::embed(texts, options, out, err);
+#else
+    impl_->wait_loading();
+    if (!impl_->model || !impl_->vocab) { err = "llama runtime not initialized"; return false; }
+    Impl& m = *impl_;
+    std::lock_guard<std::mutex> lk(m.embed_mu);
+    if (!m.create_embed_context(options.pooling, err)) return false;
+    const auto t0 = std::chrono::steady_clock::now();
 
-    std::mt19937 rng; if (auto sv = config::get_env("AICLI_SEED")) { try { rng.seed((uint32_t)std::stoul(*sv)); } catch (...) { std::random_device rd; rng.seed(rd()); } } else { std::random_device rd; rng.seed(rd()); }
-    float temperature = options.temperature; float top_p = options.top_p;
+    // 每条文本各自 tokenize（带 BOS），超过一个 batch 的截断；文本是外部数据，其中的 <|im_end|> 等按普通文本切分
+    std::vector<std::vector<llama_token>> toks(texts.size());
+    std::vector<int> lengths(texts.size());
+    int truncated = 0;
+    long n_tokens = 0;
+    for (size_t i = 0; i < texts.size(); ++i) {
+        if (!tokenize_append(m.vocab, texts[i], true, false, toks[i])) { err = "tokenize failed"; return false; }
+        if ((int)toks[i].size() > m.embed_batch) { toks[i].resize((size_t)m.embed_batch); ++truncated; }
+        if (toks[i].empty()) { err = "empty text"; return false; }
+        lengths[i] = (int)toks[i].size();
+        n_tokens += lengths[i];
+    }
 
-    for (int i = 0; i < options.max_new_tokens; ++i) {
-        if (impl_->abort_requested.load(std::memory_order_relaxed)) { err = "aborted"; return false; }
-        const float* logits = llama_get_logits(impl_->ctx); if (!logits) { err = "no logits"; return false; }
-        int next_id; if (temperature <= 0.0001f) { int best_id = 0; float best_val = logits[0]; for (int t = 1; t < n_vocab; ++t) if (logits[t] > best_val) { best_val = logits[t]; best_id = t; } next_id = best_id; }
-        else { if (top_p <= 0.0f || top_p > 1.0f) top_p = 0.95f; next_id = sample_top_p_temperature(logits, n_vocab, temperature, top_p, rng); }
-        if (next_id == eos) break; std::string piece = token_to_piece(impl_->vocab, next_id); if (!piece.empty()) on_token(piece);
-        llama_batch step = llama_batch_init(1, 0, 1); step.token[0] = (llama_token)next_id; {
-            std::unique_lock<std::mutex> lk7(impl_->mu); step.pos[0] = impl_->sessions[session_id].n_past; }
-        step.n_seq_id[0] = 1; step.seq_id[0][0] = 0; step.logits[0] = true; step.n_tokens = 1;
-        if (llama_decode(impl_->ctx, step) != 0) { llama_batch_free(step); err = "decode failed (loop session)"; return false; }
-        llama_batch_free(step);
-        std::unique_lock<std::mutex> lk8(impl_->mu); impl_->sessions[session_id].n_past += 1; impl_->sessions[session_id].last_tokens.push_back((llama_token)next_id); lk8.unlock();
+    // 长短文本装箱进同一个 batch，每条文本占一个序列号，一次 decode 得到整批的池化向量
+    const auto bins = pack_embed_batches(lengths, m.embed_batch, m.embed_seqs);
+    out.rows = (int)texts.size();
+    out.dim = llama_model_n_embd(m.model);
+    out.data.assign((size_t)out.rows * out.dim, 0.0f);
+    // 仅有编码器的模型（BERT 类）走 llama_encode，也没有需要清理的 KV
+    const bool encoder_only = llama_model_has_encoder(m.model) && !llama_model_has_decoder(m.model);
+    llama_batch b = llama_batch_init(m.embed_batch, 0, 1);
+    bool ok = true;
+    for (const auto& bin : bins) {
+        if (options.cancel && options.cancel->cancelled()) { err = "aborted"; ok = false; break; }
+        if (llama_memory_t mem = llama_get_memory(m.embed_ctx)) llama_memory_clear(mem, true);
+        b.n_tokens = 0;
+        for (int k = 0; k < (int)bin.size(); ++k) {
+            const auto& t = toks[bin[k]];
+            for (int p = 0; p < (int)t.size(); ++p) batch_add(b, t[p], p, k, true);
+        }
+        if ((encoder_only ? llama_encode(m.embed_ctx, b) : llama_decode(m.embed_ctx, b)) != 0) { err = "decode failed"; ok = false; break; }
+        for (int k = 0; k < (int)bin.size(); ++k) {
+            const float* v = llama_get_embeddings_seq(m.embed_ctx, k);
+            if (!v) { err = "embeddings unavailable"; ok = false; break; }
+            float* dst = out.data.data() + (size_t)bin[k] * out.dim;
+            std::memcpy(dst, v, sizeof(float) * (size_t)out.dim);
+            if (options.normalize) l2_normalize(dst, out.dim);
+        }
+        if (!ok) break;
     }
+    llama_batch_free(b);
+    if (!ok) { out = EmbeddingMatrix{}; return false; }
+
+    const double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    const double tps = ms > 0 ? n_tokens * 1000.0 / ms : 0.0;
+    sysbox::record_json("metrics", "info", std::string("{\"event\":\"embed\",\"texts\":") + std::to_string(texts.size()) +
+                        ",\"tokens\":" + std::to_string(n_tokens) + ",\"batches\":" + std::to_string(bins.size()) +
+                        ",\"ms\":" + std::to_string(ms) + ",\"tokens_per_s\":" + std::to_string(tps) +
+                        ",\"truncated\":" + std::to_string(truncated) + "}");
     return true;
 #endif
 }
 
 void LlamaEngine::reset_session(const std::string& session_id) {
 #if AICLI_WITH_LLAMA
+    // 交给调度线程处理，避免与正在运行的请求竞争序列
+    {
+        std::lock_guard<std::mutex> lk(impl_->tok_mu);
+        impl_->prompt_caches.erase(session_id);
+        for (auto& a : impl_->adapters) impl_->prompt_caches.erase(session_id + "@" + a.name);
+    }
     std::lock_guard<std::mutex> lk(impl_->mu);
-    impl_->sessions.erase(session_id);
-    if (impl_->active_session == session_id) impl_->active_session.clear();
+    impl_->pending_resets.push_back(session_id);
+    impl_->cv.notify_all();
+#else
+    (void)session_id;
 #endif
 }
 
 void LlamaEngine::request_abort() {
 #if AICLI_WITH_LLAMA
-    impl_->abort_requested.store(true, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lk(impl_->mu);
+    for (Impl::Request* r : impl_->inflight) r->options.cancel->cancel();
+    impl_->cv.notify_all();
+#endif
+}
+
+bool LlamaEngine::bench_threads(const std::vector<int>& candidates, int n_prompt, int n_gen,
+                                std::vector<ThreadBench>& out, std::string& err) {
+    out.clear();
+    impl_->wait_loading();
+    if (!impl_->loaded) { err = "model not loaded"; return false; }
+#if AICLI_WITH_LLAMA
+    Impl& m = *impl_;
+    m.stop_scheduler();
+    for (auto& kv : m.sessions) { m.save_session(kv.first, kv.second); m.release_seq(kv.second); }
+    const bool pinned = m.tp != nullptr;
+    if (pinned) llama_detach_threadpool(m.ctx);
+    n_prompt = std::max(1, std::min(n_prompt, m.n_ctx / 2));
+    n_gen = std::max(1, std::min(n_gen, m.n_ctx - n_prompt));
+    const int n_vocab = llama_vocab_n_tokens(m.vocab);
+    llama_batch b = llama_batch_init(m.n_ubatch, 0, 1);
+    // 一轮：prefill 按 n_ubatch 分块，之后逐 token 解码；返回 false 表示 decode 失败
+    auto decode_run = [&](int t, double& prefill_s, double& decode_s) {
+        using clock = std::chrono::steady_clock;
+        llama_memory_clear(m.mem(), true);
+        llama_set_n_threads(m.ctx, t, t);
+        auto t0 = clock::now();
+        for (int i = 0; i < n_prompt;) {
+            b.n_tokens = 0;
+            for (; i < n_prompt && b.n_tokens < m.n_ubatch; ++i) batch_add(b, (i * 7919 + 13) % n_vocab, i, 0, i == n_prompt - 1);
+            if (llama_decode(m.ctx, b) != 0) return false;
+        }
+        llama_synchronize(m.ctx);
+        auto t1 = clock::now();
+        for (int i = 0; i < n_gen; ++i) {
+            b.n_tokens = 0;
+            batch_add(b, (i * 31 + 7) % n_vocab, n_prompt + i, 0, true);
+            if (llama_decode(m.ctx, b) != 0) return false;
+            llama_synchronize(m.ctx);
+        }
+        auto t2 = clock::now();
+        prefill_s = std::chrono::duration<double>(t1 - t0).count();
+        decode_s = std::chrono::duration<double>(t2 - t1).count();
+        return true;
+    };
+    // 绑核时为每轮挂一个 t 线程的临时绑核线程池，测到的与调优后实际运行的配置一致
+    auto run = [&](int t, double& prefill_s, double& decode_s) {
+        ggml_threadpool* pool = pinned ? m.new_pinned_pool(t) : nullptr;
+        if (pinned && !pool) return false;
+        if (pool) llama_attach_threadpool(m.ctx, pool, pool);
+        const bool ok = decode_run(t, prefill_s, decode_s);
+        if (pool) { llama_detach_threadpool(m.ctx); ggml_threadpool_free(pool); }
+        return ok;
+    };
+    double ps = 0, ds = 0;
+    bool ok = run(candidates.empty() ? m.n_threads : candidates.back(), ps, ds); // 预热，不计入结果
+    for (size_t k = 0; ok && k < candidates.size(); ++k) {
+        // 每个候选跑两轮取较快的一轮，减小抖动
+        double best_p = 0, best_d = 0;
+        for (int rep = 0; ok && rep < 2; ++rep) {
+            ok = run(candidates[k], ps, ds);
+            if (!ok) break;
+            best_p = std::max(best_p, n_prompt / ps);
+            best_d = std::max(best_d, n_gen / ds);
+        }
+        if (ok) out.push_back({candidates[k], best_p, best_d, pinned});
+    }
+    llama_batch_free(b);
+    llama_memory_clear(m.mem(), true);
+    llama_set_n_threads(m.ctx, m.n_threads, m.n_threads_batch);
+    if (pinned) llama_attach_threadpool(m.ctx, m.tp, m.tp_batch);
+    m.start_scheduler();
+    if (!ok) { err = "decode failed"; return false; }
+    return true;
+#else
+    (void)candidates; (void)n_prompt; (void)n_gen;
+    err = "built without llama.cpp";
+    return false;
+#endif
+}
+
+bool LlamaEngine::get_stats(EngineStats& out) {
+    out = EngineStats{};
+    if (impl_->loading || !impl_->loaded) return false;
+#if AICLI_WITH_LLAMA
+    Impl& m = *impl_;
+    out.model = m.model_path;
+    out.n_ctx = m.n_ctx;
+    out.n_seq_max = m.n_seq_max;
+    out.kv_type_k = ggml_type_name(m.type_k);
+    out.kv_type_v = ggml_type_name(m.type_v);
+    out.flash_attn = m.flash_attn == LLAMA_FLASH_ATTN_TYPE_ENABLED ? "on" : m.flash_attn == LLAMA_FLASH_ATTN_TYPE_DISABLED ? "off" : "auto";
+    out.kv_bytes_per_token = m.kv_cell_bytes;
+    out.kv_capacity_bytes = m.kv_cell_bytes * (uint64_t)m.n_ctx;
+    out.model_bytes = llama_model_size(m.model);
+    for (auto& a : m.adapters) out.adapters.push_back({a.name, a.path, a.scale, a.bytes});
+    // 会话簿记归调度线程所有：挂一个统计请求，等它在下一轮循环开头填写
+    std::unique_lock<std::mutex> lk(m.mu);
+    if (m.stopping || !m.worker.joinable()) return false;
+    m.done_cv.wait(lk, [&]{ return m.pending_stats == nullptr || m.stopping; });
+    if (m.stopping) return false;
+    m.pending_stats = &out;
+    m.cv.notify_all();
+    m.done_cv.wait(lk, [&]{ return m.pending_stats != &out || m.stopping; });
+    if (m.pending_stats == &out) { m.pending_stats = nullptr; return false; }
+    return true;
+#else
+    out.model = impl_->model_path;
+    return true;
 #endif
 }
 
@@ -3,6 +3,7 @@
 #include "core/inference/engine.h"
 #include <memory>
 #include <string>
+#include <vector>
 
 namespace inference {
 
@@ -14,6 +15,9 @@ public:
     bool load_model(const std::string& model_path, std::string& err) override;
     void unload_model() override;
     bool is_loaded() const override;
+    void load_model_async(const std::string& model_path, LoadCallback done) override;
+    bool is_loading() const override;
+    float load_progress() const override;
 
     bool generate(const std::string& prompt,
                   const GenerateOptions& options,
@@ -26,10 +30,33 @@ public:
                                const StreamCallback& on_token,
                                std::string& err) override;
 
+    // n-best：prompt 只 prefill 一次，KV 经 seq_cp 共享给 n 条序列，各候选在同一个 batch 中并行解码
+    bool generate_n(const std::string& prompt,
+                    const GenerateOptions& options,
+                    const BranchStreamCallback& on_token,
+                    std::string& err) override;
+
+    // 批量嵌入：使用独立的 embeddings context，多条文本按长度装箱进同一个 batch，各占一个序列号
+    bool embed(const std::vector<std::string>& texts, const EmbedOptions& options, EmbeddingMatrix& out, std::string& err) override;
+
     void reset_session(const std::string& session_id) override;
 
     void request_abort() override;
 
+    bool get_stats(EngineStats& out) override;
+
+    // 线程数基准（aicli tune）：对每个候选线程数清空 KV 后 prefill n_prompt 个 token、再逐个解码 n_gen 个，
+    // 分别得到 prefill（n_threads_batch）与解码（n_threads）吞吐。期间暂停调度，驻留会话先落盘并释放；
+    // 配置了绑核时每个候选都在同样绑核的临时线程池上测量
+    struct ThreadBench {
+        int threads = 0;
+        double prefill_tokens_per_s = 0;
+        double decode_tokens_per_s = 0;
+        bool pinned = false;
+    };
+    bool bench_threads(const std::vector<int>& candidates, int n_prompt, int n_gen,
+                       std::vector<ThreadBench>& out, std::string& err);
+
 private:
     struct Impl;
     std::unique_ptr<Impl> impl_;
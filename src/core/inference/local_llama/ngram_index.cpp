@@ -0,0 +1,89 @@
+#include "ngram_index.h"
+
+#include <algorithm>
+#include <bit>
+
+namespace inference {
+
+static constexpr uint64_t BASE = 1000003ull;
+
+void NgramIndex::reset(int n, size_t reserve_tokens) {
+    n_ = n > 0 ? n : 1;
+    toks_.clear();
+    toks_.reserve(reserve_tokens);
+    size_t cap = 16;
+    while (cap < reserve_tokens * 2) cap <<= 1;
+    if (cap > vals_.size()) {
+        keys_.assign(cap, 0);
+        vals_.assign(cap, 0);
+    } else {
+        std::fill(vals_.begin(), vals_.end(), 0u);
+    }
+    used_ = 0;
+    shift_ = 64 - std::countr_zero(vals_.size());
+    hash_ = 0;
+    pow_n_ = 1;
+    for (int i = 0; i < n_; ++i) pow_n_ *= BASE;
+}
+
+// Fibonacci 散列取高位作槽号：多项式哈希的低位分布不均
+size_t NgramIndex::slot_of(uint64_t h) const {
+    return (size_t)((h * 0x9E3779B97F4A7C15ull) >> shift_);
+}
+
+// 超出预留时容量翻倍并重新登记
+void NgramIndex::grow() {
+    const size_t cap = std::max<size_t>(16, vals_.size() * 2);
+    std::vector<uint64_t> keys(cap, 0);
+    std::vector<uint32_t> vals(cap, 0);
+    keys.swap(keys_);
+    vals.swap(vals_);
+    shift_ = 64 - std::countr_zero(cap);
+    const size_t mask = vals_.size() - 1;
+    for (size_t i = 0; i < vals.size(); ++i) {
+        if (vals[i] == 0) continue;
+        size_t s = slot_of(keys[i]);
+        while (vals_[s] != 0) s = (s + 1) & mask;
+        keys_[s] = keys[i];
+        vals_[s] = vals[i];
+    }
+}
+
+void NgramIndex::append(int token) {
+    const size_t sz = toks_.size();
+    // 当前末尾 n-gram 的后继就是本 token：登记（覆盖为最近一次出现）
+    if (sz >= (size_t)n_) {
+        if ((used_ + 1) * 2 > vals_.size()) grow();
+        const size_t mask = vals_.size() - 1;
+        size_t s = slot_of(hash_);
+        while (vals_[s] != 0 && keys_[s] != hash_) s = (s + 1) & mask;
+        if (vals_[s] == 0) { keys_[s] = hash_; ++used_; }
+        vals_[s] = (uint32_t)sz;
+    }
+    toks_.push_back(token);
+    hash_ = hash_ * BASE + (uint64_t)(uint32_t)token + 1;
+    if (sz >= (size_t)n_) hash_ -= ((uint64_t)(uint32_t)toks_[sz - n_] + 1) * pow_n_;
+}
+
+// 以 end_a、end_b 结尾（不含）的两个 n-gram 是否逐 token 相同，排除哈希碰撞
+bool NgramIndex::matches(size_t end_a, size_t end_b) const {
+    for (int i = 1; i <= n_; ++i) if (toks_[end_a - i] != toks_[end_b - i]) return false;
+    return true;
+}
+
+int NgramIndex::propose(int k, std::vector<int>& out) const {
+    out.clear();
+    const size_t sz = toks_.size();
+    if (k <= 0 || sz < (size_t)n_) return 0;
+    if (vals_.empty()) return 0;
+    const size_t mask = vals_.size() - 1;
+    size_t s = slot_of(hash_);
+    while (vals_[s] != 0 && keys_[s] != hash_) s = (s + 1) & mask;
+    const size_t pos = vals_[s];
+    if (pos == 0) return 0;
+    if (pos < (size_t)n_ || !matches(pos, sz)) return 0;
+    for (size_t i = pos; i < sz && (int)out.size() < k; ++i) out.push_back(toks_[i]);
+    return (int)out.size();
+}
+
+} // namespace inference
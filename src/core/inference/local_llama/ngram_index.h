@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace inference {
+
+// 提示词查找（prompt lookup）：对不断增长的 token 序列维护长度为 n 的窗口滚动哈希，
+// 记录每个 n-gram 最近一次出现后的位置；用序列末尾的 n-gram 查到之前的出现处，
+// 把其后的 token 作为推测解码的候选。适合输出大段照抄输入的编辑类任务，不需要草稿模型
+class NgramIndex {
+public:
+    // 清空并设置 n-gram 长度；容量按 reserve_tokens 预留，已有的更大容量跨请求复用
+    void reset(int n, size_t reserve_tokens = 0);
+
+    // 追加一个 token：此前末尾的 n-gram 此时才知道后继，登记进索引
+    void append(int token);
+
+    // 以末尾 n-gram 最近一次（更早的）出现为起点，把其后至多 k 个 token 写入 out（先清空），返回个数
+    int propose(int k, std::vector<int>& out) const;
+
+    size_t size() const { return toks_.size(); }
+
+private:
+    bool matches(size_t end_a, size_t end_b) const;
+    size_t slot_of(uint64_t h) const;
+    void grow();
+
+    int n_ = 3;
+    std::vector<int> toks_;
+    uint64_t hash_ = 0;   // 末尾 n 个 token 的多项式哈希
+    uint64_t pow_n_ = 1;  // BASE^n，滚动时移出最旧 token
+    // 哈希 -> 该 n-gram 最近一次出现后的位置（后继 token 的下标，恒 >= n，0 表示空槽）。
+    // 线性探测的开放寻址表，容量为 2 的幂且负载不超过一半，登记不做逐节点分配
+    std::vector<uint64_t> keys_;
+    std::vector<uint32_t> vals_;
+    size_t used_ = 0;
+    int shift_ = 64;
+};
+
+} // namespace inference
@@ -0,0 +1,275 @@
+#include "sampler.h"
+
+#include <algorithm>
+#include <bit>
+#include <cfloat>
+#include <cmath>
+
+namespace inference {
+
+static bool by_p_desc(const TokenCandidate& a, const TokenCandidate& b) { return a.p > b.p; }
+static bool by_logit_desc(const TokenCandidate& a, const TokenCandidate& b) { return a.logit > b.logit; }
+
+// 写入未归一化概率 p = exp(logit - max)，返回总和
+static double softmax_unnormalized(TokenCandidate* cand, int n) {
+    float max_logit = -INFINITY;
+    for (int i = 0; i < n; ++i) if (cand[i].logit > max_logit) max_logit = cand[i].logit;
+    double sum = 0.0;
+    for (int i = 0; i < n; ++i) {
+        float ev = std::exp(cand[i].logit - max_logit);
+        cand[i].p = ev;
+        sum += ev;
+    }
+    return sum;
+}
+
+// 按 less 排序后累计 weight 达到 target 的最小前缀，返回其长度，前缀按 less 有序；mass 为前缀的 weight 和。
+// 未排序时分段部分选择：每轮把剩余候选中最靠前的一段移到前面并只对这一段排序，通常第一段就够
+template <typename Less, typename Weight>
+static int select_prefix(TokenCandidate* cand, int n, double target, bool sorted, Less less, Weight weight, double& mass) {
+    int done = 0;
+    int k = sorted ? n : std::min(n, 32);
+    mass = 0.0;
+    while (true) {
+        if (!sorted) {
+            if (k < n) std::nth_element(cand + done, cand + k - 1, cand + n, less);
+            std::sort(cand + done, cand + k, less);
+        }
+        for (int i = done; i < k; ++i) {
+            mass += weight(cand[i]);
+            if (mass >= target) return i + 1;
+        }
+        if (k == n) return n;
+        done = k;
+        k = std::min(n, k * 4);
+    }
+}
+
+// 找出累计概率达到 target 的最小前缀，前缀按 p 降序排列；尖峰分布下通常第一段就够
+static int select_nucleus(TokenCandidate* cand, int n, double target, bool sorted, double& mass) {
+    return select_prefix(cand, n, target, sorted, by_p_desc, [](const TokenCandidate& c) { return (double)c.p; }, mass);
+}
+
+static int draw(const TokenCandidate* cand, int n, double mass, std::mt19937& rng) {
+    std::uniform_real_distribution<double> uni(0.0, 1.0);
+    const double r = uni(rng) * mass;
+    double c = 0.0;
+    for (int i = 0; i < n; ++i) {
+        c += cand[i].p;
+        if (r < c) return cand[i].id;
+    }
+    return cand[n - 1].id;
+}
+
+int sample_greedy(const float* logits, int n_vocab) {
+    int best = 0; float bestv = logits[0];
+    for (int i = 1; i < n_vocab; ++i) if (logits[i] > bestv) { bestv = logits[i]; best = i; }
+    return best;
+}
+
+void SamplerChain::configure(const GenerateOptions& opt, int n_vocab, uint32_t seed, const uint8_t* dry_breakers) {
+    opt_ = opt;
+    dry_breakers_ = dry_breakers;
+    rng_.seed(seed);
+
+    // 清掉上一个请求留下的计数：只遍历非零项，避免 O(n_vocab)
+    if (n_vocab_ == n_vocab) {
+        for (int t : active_) { counts_[t] = 0; active_pos_[t] = -1; }
+    } else {
+        n_vocab_ = n_vocab;
+        counts_.assign(n_vocab, 0);
+        active_pos_.assign(n_vocab, -1);
+        dry_len_.clear();
+    }
+    active_.clear();
+    ring_head_ = ring_size_ = 0;
+    dry_head_ = dry_size_ = 0;
+
+    penalties_on_ = opt.penalty_last_n > 0 &&
+        (opt.repeat_penalty != 1.0f || opt.frequency_penalty != 0.0f || opt.presence_penalty != 0.0f);
+    if (penalties_on_) {
+        ring_.resize(opt.penalty_last_n);
+        active_.reserve(opt.penalty_last_n);
+    }
+
+    dry_on_ = opt.dry_multiplier > 0.0f && opt.dry_base > 1.0f && opt.dry_penalty_last_n > 1;
+    if (dry_on_) {
+        const int cap = opt.dry_penalty_last_n;
+        dry_ring_.resize(cap);
+        dry_rev_.resize(cap);
+        dry_z_.resize(cap);
+        dry_touched_.reserve(cap);
+        if ((int)dry_len_.size() != n_vocab) dry_len_.assign(n_vocab, 0);
+    }
+}
+
+void SamplerChain::count_add(int token) {
+    if (counts_[token]++ == 0) {
+        active_pos_[token] = (int)active_.size();
+        active_.push_back(token);
+    }
+}
+
+void SamplerChain::count_remove(int token) {
+    if (--counts_[token] == 0) {
+        const int pos = active_pos_[token];
+        const int last = active_.back();
+        active_[pos] = last;
+        active_pos_[last] = pos;
+        active_.pop_back();
+        active_pos_[token] = -1;
+    }
+}
+
+void SamplerChain::accept(int token) {
+    if (token < 0 || token >= n_vocab_) return;
+    if (penalties_on_) {
+        const int cap = (int)ring_.size();
+        if (ring_size_ == cap) count_remove(ring_[ring_head_]);
+        else ++ring_size_;
+        ring_[ring_head_] = token;
+        ring_head_ = (ring_head_ + 1) % cap;
+        count_add(token);
+    }
+    if (dry_on_) {
+        const int cap = (int)dry_ring_.size();
+        dry_ring_[dry_head_] = token;
+        dry_head_ = (dry_head_ + 1) % cap;
+        if (dry_size_ < cap) ++dry_size_;
+    }
+}
+
+void SamplerChain::apply_penalties(TokenCandidate* cand) const {
+    // 候选此时仍按 id 排列（cand[t].id == t），可直接下标访问
+    for (int t : active_) {
+        const int c = counts_[t];
+        float& l = cand[t].logit;
+        if (opt_.repeat_penalty != 1.0f) l = l > 0.0f ? l / opt_.repeat_penalty : l * opt_.repeat_penalty;
+        l -= c * opt_.frequency_penalty + opt_.presence_penalty;
+    }
+}
+
+void SamplerChain::apply_dry(TokenCandidate* cand) {
+    const int n = dry_size_;
+    if (n < 2) return;
+    const int cap = (int)dry_ring_.size();
+    // 逆序线性化：rev[0] 为最新 token；中断 token 换成互不相同的负数，任何匹配都不会跨过它
+    for (int j = 0; j < n; ++j) {
+        const int t = dry_ring_[(dry_head_ - 1 - j + 2 * cap) % cap];
+        dry_rev_[j] = dry_breakers_ && dry_breakers_[t] ? -1 - j : t;
+    }
+
+    // Z 函数：z[j] = rev 与 rev[j..] 的最长公共前缀，
+    // 即“以 rev[j] 结尾的历史片段”与“当前后缀”的最长匹配长度
+    const int* s = dry_rev_.data();
+    int* z = dry_z_.data();
+    z[0] = n;
+    for (int j = 1, l = 0, r = 0; j < n; ++j) {
+        int k = j < r ? std::min(r - j, z[j - l]) : 0;
+        while (j + k < n && s[k] == s[j + k]) ++k;
+        z[j] = k;
+        if (j + k > r) { l = j; r = j + k; }
+    }
+
+    // 匹配片段之后出现过的 token（rev[j-1]）若再次出现就会延续该重复，取最长匹配惩罚
+    for (int j = 1; j < n; ++j) {
+        const int m = z[j];
+        if (m < opt_.dry_allowed_length) continue;
+        const int tok = s[j - 1];
+        if (tok < 0) continue; // 中断 token 本身不受惩罚
+        if (dry_len_[tok] == 0) dry_touched_.push_back(tok);
+        if (m > dry_len_[tok]) dry_len_[tok] = m;
+    }
+    const float max_exp = FLT_MAX_EXP / std::log(opt_.dry_base) - 1.0f;
+    for (int tok : dry_touched_) {
+        const float e = std::min((float)(dry_len_[tok] - opt_.dry_allowed_length), max_exp);
+        cand[tok].logit -= opt_.dry_multiplier * std::pow(opt_.dry_base, e);
+        dry_len_[tok] = 0;
+    }
+    dry_touched_.clear();
+}
+
+int SamplerChain::sample(const float* logits, SamplerWorkspace& ws, const uint64_t* allowed) {
+    if ((int)ws.cand.size() < n_vocab_) ws.reserve(n_vocab_);
+    TokenCandidate* cand = ws.cand.data();
+    int n = n_vocab_;
+    for (int i = 0; i < n; ++i) { cand[i].id = i; cand[i].logit = logits[i]; }
+
+    if (penalties_on_) apply_penalties(cand);
+    if (dry_on_) apply_dry(cand);
+    bool masked = false;
+    if (allowed) {
+        // 按位图原地压紧：写位置不超过读位置，逐字跳过全 0 的 64 个 token
+        int k = 0;
+        for (int w = 0; w * 64 < n; ++w) {
+            for (uint64_t bits = allowed[w]; bits; bits &= bits - 1) {
+                const int i = w * 64 + std::countr_zero(bits);
+                if (i < n) cand[k++] = cand[i];
+            }
+        }
+        if (k > 0) { n = k; masked = true; }
+    }
+
+    if (opt_.temperature <= 0.0001f) {
+        int best = 0;
+        for (int i = 1; i < n; ++i) if (cand[i].logit > cand[best].logit) best = i;
+        return cand[best].id;
+    }
+
+    bool sorted = false;
+    if (opt_.top_k > 0 && opt_.top_k < n) {
+        std::nth_element(cand, cand + opt_.top_k - 1, cand + n, by_logit_desc);
+        n = opt_.top_k;
+        std::sort(cand, cand + n, by_logit_desc);
+        sorted = true;
+    }
+
+    if (opt_.typical_p > 0.0f && opt_.typical_p < 1.0f && n > 1) {
+        // 按 |-log q - H| 升序保留累计概率达到 typical_p 的 token；分数暂存在 p 字段
+        const double sum = softmax_unnormalized(cand, n);
+        double ent = 0.0;
+        for (int i = 0; i < n; ++i) { double q = cand[i].p / sum; if (q > 0) ent -= q * std::log(q); }
+        float max_logit = -INFINITY;
+        for (int i = 0; i < n; ++i) max_logit = std::max(max_logit, cand[i].logit);
+        const double log_sum = std::log(sum);
+        for (int i = 0; i < n; ++i) {
+            const double neg_log_q = -(cand[i].logit - max_logit - log_sum);
+            cand[i].p = (float)std::fabs(neg_log_q - ent);
+        }
+        // 与 nucleus 相同的分段部分选择，不对全部候选排序
+        double acc = 0.0;
+        n = select_prefix(cand, n, opt_.typical_p, false, [](const TokenCandidate& a, const TokenCandidate& b) { return a.p < b.p; },
+                          [&](const TokenCandidate& c) { return std::exp(c.logit - max_logit) / sum; }, acc);
+        sorted = false;
+    }
+
+    const float invT = 1.0f / opt_.temperature;
+    if (invT != 1.0f) for (int i = 0; i < n; ++i) cand[i].logit *= invT;
+    double mass = softmax_unnormalized(cand, n);
+    if (!(mass > 0.0)) return sorted || masked ? cand[0].id : sample_greedy(logits, n_vocab_);
+
+    if (opt_.top_p > 0.0f && opt_.top_p < 1.0f) {
+        double nucleus_mass = 0.0;
+        n = select_nucleus(cand, n, opt_.top_p * mass, sorted, nucleus_mass);
+        mass = nucleus_mass;
+        sorted = true;
+    }
+
+    if (opt_.min_p > 0.0f && n > 1) {
+        // p 以最大值为 1 归一，阈值即 min_p；未排序时原地划分
+        const float thr = opt_.min_p;
+        TokenCandidate* end = sorted
+            ? std::partition_point(cand, cand + n, [thr](const TokenCandidate& c){ return c.p >= thr; })
+            : std::partition(cand, cand + n, [thr](const TokenCandidate& c){ return c.p >= thr; });
+        const int keep = std::max(1, (int)(end - cand));
+        if (keep < n) {
+            n = keep;
+            mass = 0.0;
+            for (int i = 0; i < n; ++i) mass += cand[i].p;
+        }
+    }
+
+    return draw(cand, n, mass, rng_);
+}
+
+} // namespace inference
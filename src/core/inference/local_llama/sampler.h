@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "core/inference/engine.h"
+
+namespace inference {
+
+struct TokenCandidate {
+    int id;
+    float logit;
+    float p; // 未归一化概率 exp(logit - max)
+};
+
+// 采样工作区：按 n_vocab 在 load_model 时预分配，解码期间不再分配堆内存
+struct SamplerWorkspace {
+    std::vector<TokenCandidate> cand;
+
+    void reserve(int n_vocab) { cand.resize(n_vocab > 0 ? (size_t)n_vocab : 0); }
+};
+
+// 取 logits 最大值对应的 token
+int sample_greedy(const float* logits, int n_vocab);
+
+// 采样链：每个请求 configure 一次，之后在共享的候选缓冲上按固定顺序执行
+//   repetition/frequency/presence -> DRY -> top-k -> typical -> temperature -> top-p -> min-p -> 抽样
+// 惩罚统计用环形窗口 + 计数表增量维护，应用代价为 O(窗口内不同 token 数)，不重扫历史。
+class SamplerChain {
+public:
+    // 窗口与计数表只在容量不足时分配；之后每个请求复用。
+    // dry_breakers[t] 非 0 表示 token t 为 DRY 中断 token，须在请求期间保持有效
+    void configure(const GenerateOptions& opt, int n_vocab, uint32_t seed, const uint8_t* dry_breakers = nullptr);
+
+    // 记录一个已确定的 token（prompt 尾部或新生成），更新惩罚窗口
+    void accept(int token);
+
+    // allowed 非空时只在位图中为 1 的 token 里采样（约束解码），惩罚之后、截断之前收缩候选
+    int sample(const float* logits, SamplerWorkspace& ws, const uint64_t* allowed = nullptr);
+
+private:
+    void apply_penalties(TokenCandidate* cand) const;
+    void apply_dry(TokenCandidate* cand);
+    void count_add(int token);
+    void count_remove(int token);
+
+    GenerateOptions opt_;
+    int n_vocab_ = 0;
+    bool penalties_on_ = false;
+    bool dry_on_ = false;
+    std::mt19937 rng_;
+
+    // 重复惩罚：最近 penalty_last_n 个 token 的环形窗口、计数表与当前非零计数的 token 列表
+    std::vector<int> ring_;
+    int ring_head_ = 0, ring_size_ = 0;
+    std::vector<int> counts_;
+    std::vector<int> active_;
+    std::vector<int> active_pos_;
+
+    // DRY：历史窗口（环形）、逆序线性化缓冲与 Z 函数缓冲、每 token 最长匹配
+    std::vector<int> dry_ring_;
+    int dry_head_ = 0, dry_size_ = 0;
+    std::vector<int> dry_rev_, dry_z_, dry_len_, dry_touched_;
+    const uint8_t* dry_breakers_ = nullptr;
+};
+
+} // namespace inference
@@ -0,0 +1,49 @@
+#include "thread_config.h"
+
+#include <algorithm>
+#include <cctype>
+#include <sstream>
+
+namespace inference {
+
+bool parse_cpu_list(const std::string& spec, std::vector<int>& cpus) {
+    cpus.clear();
+    std::stringstream ss(spec);
+    std::string part;
+    while (std::getline(ss, part, ',')) {
+        part.erase(std::remove_if(part.begin(), part.end(), [](unsigned char c) { return std::isspace(c) != 0; }), part.end());
+        if (part.empty()) continue;
+        int lo = 0, hi = 0;
+        try {
+            const auto dash = part.find('-');
+            size_t n = 0;
+            lo = std::stoi(part.substr(0, dash), &n);
+            if (n != (dash == std::string::npos ? part.size() : dash)) return false;
+            hi = lo;
+            if (dash != std::string::npos) {
+                hi = std::stoi(part.substr(dash + 1), &n);
+                if (n != part.size() - dash - 1) return false;
+            }
+        } catch (...) {
+            return false;
+        }
+        if (lo < 0 || hi < lo) return false;
+        for (int c = lo; c <= hi; ++c) cpus.push_back(c);
+    }
+    std::sort(cpus.begin(), cpus.end());
+    cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+    return !cpus.empty();
+}
+
+std::vector<int> thread_candidates(int hw) {
+    hw = std::max(1, hw);
+    std::vector<int> v;
+    for (int t = 1; t <= hw; t *= 2) v.push_back(t);
+    // 超线程主机上物理核数（约 hw/2）与其 3/4 往往是解码的最优点
+    for (int t : {hw * 3 / 8, hw / 2, hw * 3 / 4, hw}) if (t >= 1) v.push_back(t);
+    std::sort(v.begin(), v.end());
+    v.erase(std::unique(v.begin(), v.end()), v.end());
+    return v;
+}
+
+} // namespace inference
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace inference {
+
+// 解析 CPU 列表（如 "0-7,16,18-19"），结果升序去重；格式错误返回 false
+bool parse_cpu_list(const std::string& spec, std::vector<int>& cpus);
+
+// 线程数扫描的候选：1、2、4 起按 2 的幂与 hw/2、hw 组成，升序去重，不超过 hw
+std::vector<int> thread_candidates(int hw);
+
+} // namespace inference
@@ -0,0 +1,62 @@
+#include "prompt_cache.h"
+
+#include <algorithm>
+
+namespace inference {
+
+static constexpr std::string_view kSegMarker = "<|im_start|>";
+
+void PromptTokenCache::clear() {
+    text_.clear();
+    seg_begin_.clear();
+    tok_end_.clear();
+    tokens_.clear();
+}
+
+bool PromptTokenCache::tokenize(std::string_view prompt, const Tokenizer& tok, std::vector<int32_t>& tokens, int& reused) {
+    // 与上一轮的公共字节前缀；第 k 段可复用的条件是整段都在公共前缀内，
+    // 且新 prompt 在段尾同样结束或紧跟段标记（切分点一致）
+    const size_t common = (size_t)(std::mismatch(text_.begin(), text_.end(), prompt.begin(), prompt.end()).first - text_.begin());
+    size_t keep = 0;
+    while (keep < seg_begin_.size()) {
+        const size_t end = keep + 1 < seg_begin_.size() ? seg_begin_[keep + 1] : text_.size();
+        if (end > common) break;
+        if (end != prompt.size() && prompt.compare(end, kSegMarker.size(), kSegMarker) != 0) break;
+        ++keep;
+    }
+    const size_t text_from = keep < seg_begin_.size() ? seg_begin_[keep] : (keep > 0 ? text_.size() : 0);
+    seg_begin_.resize(keep);
+    tok_end_.resize(keep);
+    tokens_.resize(keep > 0 ? tok_end_.back() : 0);
+    reused = (int)tokens_.size();
+
+    // 其余部分逐段 tokenize；工具结果段按 包装 / 正文 / 包装 三段，正文不解析特殊 token，
+    // 正文里的 <|im_start|> 也不作为切分点
+    size_t pos = text_from;
+    while (pos < prompt.size()) {
+        const size_t body = pos + kToolResponseOpen.size();
+        const size_t close = prompt.compare(pos, kToolResponseOpen.size(), kToolResponseOpen) == 0
+            ? prompt.find(kToolResponseClose, body) : std::string_view::npos;
+        size_t next;
+        bool ok;
+        if (close != std::string_view::npos) {
+            next = close + kToolResponseClose.size();
+            ok = tok(kToolResponseOpen, seg_begin_.empty(), true, tokens_) &&
+                 tok(prompt.substr(body, close - body), false, false, tokens_) &&
+                 tok(kToolResponseClose, false, true, tokens_);
+        } else {
+            next = prompt.find(kSegMarker, pos + 1);
+            if (next == std::string_view::npos) next = prompt.size();
+            ok = tok(prompt.substr(pos, next - pos), seg_begin_.empty(), true, tokens_);
+        }
+        if (!ok) { clear(); return false; }
+        seg_begin_.push_back(pos);
+        tok_end_.push_back(tokens_.size());
+        pos = next;
+    }
+    text_.assign(prompt.data(), prompt.size());
+    tokens = tokens_;
+    return true;
+}
+
+} // namespace inference
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace inference {
+
+// 会话级增量 tokenize 缓存：渲染后的对话按 ChatML 消息（以 <|im_start|> 开头）切段，
+// 每段单独 tokenize 并记录其 token 区间。特殊 token 两侧不会发生 BPE 合并，
+// 因此逐段结果与整串 tokenize 一致；新一轮只需 tokenize 与上一轮不同的尾部消息。
+// 工具结果段（kToolResponseOpen ... kToolResponseClose）的正文不解析特殊 token，
+// 与生成中途接入时的 tokenize 方式一致：工具输出里的 <|im_end|> 等只是普通文本。
+class PromptTokenCache {
+public:
+    // 把 text 的 token 追加到 out；add_bos 只在整个 prompt 的第一段为真，special 为假时特殊 token 按普通文本切分。失败返回 false
+    using Tokenizer = std::function<bool(std::string_view text, bool add_bos, bool special, std::vector<int32_t>& out)>;
+
+    // 与 TemplateBuilder::render_chatml 渲染 tool 消息的包装一致；正文中不得出现 kToolResponseClose
+    static constexpr std::string_view kToolResponseOpen = "<|im_start|>user\n<tool_response>\n";
+    static constexpr std::string_view kToolResponseClose = "\n</tool_response><|im_end|>\n";
+
+    // 得到整个 prompt 的 token；reused 返回直接复用的 token 数
+    bool tokenize(std::string_view prompt, const Tokenizer& tok, std::vector<int32_t>& tokens, int& reused);
+
+    void clear();
+
+private:
+    std::string text_;                // 上一轮 prompt
+    std::vector<size_t> seg_begin_;   // 各段在 text_ 中的起点
+    std::vector<size_t> tok_end_;     // 各段在 tokens_ 中的终点
+    std::vector<int32_t> tokens_;
+};
+
+} // namespace inference
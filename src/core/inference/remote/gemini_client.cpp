@@ -1,5 +1,6 @@
 #include "gemini_client.h"
 #include "http_client.h"
+#include "core/inference/stop_matcher.h"
 #include "core/sysbox/sysbox.h"
 
 #include <sstream>
@@ -34,6 +35,13 @@ bool GeminiClient::generate(const std::string& prompt,
     body << "\"maxOutputTokens\":" << options.max_new_tokens << ",";
     body << "\"temperature\":" << options.temperature << ",";
     body << "\"topP\":" << options.top_p;
+    if (options.top_k > 0) body << ",\"topK\":" << options.top_k;
+    // 服务端最多接受 5 个停止串，其余只在本地匹配
+    if (!options.stop.empty()) {
+        body << ",\"stopSequences\":[";
+        for (size_t i = 0; i < options.stop.size() && i < 5; ++i) body << (i ? "," : "") << "\"" << HttpClient::json_escape(options.stop[i]) << "\"";
+        body << "]";
+    }
     body << "}}";
 
     std::map<std::string, std::string> headers;
@@ -41,7 +49,9 @@ bool GeminiClient::generate(const std::string& prompt,
 
     std::string url = base_url_ + "/models/" + model_ + ":streamGenerateContent?key=" + api_key_;
     
-    // 流式调用
+    // 流式调用；停止串在本地再匹配一遍，跨 SSE 块的停止串与超出服务端上限的部分同样生效
+    StopMatcher stop(options.stop);
+    std::string out;
     bool ok = HttpClient::post_stream(url, body.str(), headers, [&](const std::string& chunk){
         // Gemini SSE 格式：data: {...}\n
         if (chunk.rfind("data: ", 0) == 0) {
@@ -63,12 +73,17 @@ bool GeminiClient::generate(const std::string& prompt,
                         }
                         unesc += text[i];
                     }
-                    if (!unesc.empty()) on_token(unesc);
+                    out.clear();
+                    if (!unesc.empty()) { stop.feed(unesc, out); if (!out.empty()) on_token(out); }
                 }
             }
         }
-    }, err);
-    
+        // 命中停止串后不再读取剩余的流，curl 随之退出
+        return !stop.matched();
+    }, err, 30000, options.cancel.get());
+    out.clear();
+    stop.finish(out);
+    if (ok && !out.empty()) on_token(out);
     return ok;
 }
 
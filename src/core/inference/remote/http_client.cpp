@@ -1,4 +1,5 @@
 #include "http_client.h"
+#include "core/inference/engine.h"
 
 #include <cstdio>
 #include <cstring>
@@ -53,12 +54,27 @@ HttpResponse HttpClient::post(const std::string& url,
     return {0, result, "parse failed"};
 }
 
+std::string HttpClient::json_escape(const std::string& s) {
+    std::string out;
+    out.reserve(s.size() + 8);
+    for (unsigned char c : s) {
+        if (c == '"') out += "\\\"";
+        else if (c == '\\') out += "\\\\";
+        else if (c == '\n') out += "\\n";
+        else if (c == '\t') out += "\\t";
+        else if (c < 0x20) { char buf[8]; std::snprintf(buf, sizeof(buf), "\\u%04x", c); out += buf; }
+        else out += (char)c;
+    }
+    return out;
+}
+
 bool HttpClient::post_stream(const std::string& url,
                              const std::string& body,
                              const std::map<std::string, std::string>& headers,
                              const StreamChunkCallback& on_chunk,
                              std::string& err,
-                             int timeout_ms) {
+                             int timeout_ms,
+                             const CancelToken* cancel) {
     (void)timeout_ms;
     std::string cmd = "curl -s -N -X POST ";
     for (auto& [k, v] : headers) {
@@ -70,11 +86,15 @@ bool HttpClient::post_stream(const std::string& url,
     FILE* pipe = popen(cmd.c_str(), "r");
     if (!pipe) { err = "popen failed"; return false; }
     char buf[4096];
+    bool done = false;
     while (fgets(buf, sizeof(buf), pipe)) {
-        on_chunk(buf);
+        if (cancel && cancel->cancelled()) break;
+        if (!on_chunk(buf)) { done = true; break; }
     }
+    // 提前关闭读端后 curl 下次写入即因 SIGPIPE 退出，pclose 不会一直等到响应结束
     int rc = pclose(pipe);
-    if (rc != 0) { err = "curl failed"; return false; }
+    if (cancel && cancel->cancelled()) { err = "aborted"; return false; }
+    if (rc != 0 && !done) { err = "curl failed"; return false; }
     return true;
 }
 
@@ -6,6 +6,8 @@
 
 namespace inference {
 
+class CancelToken;
+
 struct HttpResponse {
     int status_code = 0;
     std::string body;
@@ -13,7 +15,8 @@ struct HttpResponse {
     bool ok() const { return status_code >= 200 && status_code < 300; }
 };
 
-using StreamChunkCallback = std::function<void(const std::string& chunk)>;
+// 返回 false 表示调用方已拿到所需内容（如命中停止串），post_stream 立即停止读取并成功返回
+using StreamChunkCallback = std::function<bool(const std::string& chunk)>;
 
 class HttpClient {
 public:
@@ -23,13 +26,18 @@ public:
                             const std::map<std::string, std::string>& headers,
                             int timeout_ms = 30000);
 
-    // 流式 POST（SSE）
+    // JSON 字符串转义（不含两侧引号）
+    static std::string json_escape(const std::string& s);
+
+    // 流式 POST（SSE）；cancel 被取消后在下一个数据块到达时停止读取并结束 curl，err 为 "aborted"；
+    // on_chunk 返回 false 时同样停止读取，但视为正常结束
     static bool post_stream(const std::string& url,
                            const std::string& body,
                            const std::map<std::string, std::string>& headers,
                            const StreamChunkCallback& on_chunk,
                            std::string& err,
-                           int timeout_ms = 30000);
+                           int timeout_ms = 30000,
+                           const CancelToken* cancel = nullptr);
 };
 
 } // namespace inference
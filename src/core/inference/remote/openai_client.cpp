@@ -1,5 +1,6 @@
 #include "openai_client.h"
 #include "http_client.h"
+#include "core/inference/stop_matcher.h"
 #include "core/sysbox/sysbox.h"
 
 #include <sstream>
@@ -34,6 +35,14 @@ bool OpenAIClient::generate(const std::string& prompt,
     body << "\"max_tokens\":" << options.max_new_tokens << ",";
     body << "\"temperature\":" << options.temperature << ",";
     body << "\"top_p\":" << options.top_p << ",";
+    body << "\"frequency_penalty\":" << options.frequency_penalty << ",";
+    body << "\"presence_penalty\":" << options.presence_penalty << ",";
+    // 服务端最多接受 4 个停止串，其余只在本地匹配
+    if (!options.stop.empty()) {
+        body << "\"stop\":[";
+        for (size_t i = 0; i < options.stop.size() && i < 4; ++i) body << (i ? "," : "") << "\"" << HttpClient::json_escape(options.stop[i]) << "\"";
+        body << "],";
+    }
     body << "\"stream\":true}";
 
     std::map<std::string, std::string> headers;
@@ -42,12 +51,14 @@ bool OpenAIClient::generate(const std::string& prompt,
 
     std::string url = base_url_ + "/chat/completions";
     
-    // 流式调用
+    // 流式调用；停止串在本地再匹配一遍，跨 SSE 块的停止串与超出服务端上限的部分同样生效
+    StopMatcher stop(options.stop);
+    std::string out;
     bool ok = HttpClient::post_stream(url, body.str(), headers, [&](const std::string& chunk){
         // 解析 SSE：data: {...}\n
         if (chunk.rfind("data: ", 0) == 0) {
             std::string line = chunk.substr(6);
-            if (line.rfind("[DONE]", 0) == 0) return;
+            if (line.rfind("[DONE]", 0) == 0) return false;
             // 简化解析 delta.content
             auto pos = line.find("\"content\":\"");
             if (pos != std::string::npos) {
@@ -65,12 +76,17 @@ bool OpenAIClient::generate(const std::string& prompt,
                         }
                         unesc += text[i];
                     }
-                    if (!unesc.empty()) on_token(unesc);
+                    out.clear();
+                    if (!unesc.empty()) { stop.feed(unesc, out); if (!out.empty()) on_token(out); }
                 }
             }
         }
-    }, err);
-    
+        // 命中停止串后不再读取剩余的流，curl 随之退出
+        return !stop.matched();
+    }, err, 30000, options.cancel.get());
+    out.clear();
+    stop.finish(out);
+    if (ok && !out.empty()) on_token(out);
     return ok;
 }
 
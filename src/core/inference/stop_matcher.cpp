@@ -0,0 +1,83 @@
+#include "stop_matcher.h"
+
+#include <algorithm>
+#include <deque>
+
+namespace inference {
+
+void StopMatcher::build(const std::vector<std::string>& patterns) {
+    next_.assign(256, -1);
+    depth_.assign(1, 0);
+    out_.assign(1, 0);
+    // 先建 trie，-1 表示尚无转移
+    for (const std::string& p : patterns) {
+        if (p.empty()) continue;
+        int32_t s = 0;
+        for (unsigned char c : p) {
+            if (next_[(size_t)s * 256 + c] < 0) {
+                next_[(size_t)s * 256 + c] = (int32_t)depth_.size();
+                depth_.push_back(depth_[s] + 1);
+                out_.push_back(0);
+                next_.resize(next_.size() + 256, -1);
+            }
+            s = next_[(size_t)s * 256 + c];
+        }
+        out_[s] = (int32_t)p.size();
+    }
+    // 按层 BFS 补全失败转移：缺失的边指向失败状态的同名边；out_ 沿失败链取最长
+    std::vector<int32_t> fail(depth_.size(), 0);
+    std::deque<int32_t> q;
+    for (int c = 0; c < 256; ++c) {
+        int32_t& t = next_[c];
+        if (t < 0) t = 0;
+        else q.push_back(t);
+    }
+    while (!q.empty()) {
+        const int32_t s = q.front(); q.pop_front();
+        out_[s] = std::max(out_[s], out_[fail[s]]);
+        for (int c = 0; c < 256; ++c) {
+            int32_t& t = next_[(size_t)s * 256 + c];
+            const int32_t f = next_[(size_t)fail[s] * 256 + c];
+            if (t < 0) { t = f; continue; }
+            fail[t] = f;
+            q.push_back(t);
+        }
+    }
+    reset();
+}
+
+bool StopMatcher::feed(std::string_view chunk, std::string& out) {
+    if (matched_) return true;
+    if (empty()) { out.append(chunk); return false; }
+    for (unsigned char c : chunk) {
+        state_ = next_[(size_t)state_ * 256 + c];
+        held_.push_back((char)c);
+        if (out_[state_] > 0) {
+            // 命中：留存字节的末尾 out_ 个字节即停止串
+            out.append(held_, 0, held_.size() - (size_t)out_[state_]);
+            held_.clear();
+            matched_ = true;
+            return true;
+        }
+        const size_t keep = (size_t)depth_[state_];
+        if (held_.size() > keep) {
+            out.append(held_, 0, held_.size() - keep);
+            held_.erase(0, held_.size() - keep);
+        }
+    }
+    return false;
+}
+
+void StopMatcher::finish(std::string& out) {
+    if (!matched_) out += held_;
+    held_.clear();
+    state_ = 0;
+}
+
+void StopMatcher::reset() {
+    state_ = 0;
+    held_.clear();
+    matched_ = false;
+}
+
+} // namespace inference
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace inference {
+
+// 停止串匹配：多个停止串构成 Aho-Corasick 自动机（按字节的稠密转移表），逐块喂入解码出的文本，
+// 停止串拆在多个 token 之间也能命中。当前状态对应的尾部字节可能是停止串的开头，先留在内部，
+// 确认不构成匹配后再输出；命中时只输出停止串之前的文本
+class StopMatcher {
+public:
+    StopMatcher() = default;
+    explicit StopMatcher(const std::vector<std::string>& patterns) { build(patterns); }
+
+    // 重建自动机并清空流状态；空串忽略
+    void build(const std::vector<std::string>& patterns);
+    bool empty() const { return depth_.size() <= 1; }
+
+    // 把 chunk 中确认不属于停止串的部分追加到 out；命中停止串时返回 true，之后的输入全部丢弃
+    bool feed(std::string_view chunk, std::string& out);
+    // 输出结束：冲掉留存的字节（未命中时它们属于正文）
+    void finish(std::string& out);
+    // 清空流状态，自动机保留
+    void reset();
+
+    bool matched() const { return matched_; }
+
+private:
+    std::vector<int32_t> next_;   // next_[s * 256 + byte]：含失败转移的完整转移表
+    std::vector<int32_t> depth_;  // 状态对应前缀的长度
+    std::vector<int32_t> out_;    // 在该状态结束的最长停止串长度，0 表示无
+    int32_t state_ = 0;
+    std::string held_;            // 留存的尾部字节，长度等于 depth_[state_]
+    bool matched_ = false;
+};
+
+} // namespace inference
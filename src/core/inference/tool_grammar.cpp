@@ -0,0 +1,259 @@
+#include "tool_grammar.h"
+
+#include <algorithm>
+#include <map>
+#include <numeric>
+
+namespace inference {
+
+namespace {
+
+// Thompson 式 NFA：各片段从给定状态接着往后建，返回片段的结束状态
+struct Nfa {
+    struct Edge { uint8_t lo, hi; int to; };
+    std::vector<std::vector<Edge>> edges;
+    std::vector<std::vector<int>> eps;
+
+    int add() { edges.emplace_back(); eps.emplace_back(); return (int)edges.size() - 1; }
+    int range(int s, uint8_t lo, uint8_t hi) { const int t = add(); edges[s].push_back({lo, hi, t}); return t; }
+    int ranges(int s, std::initializer_list<std::pair<uint8_t, uint8_t>> rs) {
+        const int t = add();
+        for (auto [lo, hi] : rs) edges[s].push_back({lo, hi, t});
+        return t;
+    }
+    int lit(int s, std::string_view text) {
+        for (unsigned char c : text) s = range(s, c, c);
+        return s;
+    }
+    template <typename F> int star(int s, F&& body) {
+        const int l = add();
+        eps[s].push_back(l);
+        eps[body(l)].push_back(l);
+        return l;
+    }
+    template <typename F> int opt(int s, F&& body) {
+        const int e = add();
+        eps[s].push_back(e);
+        eps[body(s)].push_back(e);
+        return e;
+    }
+
+    int ws(int s) { return star(s, [&](int a) { return ranges(a, {{' ', ' '}, {'\n', '\n'}}); }); }
+    int sp(int s) { return opt(s, [&](int a) { return lit(a, " "); }); }
+    int digits(int s) { return star(range(s, '0', '9'), [&](int a) { return range(a, '0', '9'); }); }
+
+    // JSON 字符串：控制字符须转义，\u 后跟 4 位十六进制；非 ASCII 字节原样放行
+    int string(int s) {
+        s = lit(s, "\"");
+        s = star(s, [&](int a) {
+            const int e = ranges(a, {{0x20, 0x21}, {0x23, 0x5B}, {0x5D, 0xFF}});
+            const int b = lit(a, "\\");
+            eps[ranges(b, {{'"', '"'}, {'\\', '\\'}, {'/', '/'}, {'b', 'b'}, {'f', 'f'}, {'n', 'n'}, {'r', 'r'}, {'t', 't'}})].push_back(e);
+            int u = lit(b, "u");
+            for (int i = 0; i < 4; ++i) u = ranges(u, {{'0', '9'}, {'a', 'f'}, {'A', 'F'}});
+            eps[u].push_back(e);
+            return e;
+        });
+        return lit(s, "\"");
+    }
+    int integer(int s) {
+        s = opt(s, [&](int a) { return lit(a, "-"); });
+        const int e = add();
+        eps[lit(s, "0")].push_back(e);
+        eps[star(range(s, '1', '9'), [&](int a) { return range(a, '0', '9'); })].push_back(e);
+        return e;
+    }
+    int number(int s) {
+        s = integer(s);
+        s = opt(s, [&](int a) { return digits(lit(a, ".")); });
+        return opt(s, [&](int a) {
+            a = ranges(a, {{'e', 'e'}, {'E', 'E'}});
+            a = opt(a, [&](int b) { return ranges(b, {{'+', '+'}, {'-', '-'}}); });
+            return digits(a);
+        });
+    }
+    int boolean(int s) {
+        const int e = add();
+        eps[lit(s, "true")].push_back(e);
+        eps[lit(s, "false")].push_back(e);
+        return e;
+    }
+    int string_array(int s) {
+        s = lit(s, "[");
+        s = opt(s, [&](int a) {
+            a = string(a);
+            return star(a, [&](int b) { return string(sp(lit(b, ","))); });
+        });
+        return lit(s, "]");
+    }
+};
+
+std::string quoted(const std::string& s) {
+    std::string out = "\"";
+    for (char c : s) {
+        if (c == '"' || c == '\\') out += '\\';
+        out += c;
+    }
+    return out + "\"";
+}
+
+} // namespace
+
+bool ToolGrammar::compile(const std::vector<Tool>& tools, std::string& err) {
+    next_.clear();
+    accept_.clear();
+    if (tools.empty()) { err = "no tools"; return false; }
+
+    Nfa n;
+    const int start = n.add();
+    int s = n.ws(start);
+    s = n.sp(n.lit(s, "{\"name\":"));
+    const int after_name = n.add();
+    for (const Tool& t : tools) {
+        int a = n.lit(s, quoted(t.name));
+        a = n.sp(n.lit(a, ","));
+        a = n.sp(n.lit(a, "\"arguments\":"));
+        a = n.lit(a, "{");
+        // 两条并行轨道：none 表示尚未输出任何参数，some 表示已输出过，之后的参数前须加逗号
+        int none = a, some = n.add();
+        for (const Param& p : t.params) {
+            auto value = [&](int v) -> int {
+                v = n.sp(n.lit(v, quoted(p.name) + ":"));
+                if (p.type == "string") return n.string(v);
+                if (p.type == "integer") return n.integer(v);
+                if (p.type == "number") return n.number(v);
+                if (p.type == "boolean") return n.boolean(v);
+                if (p.type == "array") return n.string_array(v);
+                return -1;
+            };
+            const int first = value(none);
+            const int more = value(n.sp(n.lit(some, ",")));
+            if (first < 0 || more < 0) { err = "unsupported type '" + p.type + "' for " + t.name + "." + p.name; return false; }
+            const int none2 = n.add(), some2 = n.add();
+            n.eps[first].push_back(some2);
+            n.eps[more].push_back(some2);
+            if (!p.required) { n.eps[none].push_back(none2); n.eps[some].push_back(some2); }
+            none = none2;
+            some = some2;
+        }
+        const int close = n.add();
+        n.eps[none].push_back(close);
+        n.eps[some].push_back(close);
+        n.eps[n.lit(close, "}")].push_back(after_name);
+    }
+    s = n.lit(n.ws(n.lit(after_name, "}")), "</tool_call>");
+    const int final_state = s;
+
+    // 子集构造：DFA 状态为 NFA 状态集合的 ε 闭包（排序后作键），空集即 -1
+    auto closure = [&](std::vector<int>& set) {
+        std::vector<int> stack(set);
+        std::vector<uint8_t> seen(n.edges.size(), 0);
+        for (int x : set) seen[x] = 1;
+        while (!stack.empty()) {
+            const int x = stack.back(); stack.pop_back();
+            for (int y : n.eps[x]) if (!seen[y]) { seen[y] = 1; set.push_back(y); stack.push_back(y); }
+        }
+        std::sort(set.begin(), set.end());
+    };
+    std::map<std::vector<int>, int> ids;
+    std::vector<std::vector<int>> sets;
+    auto intern = [&](std::vector<int>&& set) -> int {
+        if (set.empty()) return -1;
+        auto it = ids.find(set);
+        if (it != ids.end()) return it->second;
+        const int id = (int)sets.size();
+        ids.emplace(set, id);
+        accept_.push_back(std::binary_search(set.begin(), set.end(), final_state) ? 1 : 0);
+        next_.resize(next_.size() + 256, -1);
+        sets.push_back(std::move(set));
+        return id;
+    };
+    std::vector<int> init{start};
+    closure(init);
+    intern(std::move(init));
+    std::vector<uint8_t> mark(n.edges.size(), 0);
+    for (size_t d = 0; d < sets.size(); ++d) {
+        for (int b = 0; b < 256; ++b) {
+            std::vector<int> to;
+            for (int x : sets[d]) {
+                for (const Nfa::Edge& e : n.edges[x]) {
+                    if (b < e.lo || b > e.hi || mark[e.to]) continue;
+                    mark[e.to] = 1;
+                    to.push_back(e.to);
+                }
+            }
+            for (int x : to) mark[x] = 0;
+            if (to.empty()) continue;
+            closure(to);
+            const int t = intern(std::move(to));
+            next_[d * 256 + (size_t)b] = t;
+        }
+    }
+    return true;
+}
+
+int ToolGrammar::walk(int s, std::string_view text) const {
+    for (unsigned char c : text) {
+        if (s < 0) return -1;
+        s = next(s, c);
+    }
+    return s;
+}
+
+void GrammarVocab::build(const std::vector<std::string_view>& pieces) {
+    n_vocab_ = (int)pieces.size();
+    ids_.clear();
+    for (int i = 0; i < n_vocab_; ++i) if (!pieces[i].empty()) ids_.push_back(i);
+    std::sort(ids_.begin(), ids_.end(), [&](int32_t a, int32_t b) { return pieces[a] < pieces[b]; });
+    pieces_.resize(ids_.size());
+    lcp_.assign(ids_.size(), 0);
+    max_len_ = 0;
+    for (size_t k = 0; k < ids_.size(); ++k) {
+        pieces_[k] = pieces[ids_[k]];
+        max_len_ = std::max(max_len_, pieces_[k].size());
+        if (k == 0) continue;
+        const std::string_view a = pieces_[k - 1], b = pieces_[k];
+        const size_t m = std::min(a.size(), b.size());
+        size_t l = 0;
+        while (l < m && a[l] == b[l]) ++l;
+        lcp_[k] = (uint32_t)l;
+    }
+}
+
+GrammarMasks::GrammarMasks(std::shared_ptr<const ToolGrammar> grammar, const GrammarVocab& vocab)
+    : grammar_(std::move(grammar)), vocab_(vocab), words_((vocab.n_vocab() + 63) / 64),
+      masks_(grammar_->states()), empty_(grammar_->states(), -1), path_(vocab.max_len_ + 1, -1) {}
+
+const uint64_t* GrammarMasks::allowed(int state) {
+    if (state < 0 || state >= (int)masks_.size()) return nullptr;
+    if (empty_[state] < 0) {
+        std::vector<uint64_t>& m = masks_[state];
+        m.assign((size_t)words_, 0);
+        bool any = false;
+        // path_[j] 为当前 piece 前 j 个字节走到的状态；与前一个 piece 的公共前缀直接复用。
+        // dead 为前一个 piece 走不通的位置：公共前缀覆盖该位置的 piece 同样走不通
+        size_t dead = SIZE_MAX;
+        path_[0] = state;
+        for (size_t k = 0; k < vocab_.ids_.size(); ++k) {
+            const size_t l = vocab_.lcp_[k];
+            if (l >= dead) continue;
+            dead = SIZE_MAX;
+            const std::string_view p = vocab_.pieces_[k];
+            size_t j = l;
+            for (; j < p.size(); ++j) {
+                const int t = grammar_->next(path_[j], (unsigned char)p[j]);
+                if (t < 0) break;
+                path_[j + 1] = t;
+            }
+            if (j < p.size()) { dead = j + 1; continue; }
+            const int32_t id = vocab_.ids_[k];
+            m[(size_t)id >> 6] |= 1ull << (id & 63);
+            any = true;
+        }
+        empty_[state] = any ? 0 : 1;
+        ++computed_;
+    }
+    return empty_[state] ? nullptr : masks_[state].data();
+}
+
+} // namespace inference
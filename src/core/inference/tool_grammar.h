@@ -0,0 +1,82 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace inference {
+
+// 工具调用文法：把已注册工具的参数 schema 编译成按字节的 DFA，约束 <tool_call> 与 </tool_call> 之间的输出。
+// 接受的语言：{"name": "<工具名>", "arguments": {<参数>}}</tool_call>。参数按声明顺序出现，可选参数可省略；
+// 冒号、逗号后允许一个空格，调用首尾允许空白。参数类型取 JSON schema 的 string / integer / number / boolean /
+// array（字符串数组）
+class ToolGrammar {
+public:
+    struct Param {
+        std::string name;
+        std::string type = "string";
+        bool required = true;
+    };
+    struct Tool {
+        std::string name;
+        std::vector<Param> params;
+    };
+
+    // 构造 NFA 后子集构造为稠密 DFA；未知类型或工具列表为空时返回 false
+    bool compile(const std::vector<Tool>& tools, std::string& err);
+
+    int start() const { return 0; }
+    int next(int s, unsigned char b) const { return next_[(size_t)s * 256 + b]; }
+    // 从 s 读入 text，中途无转移时返回 -1
+    int walk(int s, std::string_view text) const;
+    bool accepting(int s) const { return s >= 0 && accept_[s]; }
+    int states() const { return (int)accept_.size(); }
+
+private:
+    std::vector<int32_t> next_;   // next_[s * 256 + byte]，-1 为无转移
+    std::vector<uint8_t> accept_;
+};
+
+// 供文法掩码共享的词表索引：piece 按字典序排列并记录与前一个 piece 的公共前缀长度。
+// 空 piece（含调用方想排除的控制 token）不进入索引，永远不被允许
+class GrammarVocab {
+public:
+    // pieces[id] 为 token id 的字节串，视图在索引存活期间须保持有效
+    void build(const std::vector<std::string_view>& pieces);
+    int n_vocab() const { return n_vocab_; }
+    bool empty() const { return ids_.empty(); }
+
+private:
+    friend class GrammarMasks;
+    int n_vocab_ = 0;
+    size_t max_len_ = 0;
+    std::vector<std::string_view> pieces_; // 排序后的 piece
+    std::vector<int32_t> ids_;
+    std::vector<uint32_t> lcp_;
+};
+
+// 文法状态 → 允许的 token 位图（n_vocab 位，按 64 位字存放）。每个状态首次访问时按排序词表遍历一次，
+// 复用与前一个 piece 的公共前缀上的状态，之后取掩码为一次查表
+class GrammarMasks {
+public:
+    GrammarMasks(std::shared_ptr<const ToolGrammar> grammar, const GrammarVocab& vocab);
+
+    const ToolGrammar& grammar() const { return *grammar_; }
+    const std::shared_ptr<const ToolGrammar>& grammar_ptr() const { return grammar_; }
+    // 没有任何 token 可走时返回 nullptr（调用方放弃约束）
+    const uint64_t* allowed(int state);
+    int computed() const { return computed_; }
+
+private:
+    std::shared_ptr<const ToolGrammar> grammar_;
+    const GrammarVocab& vocab_;
+    int words_ = 0;
+    int computed_ = 0;
+    std::vector<std::vector<uint64_t>> masks_; // 按状态懒计算
+    std::vector<int8_t> empty_;                // -1 未计算，1 无可用 token
+    std::vector<int32_t> path_;
+};
+
+} // namespace inference
@@ -16,6 +16,7 @@ Router::Router(std::shared_ptr<inference::Engine> local_engine,
     if (auto v = config::get_env("AICLI_INPUT_TOKEN_THRESHOLD")) {
         try { input_token_threshold_ = std::stoi(*v); } catch (...) {}
     }
+    local_model_ = config::get_env("AICLI_ROUTE_MODEL").value_or(config::get_value("routing.local_model").value_or(""));
 }
 
 Decision Router::decide(const Request& req) const {
@@ -37,17 +38,37 @@ bool Router::generate(const std::string& session_id,
                      const inference::GenerateOptions& options,
                      const inference::StreamCallback& on_token,
                      std::string& err) {
+    return generate_with_model("", session_id, prompt, options, on_token, err);
+}
+
+bool Router::generate_with_model(const std::string& model,
+                                 const std::string& session_id,
+                                 const std::string& prompt,
+                                 const inference::GenerateOptions& options,
+                                 const inference::StreamCallback& on_token,
+                                 std::string& err) {
     Request req;
     req.prompt = prompt;
     req.estimated_input_tokens = (int)(prompt.size() / 4); // 粗略估计
+    req.model = model.empty() ? local_model_ : model;
 
-    Decision d = decide(req);
-    std::shared_ptr<inference::Engine> eng = (d == Decision::Local) ? local_ : cloud_;
+    // 显式指定模型或 LoRA 适配器的请求总是走本地
+    Decision d = model.empty() && options.adapter.empty() ? decide(req) : Decision::Local;
+    std::shared_ptr<inference::Engine> local = local_;
+    if (!req.model.empty() && pool_) {
+        // 指定模型：从模型池取（未常驻时后台加载，本次请求等待加载完成）
+        std::string perr;
+        if (auto e = pool_->acquire(req.model, perr)) local = e;
+        else sysbox::record({"router","warn","model unavailable: " + perr});
+    }
+    std::shared_ptr<inference::Engine> eng = (d == Decision::Local) ? local : cloud_;
     
-    if (!eng || !eng->is_loaded()) {
+    // 加载中的引擎视为可用：生成请求会等待加载完成
+    auto available = [](const std::shared_ptr<inference::Engine>& e) { return e && (e->is_loaded() || e->is_loading()); };
+    if (!available(eng)) {
         // 回退
-        eng = (d == Decision::Local) ? cloud_ : local_;
-        if (!eng || !eng->is_loaded()) {
+        eng = (d == Decision::Local) ? cloud_ : local;
+        if (!available(eng)) {
             err = "no engine available";
             sysbox::record({"router","error","no engine available"});
             return false;
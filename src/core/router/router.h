@@ -1,6 +1,7 @@
 #pragma once
 
 #include "core/inference/engine.h"
+#include "core/inference/engine_pool.h"
 #include <memory>
 #include <string>
 
@@ -13,6 +14,7 @@ struct Request {
     int estimated_input_tokens = 0;
     int estimated_output_tokens = 0;
     bool requires_tools = false;
+    std::string model;  // 指定本地模型名，空表示路由默认
 };
 
 class Router {
@@ -28,8 +30,21 @@ public:
                  const inference::StreamCallback& on_token,
                  std::string& err);
 
+    // 本地路由落到模型池中的指定模型（model 为空时用 routing.local_model，仍为空则用当前本地引擎）
+    bool generate_with_model(const std::string& model,
+                             const std::string& session_id,
+                             const std::string& prompt,
+                             const inference::GenerateOptions& options,
+                             const inference::StreamCallback& on_token,
+                             std::string& err);
+
+    void set_local(std::shared_ptr<inference::Engine> engine) { local_ = std::move(engine); }
+    void set_pool(std::shared_ptr<inference::EnginePool> pool) { pool_ = std::move(pool); }
+
 private:
     std::shared_ptr<inference::Engine> local_;
+    std::shared_ptr<inference::EnginePool> pool_;
+    std::string local_model_;
     std::shared_ptr<inference::Engine> cloud_;
     bool prefer_local_ = true;
     int input_token_threshold_ = 800;
@@ -8,6 +8,9 @@
 #include <vector>
 #include <algorithm>
 #include <cstdlib>
+#if defined(__linux__)
+#include <unistd.h>
+#endif
 
 namespace fs = std::filesystem;
 
@@ -81,4 +84,14 @@ std::pair<double,double> add_duration_sample(const std::string& name, double ms)
     return {pct(0.50), pct(0.95)};
 }
 
+size_t process_rss_bytes() {
+#if defined(__linux__)
+    // /proc/self/statm：第二列为常驻页数
+    std::ifstream ifs("/proc/self/statm");
+    size_t total = 0, resident = 0;
+    if (ifs >> total >> resident) return resident * (size_t)sysconf(_SC_PAGESIZE);
+#endif
+    return 0;
+}
+
 } // namespace sysbox
@@ -2,6 +2,7 @@
 
 #include <string>
 #include <chrono>
+#include <cstddef>
 #include <utility>
 
 namespace sysbox {
@@ -30,4 +31,7 @@ private:
 // 指标聚合：加入样本（毫秒）并返回 p50/p95（毫秒）
 std::pair<double,double> add_duration_sample(const std::string& name, double ms);
 
+// 当前进程常驻内存（字节），不支持的平台返回 0
+size_t process_rss_bytes();
+
 } // namespace sysbox
@@ -24,6 +24,27 @@ std::optional<std::string> extract_string_field(const std::string& json, const s
     return json.substr(s + 1, e - s - 1);
 }
 
+std::optional<std::string> extract_object_field(const std::string& json, const std::string& key) {
+    auto p = json.find("\"" + key + "\"");
+    if (p == std::string::npos) return std::nullopt;
+    auto s = json.find_first_of("{[", p + key.size() + 2);
+    if (s == std::string::npos) return std::nullopt;
+    int depth = 0;
+    bool in_str = false;
+    for (size_t i = s; i < json.size(); ++i) {
+        const char c = json[i];
+        if (in_str) {
+            if (c == '\\') ++i;
+            else if (c == '"') in_str = false;
+            continue;
+        }
+        if (c == '"') in_str = true;
+        else if (c == '{' || c == '[') ++depth;
+        else if ((c == '}' || c == ']') && --depth == 0) return json.substr(s, i - s + 1);
+    }
+    return std::nullopt;
+}
+
 } // namespace tools
 
 
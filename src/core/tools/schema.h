@@ -18,5 +18,8 @@ std::optional<SchemaError> validate_required_fields(const std::string& json, con
 // 提取 JSON 字符串字段值
 std::optional<std::string> extract_string_field(const std::string& json, const std::string& key);
 
+// 提取对象 / 数组字段的原始 JSON 文本（按括号配对，跳过字符串内的括号）
+std::optional<std::string> extract_object_field(const std::string& json, const std::string& key);
+
 } // namespace tools
 
@@ -138,10 +138,10 @@ static ToolResult tool_shell_exec(const std::string& args_json) {
 }
 
 void register_builtin_tools() {
-    Registry::instance().register_tool({"echo","返回参数原样", tool_echo});
-    Registry::instance().register_tool({"fs.read_file","读取文本文件", tool_fs_read_file});
-    Registry::instance().register_tool({"fs.write_file","写入文本文件", tool_fs_write_file});
-    Registry::instance().register_tool({"shell.exec","执行白名单 shell 命令", tool_shell_exec});
+    Registry::instance().register_tool({"echo","返回参数原样", tool_echo, {{"text", "string", false}}});
+    Registry::instance().register_tool({"fs.read_file","读取文本文件", tool_fs_read_file, {{"path"}}});
+    Registry::instance().register_tool({"fs.write_file","写入文本文件", tool_fs_write_file, {{"path"}, {"content"}}});
+    Registry::instance().register_tool({"shell.exec","执行白名单 shell 命令", tool_shell_exec, {{"cmd"}, {"args", "array", false}}});
 }
 
 } // namespace tools
@@ -15,10 +15,19 @@ struct ToolResult {
 
 using ToolFn = std::function<ToolResult(const std::string& args_json)>;
 
+// 参数说明：type 取 JSON schema 的类型名（string / integer / number / boolean / array），
+// 用于生成调用说明与约束解码的文法；参数按声明顺序出现
+struct ToolParam {
+    std::string name;
+    std::string type = "string";
+    bool required = true;
+};
+
 struct ToolDesc {
     std::string name;
     std::string description;
     ToolFn run;
+    std::vector<ToolParam> params;
 };
 
 class Registry {
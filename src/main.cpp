@@ -1,12 +1,22 @@
 #include "cli/repl.h"
+#include "cli/tune.h"
+#include "cli/batch.h"
 #include "utils/logging.h"
 #include "utils/config.h"
 
+#include <string>
+
 int main(int argc, char** argv) {
-    (void)argc; (void)argv;
     logging::initialize();
     config::initialize_from_env();
 
+    if (argc > 1 && std::string(argv[1]) == "tune") {
+        return cli::run_tune(argc - 2, argv + 2);
+    }
+    if (argc > 1 && std::string(argv[1]) == "--batch") {
+        return cli::run_batch(argc - 1, argv + 1);
+    }
+
     cli::Repl repl;
     repl.run();
     return 0;
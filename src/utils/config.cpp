@@ -1,13 +1,88 @@
 #include "config.h"
 
 #include <cstdlib>
+#include <fstream>
+#include <map>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <vector>
 
 namespace config {
 
+static std::map<std::string, std::string>& values() {
+    static std::map<std::string, std::string> v;
+    return v;
+}
+
+static std::string trim(const std::string& s) {
+    auto b = s.find_first_not_of(" \t\r");
+    if (b == std::string::npos) return "";
+    auto e = s.find_last_not_of(" \t\r");
+    return s.substr(b, e - b + 1);
+}
+
+// 展开 ${VAR:-default}
+static std::string expand(const std::string& v) {
+    std::string out;
+    size_t i = 0;
+    while (i < v.size()) {
+        auto l = v.find("${", i);
+        if (l == std::string::npos) { out += v.substr(i); break; }
+        auto r = v.find('}', l);
+        if (r == std::string::npos) { out += v.substr(i); break; }
+        out += v.substr(i, l - i);
+        std::string body = v.substr(l + 2, r - l - 2);
+        std::string def;
+        auto d = body.find(":-");
+        if (d != std::string::npos) { def = body.substr(d + 2); body = body.substr(0, d); }
+        const char* env = std::getenv(body.c_str());
+        out += (env && *env) ? std::string(env) : def;
+        i = r + 1;
+    }
+    return out;
+}
+
+// 只支持本项目配置用到的子集：缩进表示的嵌套映射 + 标量值，列表项与多行值忽略
+static void load_yaml(const std::string& path) {
+    std::ifstream ifs(path);
+    if (!ifs.is_open()) return;
+    std::vector<std::pair<int, std::string>> stack; // (缩进, 键)
+    std::string line;
+    while (std::getline(ifs, line)) {
+        auto hash = line.find(" #");
+        if (line.rfind('#', 0) == 0) continue;
+        if (hash != std::string::npos) line = line.substr(0, hash);
+        if (trim(line).empty()) continue;
+        int indent = (int)line.find_first_not_of(' ');
+        std::string body = trim(line);
+        if (body.rfind("- ", 0) == 0) continue;
+        auto colon = body.find(':');
+        if (colon == std::string::npos) continue;
+        std::string key = trim(body.substr(0, colon));
+        std::string val = trim(body.substr(colon + 1));
+        while (!stack.empty() && stack.back().first >= indent) stack.pop_back();
+        std::string full;
+        for (auto& kv : stack) full += kv.second + ".";
+        full += key;
+        if (val.empty()) { stack.emplace_back(indent, key); continue; }
+        if (val.size() >= 2 && (val.front() == '"' || val.front() == '\'') && val.back() == val.front()) val = val.substr(1, val.size() - 2);
+        values()[full] = expand(val);
+    }
+}
+
+static std::string config_path() {
+    const char* p = std::getenv("AICLI_CONFIG");
+    return p ? p : "config/aicli.yaml";
+}
+
+static void ensure_loaded() {
+    static std::once_flag once;
+    std::call_once(once, []{ load_yaml(config_path()); });
+}
+
 void initialize_from_env() {
-    (void)0; // 预留：读取 AICLI_CONFIG 等环境变量，加载 YAML
+    ensure_loaded();
 }
 
 std::optional<std::string> get_env(const std::string& key) {
@@ -17,11 +92,71 @@ std::optional<std::string> get_env(const std::string& key) {
     return std::nullopt;
 }
 
-} // namespace config
-
-
-
-
+std::optional<std::string> get_value(const std::string& dotted_key) {
+    ensure_loaded();
+    auto it = values().find(dotted_key);
+    if (it == values().end()) return std::nullopt;
+    return it->second;
+}
 
+int get_int(const std::string& env_key, const std::string& dotted_key, int def) {
+    if (auto v = get_env(env_key)) { try { return std::stoi(*v); } catch (...) {} }
+    if (auto v = get_value(dotted_key)) { try { return std::stoi(*v); } catch (...) {} }
+    return def;
+}
 
+bool set_value(const std::string& dotted_key, const std::string& value, std::string& err) {
+    ensure_loaded();
+    const auto dot = dotted_key.find('.');
+    if (dot == std::string::npos || dotted_key.find('.', dot + 1) != std::string::npos) { err = "only section.key is supported"; return false; }
+    const std::string section = dotted_key.substr(0, dot), key = dotted_key.substr(dot + 1);
+    const std::string path = config_path();
+    std::vector<std::string> lines;
+    {
+        std::ifstream ifs(path);
+        std::string line;
+        while (std::getline(ifs, line)) lines.push_back(line);
+    }
+    // 定位节的范围 [begin, end)：节头之后、下一个顶层键之前
+    size_t begin = lines.size(), end = lines.size();
+    for (size_t i = 0; i < lines.size(); ++i) {
+        const std::string body = trim(lines[i]);
+        const bool top = !lines[i].empty() && lines[i][0] != ' ' && lines[i][0] != '#';
+        if (begin == lines.size()) {
+            if (top && body == section + ":") begin = i + 1;
+        } else if (top && !body.empty()) {
+            end = i;
+            break;
+        }
+    }
+    if (begin == lines.size()) {
+        lines.push_back(section + ":");
+        begin = end = lines.size();
+    }
+    // 只匹配节下第一层的键
+    size_t child = std::string::npos;
+    for (size_t i = begin; i < end && child == std::string::npos; ++i) {
+        if (!trim(lines[i]).empty() && trim(lines[i])[0] != '#') child = lines[i].find_first_not_of(' ');
+    }
+    bool done = false;
+    for (size_t i = begin; i < end && !done; ++i) {
+        const std::string& line = lines[i];
+        const auto indent = line.find_first_not_of(' ');
+        if (indent != child || line.compare(indent, key.size() + 1, key + ":") != 0) continue;
+        const auto hash = line.find(" #");
+        std::string comment = hash == std::string::npos ? "" : line.substr(hash);
+        std::string head = line.substr(0, indent) + key + ": " + value;
+        // 尽量保持注释列对齐
+        if (!comment.empty() && head.size() < hash) head.append(hash - head.size(), ' ');
+        lines[i] = head + comment;
+        done = true;
+    }
+    if (!done) lines.insert(lines.begin() + (long)begin, std::string(child == std::string::npos ? 2 : child, ' ') + key + ": " + value);
+    std::ofstream ofs(path, std::ios::trunc);
+    if (!ofs.is_open()) { err = "cannot write " + path; return false; }
+    for (auto& l : lines) ofs << l << '\n';
+    values()[dotted_key] = value;
+    return true;
+}
 
+} // namespace config
@@ -8,11 +8,13 @@ namespace config {
 void initialize_from_env();
 std::optional<std::string> get_env(const std::string& key);
 
-} // namespace config
-
-
-
-
+// 读取 config/aicli.yaml（或 AICLI_CONFIG 指定文件）中的标量，键用点号分隔，如 "local_model.ubatch"
+std::optional<std::string> get_value(const std::string& dotted_key);
 
+// 按 环境变量 > 配置文件 > 默认值 的优先级取整数
+int get_int(const std::string& env_key, const std::string& dotted_key, int def);
 
+// 把 "section.key" 写回配置文件：已有的键原位替换值（保留行尾注释），否则插到该节开头；同时更新内存中的值
+bool set_value(const std::string& dotted_key, const std::string& value, std::string& err);
 
+} // namespace config
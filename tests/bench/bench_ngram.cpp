@@ -0,0 +1,68 @@
+// 提示词查找微基准：模拟“输出大段照抄输入”的编辑类任务，统计草稿接受率与每次校验产出的 token 数
+#include "core/inference/local_llama/ngram_index.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+// 输出 = 输入按 edit_rate 逐 token 改写：替换或插入 1~3 个新 token
+static std::vector<int> make_edit(const std::vector<int>& src, double edit_rate, std::mt19937& rng) {
+    std::uniform_real_distribution<double> uni(0.0, 1.0);
+    std::uniform_int_distribution<int> tok(0, 31999), len(1, 3);
+    std::vector<int> out;
+    for (int t : src) {
+        if (uni(rng) < edit_rate) {
+            if (uni(rng) < 0.5) { out.push_back(tok(rng)); continue; }
+            for (int i = len(rng); i > 0; --i) out.push_back(tok(rng));
+        }
+        out.push_back(t);
+    }
+    return out;
+}
+
+struct Result { double accept_rate; double tokens_per_step; double us_per_step; };
+
+// 按推测解码的节奏回放：每步提议至多 k 个，与真实输出逐个比对，命中前缀被接受，再加上目标模型自己的 1 个
+static Result replay(const std::vector<int>& prompt, const std::vector<int>& output, int n, int k) {
+    inference::NgramIndex idx;
+    idx.reset(n, prompt.size() + output.size());
+    for (int t : prompt) idx.append(t);
+    std::vector<int> draft; draft.reserve(k);
+    long drafted = 0, accepted = 0, steps = 0;
+    auto t0 = std::chrono::steady_clock::now();
+    size_t pos = 0;
+    while (pos < output.size()) {
+        const int m = idx.propose(k, draft);
+        int acc = 0;
+        while (acc < m && pos + acc < output.size() && draft[acc] == output[pos + acc]) ++acc;
+        drafted += m; accepted += acc; ++steps;
+        const size_t emit = std::min(output.size() - pos, (size_t)acc + 1);
+        for (size_t i = 0; i < emit; ++i) idx.append(output[pos + i]);
+        pos += emit;
+    }
+    auto us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+    return {drafted > 0 ? (double)accepted / drafted : 0.0, (double)output.size() / steps, us / steps};
+}
+
+int main(int argc, char** argv) {
+    const int n_tokens = argc > 1 ? std::max(64, std::atoi(argv[1])) : 2000;
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> tok(0, 31999);
+    std::vector<int> prompt(n_tokens);
+    for (auto& t : prompt) t = tok(rng);
+
+    std::printf("%-6s %-4s %-4s %12s %15s %12s\n", "edit", "n", "k", "accept_rate", "tokens/verify", "us/step");
+    for (double rate : {0.01, 0.05, 0.20}) {
+        auto output = make_edit(prompt, rate, rng);
+        for (int n : {2, 3}) {
+            for (int k : {4, 8}) {
+                Result r = replay(prompt, output, n, k);
+                std::printf("%-6.2f %-4d %-4d %12.3f %15.2f %12.2f\n", rate, n, k, r.accept_rate, r.tokens_per_step, r.us_per_step);
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,57 @@
+// 增量 tokenize 微基准：历史逐轮增长时，对比每轮整串 tokenize 与 PromptTokenCache 的 prompt 准备耗时
+#include "core/inference/prompt_cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// 模拟 BPE 分词器的代价：逐字节做几轮合并式哈希，每 4 字节或遇换行产出一个 token；段标记为特殊 token
+static bool fake_bpe(std::string_view text, bool add_bos, bool special, std::vector<int32_t>& out) {
+    if (add_bos) out.push_back(1);
+    uint32_t h = 2166136261u;
+    int run = 0;
+    for (size_t i = 0; i < text.size();) {
+        if (special && text.compare(i, 12, "<|im_start|>") == 0) { out.push_back(1000); i += 12; h = 2166136261u; run = 0; continue; }
+        for (int r = 0; r < 8; ++r) h = (h ^ (unsigned char)text[i]) * 16777619u;
+        if (++run == 4 || text[i] == '\n') { out.push_back((int32_t)(h & 0x7fff)); h = 2166136261u; run = 0; }
+        ++i;
+    }
+    if (run > 0) out.push_back((int32_t)(h & 0x7fff));
+    return true;
+}
+
+static std::string msg(const std::string& role, size_t len, char fill) {
+    return "<|im_start|>" + role + "\n" + std::string(len, fill) + "<|im_end|>\n";
+}
+
+int main(int argc, char** argv) {
+    const int turns = argc > 1 ? std::max(1, std::atoi(argv[1])) : 200;
+    const std::string system = msg("system", 2000, 's');
+    std::string history = system;
+    inference::PromptTokenCache cache;
+    std::vector<int32_t> tokens;
+    std::printf("%-6s %10s %12s %14s %9s\n", "turn", "bytes", "full_us", "incremental_us", "reused");
+    for (int t = 1; t <= turns; ++t) {
+        history += msg("user", 200, 'u') + msg("assistant", 600, 'a');
+        const std::string prompt = history + "<|im_start|>assistant\n";
+
+        auto t0 = std::chrono::steady_clock::now();
+        std::vector<int32_t> full;
+        fake_bpe(prompt, true, true, full);
+        auto t1 = std::chrono::steady_clock::now();
+        int reused = 0;
+        cache.tokenize(prompt, fake_bpe, tokens, reused);
+        auto t2 = std::chrono::steady_clock::now();
+
+        if (t == 1 || t % std::max(1, turns / 10) == 0) {
+            std::printf("%-6d %10zu %12.1f %14.1f %9d\n", t, prompt.size(),
+                        std::chrono::duration<double, std::micro>(t1 - t0).count(),
+                        std::chrono::duration<double, std::micro>(t2 - t1).count(), reused);
+        }
+        if (tokens != full) { std::printf("mismatch at turn %d\n", t); return 1; }
+    }
+    return 0;
+}
@@ -11,8 +11,8 @@ AICLI=./build/aicli
 echo "=== 本地推理测试 ==="
 echo "模型: $TEST_MODEL"
 
-# 测试模型加载
-OUTPUT=$(printf "/model $TEST_MODEL\n/exit\n" | timeout 30 $AICLI 2>&1)
+# 测试模型加载（后台加载；发一轮对话等待加载完成，直接 /exit 会取消加载）
+OUTPUT=$(printf "/model $TEST_MODEL\n你好\n/exit\n" | timeout 30 $AICLI 2>&1)
 if echo "$OUTPUT" | grep -q "已加载模型"; then
     echo "✅ 模型加载成功"
 else
@@ -0,0 +1,66 @@
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "cli/batch_io.h"
+
+int main() {
+    std::map<std::string, std::string> f, raw;
+    std::string err;
+
+    // 字符串按转义解码，其余值保留原文
+    assert(cli::parse_json_object(R"({"prompt": "a\"b\nc中😀", "max_tokens": 64, "id": "x-1", "meta": {"k": [1, "}"]}, "ok": true})", f, err, &raw));
+    assert(f["prompt"] == "a\"b\nc\xe4\xb8\xad\xf0\x9f\x98\x80");
+    assert(f["max_tokens"] == "64" && f["ok"] == "true");
+    assert(f["meta"] == R"({"k": [1, "}"]})");
+    assert(raw["id"] == "\"x-1\"" && raw["max_tokens"] == "64");
+    assert(cli::parse_json_object("  {}  ", f, err) && f.empty());
+
+    // 格式错误
+    assert(!cli::parse_json_object(R"({"prompt": "a)", f, err));
+    assert(!cli::parse_json_object(R"({"prompt" "a"})", f, err));
+    assert(!cli::parse_json_object(R"({"prompt": "a"} x)", f, err));
+    assert(!cli::parse_json_object("[1]", f, err));
+    assert(!cli::parse_json_object("{\"p\": \"a\tb\"}", f, err));
+
+    // 编码后能原样解析回来
+    const std::string s = std::string("q\"\\\n\t\x01") + "中";
+    assert(cli::parse_json_object("{\"s\":" + cli::json_quote(s) + "}", f, err) && f["s"] == s);
+
+    // 检查点：只认 ok 与不可重试的行，末尾半行被截掉
+    const std::string path = (std::filesystem::temp_directory_path() / "aicli_test_batch_io.jsonl").string();
+    {
+        std::ofstream o(path, std::ios::binary | std::ios::trunc);
+        o << "{\"index\":3,\"ok\":true,\"output\":\"x\"}\n"
+          << "{\"index\":5,\"ok\":false,\"error\":\"e\"}\n"
+          << "{\"index\":0,\"ok\":true,\"output\":\"\"}\n"
+          << "{\"index\":6,\"ok\":false,\"error\":\"missing prompt\",\"retry\":false}\n"
+          << "{\"index\":7,\"ok\":tr";
+    }
+    std::unordered_set<long> done;
+    assert(cli::load_checkpoint(path, done, err));
+    assert(done.size() == 3 && done.count(3) && done.count(0) && done.count(6) && !done.count(5));
+    {
+        std::ifstream i(path, std::ios::binary);
+        const std::string rest((std::istreambuf_iterator<char>(i)), std::istreambuf_iterator<char>());
+        assert(!rest.empty() && rest.back() == '\n' && rest.find("\"index\":7") == std::string::npos);
+    }
+    std::filesystem::remove(path);
+    assert(cli::load_checkpoint(path, done, err) && done.empty());
+
+    std::vector<double> v{4, 1, 3, 2};
+    assert(cli::percentile(v, 0.0) == 1 && cli::percentile(v, 1.0) == 4);
+    assert(std::fabs(cli::percentile(v, 0.5) - 2.5) < 1e-9);
+    std::vector<double> e;
+    assert(cli::percentile(e, 0.5) == 0.0);
+
+    std::cout << "test_batch_io: ok\n";
+    return 0;
+}
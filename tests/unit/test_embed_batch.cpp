@@ -0,0 +1,62 @@
+#include <cassert>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "core/inference/embed_batch.h"
+
+// 每个 batch 不超限，且每个下标恰好出现一次
+static void check(const std::vector<std::vector<int>>& bins, const std::vector<int>& lens, int n_batch, int n_seq) {
+    std::vector<int> seen(lens.size(), 0);
+    for (auto& b : bins) {
+        assert(!b.empty() && (int)b.size() <= n_seq);
+        int sum = 0;
+        for (int i : b) { sum += std::min(std::max(lens[i], 1), n_batch); ++seen[i]; }
+        assert(sum <= n_batch);
+    }
+    for (int s : seen) assert(s == 1);
+}
+
+int main() {
+    using inference::pack_embed_batches;
+
+    // 短文本填进长文本留下的空隙
+    std::vector<int> lens{300, 700, 200, 800};
+    auto bins = pack_embed_batches(lens, 1000, 64);
+    check(bins, lens, 1000, 64);
+    assert(bins.size() == 2);
+
+    // 序列数上限先于 token 上限生效
+    std::vector<int> small(10, 4);
+    bins = pack_embed_batches(small, 1000, 3);
+    check(bins, small, 1000, 3);
+    assert(bins.size() == 4);
+
+    // 超长文本独占一个 batch；空文本按 1 个 token 计
+    std::vector<int> odd{5000, 0, 10};
+    bins = pack_embed_batches(odd, 512, 8);
+    check(bins, odd, 512, 8);
+    assert(bins.size() == 2);
+    assert(pack_embed_batches({}, 512, 8).empty());
+
+    // 随机长度：batch 数接近下界 ceil(sum / n_batch)
+    std::mt19937 rng(3);
+    std::uniform_int_distribution<int> d(8, 300);
+    std::vector<int> many(500);
+    long total = 0;
+    for (auto& l : many) { l = d(rng); total += l; }
+    bins = pack_embed_batches(many, 2048, 64);
+    check(bins, many, 2048, 64);
+    assert((long)bins.size() <= (total + 2047) / 2048 + 1);
+
+    float v[3] = {3.0f, 0.0f, 4.0f};
+    inference::l2_normalize(v, 3);
+    assert(std::fabs(v[0] - 0.6f) < 1e-6f && std::fabs(v[2] - 0.8f) < 1e-6f);
+    float z[2] = {0.0f, 0.0f};
+    inference::l2_normalize(z, 2);
+    assert(z[0] == 0.0f && z[1] == 0.0f);
+
+    std::cout << "test_embed_batch: ok\n";
+    return 0;
+}
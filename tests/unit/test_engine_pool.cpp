@@ -0,0 +1,108 @@
+#include <cassert>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "core/inference/engine_pool.h"
+
+namespace fs = std::filesystem;
+
+// 假引擎：同步“加载”，记录存活实例数；析构时访问池，池在持锁期间析构引擎会死锁
+static int g_alive = 0;
+static uint64_t g_kv = 0;
+static inference::EnginePool* g_pool = nullptr;
+struct FakeEngine : inference::Engine {
+    bool loaded = false;
+    FakeEngine() { ++g_alive; }
+    ~FakeEngine() override {
+        --g_alive;
+        if (g_pool) g_pool->used_bytes();
+    }
+    bool load_model(const std::string& path, std::string& err) override {
+        if (path.find("bad") != std::string::npos) { err = "bad model"; return false; }
+        loaded = true;
+        return true;
+    }
+    void unload_model() override { loaded = false; }
+    bool is_loaded() const override { return loaded; }
+    bool get_stats(inference::EngineStats& out) override {
+        out = inference::EngineStats{};
+        out.kv_capacity_bytes = g_kv;
+        return loaded;
+    }
+    bool generate(const std::string&, const inference::GenerateOptions&, const inference::StreamCallback&, std::string&) override { return true; }
+};
+
+static void make_model(const fs::path& dir, const std::string& name, size_t bytes) {
+    std::ofstream(dir / (name + ".gguf"), std::ios::binary) << std::string(bytes, 'x');
+}
+
+int main() {
+    using inference::EnginePool;
+    const fs::path dir = fs::temp_directory_path() / "aicli_test_engine_pool";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    make_model(dir, "chat", 300);
+    make_model(dir, "coder", 500);
+    make_model(dir, "big", 2000);
+    make_model(dir, "bad", 10);
+
+    EnginePool pool([] { return std::unique_ptr<inference::Engine>(new FakeEngine()); }, 1000, dir.string());
+    g_pool = &pool;
+    std::string err;
+
+    // 按名解析、按完整路径解析，同一模型只加载一次
+    assert(pool.resolve("chat") == (dir / "chat.gguf").string());
+    assert(pool.resolve("missing").empty());
+    bool called = false;
+    auto chat = pool.acquire("chat", err, [&](bool ok, const std::string&) { called = ok; });
+    assert(chat && chat->is_loaded() && called);
+    assert(pool.acquire((dir / "chat.gguf").string(), err) == chat);
+    assert(g_alive == 1 && pool.used_bytes() == 300);
+
+    // 预算内两个模型都常驻
+    auto coder = pool.acquire("coder", err);
+    assert(coder && pool.list().size() == 2 && pool.used_bytes() == 800);
+
+    // 超预算：被持有的模型不淘汰；释放后按 LRU 淘汰最久未用的 chat
+    make_model(dir, "small", 400);
+    assert(!pool.acquire("small", err) && !err.empty());
+    pool.acquire("chat", err);
+    pool.acquire("coder", err);
+    chat.reset(); coder.reset();
+    auto small = pool.acquire("small", err);
+    assert(small && g_alive == 2);
+    for (auto& m : pool.list()) assert(m.name != "chat");
+
+    // 单个模型超出预算：腾空其余空闲模型后仍可加载
+    small.reset();
+    auto big = pool.acquire("big", err);
+    assert(big && pool.list().size() == 1 && g_alive == 1);
+    big.reset();
+
+    // 加载失败的条目下次取用时移出池
+    auto bad = pool.acquire("bad", err, [&](bool ok, const std::string& e) { called = ok; err = e; });
+    assert(bad && !called && err == "bad model");
+    bad.reset();
+    pool.acquire("chat", err);
+    for (auto& m : pool.list()) assert(m.name != "bad");
+
+    pool.unload("chat");
+    assert(pool.list().empty() && g_alive == 0);
+
+    // 加载完成后 KV 容量计入常驻大小，参与淘汰判断
+    g_kv = 300;
+    auto c2 = pool.acquire("chat", err);
+    assert(c2 && pool.used_bytes() == 600 && pool.list()[0].kv_bytes == 300);
+    c2.reset();
+    auto c3 = pool.acquire("coder", err); // 300 + 300 + 500 > 1000：淘汰 chat
+    assert(c3 && g_alive == 1 && pool.used_bytes() == 800);
+    c3.reset();
+    pool.unload("coder");
+    g_pool = nullptr;
+
+    fs::remove_all(dir);
+    std::cout << "test_engine_pool: ok\n";
+    return 0;
+}
@@ -0,0 +1,63 @@
+#include <cassert>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+
+#include "core/inference/local_llama/kv_persist.h"
+
+namespace fs = std::filesystem;
+
+int main() {
+    using namespace inference;
+    const fs::path dir = fs::temp_directory_path() / "aicli_test_kv_persist";
+    fs::remove_all(dir);
+    const std::string path = (dir / "s.kv").string();
+
+    KvSnapshot snap;
+    snap.tokens = {1, 2, 3};
+    snap.state = {9, 8, 7, 6, 5};
+    snap.n_keep = 1;
+    std::string err;
+    assert(write_kv_snapshot(path, snap, err));
+    KvSnapshot back;
+    assert(read_kv_snapshot(path, back, err));
+    assert(back.tokens == snap.tokens && back.state == snap.state && back.n_keep == 1);
+
+    // 头部长度与文件大小不符：直接拒绝，不按损坏的长度分配
+    {
+        std::fstream f(path, std::ios::binary | std::ios::in | std::ios::out);
+        const uint64_t huge = 1ull << 60;
+        f.seekp(8 + 8); // magic + version + n_tokens 之后是 n_state
+        f.write(reinterpret_cast<const char*>(&huge), sizeof(huge));
+    }
+    assert(!read_kv_snapshot(path, back, err) && err == "size mismatch");
+    fs::resize_file(path, 10);
+    assert(!read_kv_snapshot(path, back, err));
+
+    // 后台写入：写完之前 pending 可见，flush 之后落盘且不再挂起
+    {
+        KvWriter w;
+        auto s = std::make_shared<KvSnapshot>(snap);
+        int done = 0;
+        w.enqueue(path, s, [&](const std::string& e) { assert(e.empty()); ++done; });
+        auto p = w.pending(path);
+        assert(!p || p == s);
+        w.flush();
+        assert(done == 1 && !w.pending(path));
+        assert(read_kv_snapshot(path, back, err) && back.state == snap.state);
+
+        // 同一路径的新快照覆盖旧快照
+        auto s2 = std::make_shared<KvSnapshot>(snap);
+        s2->tokens = {4, 5};
+        w.enqueue(path, s);
+        w.enqueue(path, s2);
+        w.flush();
+        assert(read_kv_snapshot(path, back, err) && back.tokens == s2->tokens);
+    }
+
+    fs::remove_all(dir);
+    std::cout << "test_kv_persist: ok\n";
+    return 0;
+}
@@ -0,0 +1,54 @@
+#include <cassert>
+#include <iostream>
+#include <vector>
+
+#include "core/inference/local_llama/ngram_index.h"
+
+int main() {
+    using namespace inference;
+    std::vector<int> out;
+
+    // 不足 n 个 token 或末尾 n-gram 未出现过：无候选
+    NgramIndex idx; idx.reset(3);
+    for (int t : {1, 2, 3, 4, 5, 6}) idx.append(t);
+    assert(idx.propose(4, out) == 0 && out.empty());
+
+    // 末尾 [1 2 3] 之前出现过：候选为其后的 token，最多 k 个
+    for (int t : {1, 2, 3}) idx.append(t);
+    assert(idx.propose(2, out) == 2);
+    assert((out == std::vector<int>{4, 5}));
+    assert(idx.propose(10, out) == 6);
+    assert((out == std::vector<int>{4, 5, 6, 1, 2, 3}));
+
+    // 取最近一次出现
+    for (int t : {9, 1, 2, 3}) idx.append(t);
+    assert(idx.propose(3, out) == 3);
+    assert((out == std::vector<int>{9, 1, 2}));
+
+    // 接受候选后继续追加，查找随之前移
+    idx.append(9);
+    assert(idx.propose(1, out) == 1 && out[0] == 1);
+
+    // 重复单 token：n=1 时候选截止在序列末尾
+    NgramIndex one; one.reset(1);
+    for (int t : {7, 7}) one.append(t);
+    assert(one.propose(4, out) == 1 && out[0] == 7);
+
+    // 未预留容量时随登记扩容：周期序列的每个位置都能查到上一周期
+    NgramIndex big; big.reset(4);
+    for (int i = 0; i < 5000; ++i) big.append(i % 1000);
+    assert(big.propose(3, out) == 3);
+    assert((out == std::vector<int>{0, 1, 2}));
+    // 同一容量复用时旧登记全部清除
+    big.reset(4, 100);
+    for (int t : {5, 6, 7, 8}) big.append(t);
+    assert(big.propose(2, out) == 0);
+
+    // reset 清空历史
+    idx.reset(2);
+    assert(idx.size() == 0);
+    assert(idx.propose(4, out) == 0);
+
+    std::cout << "test_ngram_index: ok\n";
+    return 0;
+}
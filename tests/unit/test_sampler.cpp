@@ -0,0 +1,123 @@
+#include <cassert>
+#include <iostream>
+#include <vector>
+
+#include "core/inference/local_llama/sampler.h"
+
+int main() {
+    using namespace inference;
+    const int n = 1000;
+    std::vector<float> logits(n, 0.0f);
+    logits[17] = 10.0f; logits[3] = 9.0f; logits[500] = 8.5f;
+
+    assert(sample_greedy(logits.data(), n) == 17);
+
+    SamplerWorkspace ws; ws.reserve(n);
+    // 采样链只开 temperature + top-p（默认配置）
+    auto top_p_chain = [&](SamplerChain& chain, float top_p) {
+        GenerateOptions o; o.temperature = 1.0f; o.top_p = top_p;
+        chain.configure(o, n, 123);
+    };
+    SamplerChain tp;
+    // 极小 top_p 只保留最大概率 token
+    top_p_chain(tp, 0.01f);
+    for (int i = 0; i < 50; ++i) assert(tp.sample(logits.data(), ws) == 17);
+
+    // nucleus 之外的 token 永不被采到
+    top_p_chain(tp, 0.9f);
+    int hits[3] = {0, 0, 0};
+    for (int i = 0; i < 2000; ++i) {
+        int id = tp.sample(logits.data(), ws);
+        assert(id == 17 || id == 3 || id == 500);
+        hits[id == 17 ? 0 : id == 3 ? 1 : 2]++;
+    }
+    assert(hits[0] > hits[1] && hits[1] > 0);
+
+    // 平坦分布会退化为逐段扩展直到覆盖全词表
+    std::vector<float> flat(n, 1.0f);
+    top_p_chain(tp, 0.999f);
+    for (int i = 0; i < 200; ++i) {
+        int id = tp.sample(flat.data(), ws);
+        assert(id >= 0 && id < n);
+    }
+
+    // 采样链：重复惩罚只作用于窗口内出现过的 token
+    {
+        GenerateOptions o; o.temperature = 0.0f; o.repeat_penalty = 10.0f; o.penalty_last_n = 4;
+        SamplerChain chain; chain.configure(o, n, 1);
+        assert(chain.sample(logits.data(), ws) == 17);
+        chain.accept(17);
+        assert(chain.sample(logits.data(), ws) == 3);
+        // 窗口滑出后惩罚解除
+        for (int t : {1, 2, 4, 5}) chain.accept(t);
+        assert(chain.sample(logits.data(), ws) == 17);
+    }
+    // 频率惩罚随出现次数累加
+    {
+        GenerateOptions o; o.temperature = 0.0f; o.repeat_penalty = 1.0f; o.frequency_penalty = 0.6f;
+        SamplerChain chain; chain.configure(o, n, 1);
+        chain.accept(17);
+        assert(chain.sample(logits.data(), ws) == 17); // 10 - 0.6 > 9
+        chain.accept(17);
+        assert(chain.sample(logits.data(), ws) == 3);  // 10 - 1.2 < 9
+    }
+    // DRY：历史 "7 8 17 7 8" 之后 17 会延续重复片段，应被压下去
+    {
+        GenerateOptions o; o.temperature = 0.0f; o.repeat_penalty = 1.0f;
+        o.dry_multiplier = 2.0f; o.dry_allowed_length = 2;
+        SamplerChain chain; chain.configure(o, n, 1);
+        for (int t : {7, 8, 17, 7, 8}) chain.accept(t);
+        assert(chain.sample(logits.data(), ws) == 3);
+        // 重新 configure 后历史清空
+        chain.configure(o, n, 1);
+        assert(chain.sample(logits.data(), ws) == 17);
+    }
+    // DRY 中断 token：历史 "7 8 17 9 7 8" 中 9 为中断 token 时仍可匹配；8 为中断 token 时匹配被截断
+    {
+        GenerateOptions o; o.temperature = 0.0f; o.repeat_penalty = 1.0f;
+        o.dry_multiplier = 2.0f; o.dry_allowed_length = 2;
+        std::vector<uint8_t> brk(n, 0);
+        brk[9] = 1;
+        SamplerChain chain; chain.configure(o, n, 1, brk.data());
+        for (int t : {7, 8, 17, 9, 7, 8}) chain.accept(t);
+        assert(chain.sample(logits.data(), ws) == 3);
+        brk[9] = 0; brk[8] = 1;
+        chain.configure(o, n, 1, brk.data());
+        for (int t : {7, 8, 17, 9, 7, 8}) chain.accept(t);
+        assert(chain.sample(logits.data(), ws) == 17);
+    }
+    // top-k=2 + min-p 之后只可能出现前两名
+    {
+        GenerateOptions o; o.temperature = 1.0f; o.top_k = 2; o.top_p = 1.0f; o.min_p = 0.0f; o.repeat_penalty = 1.0f;
+        SamplerChain chain; chain.configure(o, n, 99);
+        for (int i = 0; i < 500; ++i) { int id = chain.sample(logits.data(), ws); assert(id == 17 || id == 3); }
+        o.min_p = 0.5f; chain.configure(o, n, 99);
+        for (int i = 0; i < 200; ++i) assert(chain.sample(logits.data(), ws) == 17);
+    }
+    // typical：token 42 概率约 2%、惊奇度约 3.9，远离熵（约 6.87）；平尾的惊奇度约 6.93、贴近熵且占 98% 质量，
+    // typical_p=0.5 时只保留平尾，42 永不被采到；关掉 typical 后 42 照常出现
+    {
+        std::vector<float> skew(n, 0.0f);
+        skew[42] = 3.0f;
+        GenerateOptions o; o.temperature = 1.0f; o.top_k = 0; o.top_p = 1.0f; o.min_p = 0.0f; o.typical_p = 0.5f; o.repeat_penalty = 1.0f;
+        SamplerChain chain; chain.configure(o, n, 5);
+        for (int i = 0; i < 2000; ++i) { int id = chain.sample(skew.data(), ws); assert(id >= 0 && id < n && id != 42); }
+        o.typical_p = 1.0f; chain.configure(o, n, 5);
+        int dominant = 0;
+        for (int i = 0; i < 2000; ++i) dominant += chain.sample(skew.data(), ws) == 42;
+        assert(dominant > 0);
+    }
+    // 约束掩码：只在允许集合内采样，贪心与随机采样都不越界
+    {
+        std::vector<uint64_t> allow((n + 63) / 64, 0);
+        for (int id : {3, 500, 999}) allow[id >> 6] |= 1ull << (id & 63);
+        GenerateOptions o; o.temperature = 0.0f; o.repeat_penalty = 1.0f;
+        SamplerChain chain; chain.configure(o, n, 3);
+        assert(chain.sample(logits.data(), ws, allow.data()) == 3);
+        o.temperature = 1.0f; o.top_k = 0; o.min_p = 0.0f; chain.configure(o, n, 3);
+        for (int i = 0; i < 200; ++i) { int id = chain.sample(logits.data(), ws, allow.data()); assert(id == 3 || id == 500 || id == 999); }
+    }
+
+    std::cout << "test_sampler: ok\n";
+    return 0;
+}
@@ -0,0 +1,58 @@
+#include <cassert>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "core/inference/stop_matcher.h"
+
+// 按给定切分逐块喂入，返回输出文本与是否命中
+static std::string run(inference::StopMatcher& m, const std::vector<std::string>& chunks, bool& hit) {
+    std::string out;
+    m.reset();
+    hit = false;
+    for (auto& c : chunks) {
+        if (m.feed(c, out)) { hit = true; break; }
+    }
+    if (!hit) m.finish(out);
+    return out;
+}
+
+int main() {
+    using inference::StopMatcher;
+    bool hit = false;
+
+    // 停止串跨 token 拆分，命中后裁掉停止串及其后的内容
+    StopMatcher m({"<|im_start|>", "<|im_end|>", "\nUser:"});
+    assert(run(m, {"答案是 42", "<|im", "_st", "art|>user\n继续"}, hit) == "答案是 42" && hit);
+    assert(run(m, {"a\nUs", "er:", " hi"}, hit) == "a" && hit);
+
+    // 部分前缀最终不构成匹配：留存的字节原样输出，顺序不变
+    assert(run(m, {"x <|im", "_foo", " y"}, hit) == "x <|im_foo y" && !hit);
+    assert(run(m, {"tail <|im_"}, hit) == "tail <|im_" && !hit);
+
+    // 重叠的停止串：失败转移后仍能命中较短的串，并取最早开始的匹配
+    StopMatcher o({"abcd", "bc", "xyz"});
+    assert(run(o, {"zab", "c"}, hit) == "za" && hit);
+    StopMatcher n({"aab"});
+    assert(run(n, {"aaa", "ab!"}, hit) == "aa" && hit);
+
+    // 只有未确认的字节被留存：正文随喂入即时输出
+    std::string out;
+    m.reset();
+    m.feed("hello <", out);
+    assert(out == "hello ");
+    m.feed("b>", out);
+    assert(out == "hello <b>");
+
+    // 多字节 UTF-8 停止串
+    StopMatcher u({"用户："});
+    assert(run(u, {"好的。\n用", "户", "：下一个"}, hit) == "好的。\n" && hit);
+
+    // 无停止串时透传
+    StopMatcher e;
+    assert(e.empty());
+    assert(run(e, {"a", "b"}, hit) == "ab" && !hit);
+
+    std::cout << "test_stop_matcher: ok\n";
+    return 0;
+}
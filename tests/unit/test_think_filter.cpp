@@ -0,0 +1,75 @@
+#include <cassert>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "cli/think_filter.h"
+
+// 整串参照：去掉 <think>...</think>，无闭合则丢弃其后全部
+static std::string strip(const std::string& full) {
+    std::string out;
+    size_t i = 0;
+    while (i < full.size()) {
+        size_t start = full.find("<think>", i);
+        if (start == std::string::npos) { out.append(full.substr(i)); break; }
+        out.append(full.substr(i, start - i));
+        size_t end = full.find("</think>", start);
+        if (end == std::string::npos) break;
+        i = end + 8;
+    }
+    return out;
+}
+
+// 按给定切分点逐块喂入
+static std::string stream(const std::string& full, std::mt19937& rng, int max_chunk) {
+    cli::ThinkFilter f;
+    std::string out;
+    std::uniform_int_distribution<int> len(1, max_chunk);
+    for (size_t i = 0; i < full.size();) {
+        size_t n = std::min(full.size() - i, (size_t)len(rng));
+        f.feed(std::string_view(full).substr(i, n), out);
+        i += n;
+    }
+    f.finish(out);
+    return out;
+}
+
+int main() {
+    std::mt19937 rng(7);
+    const std::string cases[] = {
+        "plain answer",
+        "<think>reasoning</think>answer",
+        "a<think>x</think>b<think>y</think>c",
+        "<think>unterminated",
+        "less < than and <thin k> not a tag</think>",
+        "<<think>>x</think>>",
+        "answer ends with <thi",
+        "<think>a</thi</think>b",
+    };
+    for (const std::string& c : cases) {
+        const std::string want = strip(c);
+        for (int max_chunk : {1, 2, 3, 5, 64}) {
+            for (int rep = 0; rep < 20; ++rep) assert(stream(c, rng, max_chunk) == want);
+        }
+    }
+
+    // 逐字节喂入时，think 之前的内容不等结束就输出
+    cli::ThinkFilter f;
+    std::string out;
+    f.feed("Hello <", out);
+    assert(out == "Hello ");
+    f.feed("think>secret</th", out);
+    assert(out == "Hello " && f.in_think());
+    f.feed("ink>world", out);
+    assert(out == "Hello world");
+
+    // 显示 think 时原样透传
+    cli::ThinkFilter show(true);
+    out.clear();
+    show.feed("<think>x</think>y", out);
+    show.finish(out);
+    assert(out == "<think>x</think>y");
+
+    std::cout << "test_think_filter: ok\n";
+    return 0;
+}
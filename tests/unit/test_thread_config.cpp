@@ -0,0 +1,27 @@
+#include <cassert>
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+#include "core/inference/local_llama/thread_config.h"
+
+int main() {
+    using namespace inference;
+    std::vector<int> cpus;
+    assert(parse_cpu_list("0-3,8, 10-11", cpus));
+    assert((cpus == std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+    assert(parse_cpu_list("5,1-2,2", cpus) && (cpus == std::vector<int>{1, 2, 5}));
+    assert(!parse_cpu_list("", cpus));
+    assert(!parse_cpu_list("3-1", cpus));
+    assert(!parse_cpu_list("a-b", cpus));
+    assert(!parse_cpu_list("1x", cpus));
+
+    assert((thread_candidates(1) == std::vector<int>{1}));
+    assert((thread_candidates(6) == std::vector<int>{1, 2, 3, 4, 6}));
+    auto v = thread_candidates(32);
+    assert(v.front() == 1 && v.back() == 32);
+    assert(std::find(v.begin(), v.end(), 16) != v.end() && std::find(v.begin(), v.end(), 24) != v.end());
+
+    std::cout << "test_thread_config: ok\n";
+    return 0;
+}
@@ -0,0 +1,104 @@
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "core/inference/tool_grammar.h"
+#include "core/inference/local_llama/sampler.h"
+
+using inference::ToolGrammar;
+
+static bool accepts(const ToolGrammar& g, const std::string& text) { return g.accepting(g.walk(g.start(), text)); }
+
+int main() {
+    ToolGrammar g;
+    std::string err;
+    assert(!g.compile({}, err));
+    assert(!g.compile({{"bad", {{"x", "object"}}}}, err) && !err.empty());
+    assert(g.compile({{"fs.read_file", {{"path"}}},
+                      {"fs.write_file", {{"path"}, {"content"}}},
+                      {"shell.exec", {{"cmd"}, {"args", "array", false}, {"timeout", "integer", false}}},
+                      {"calc", {{"x", "number"}, {"exact", "boolean", false}}}}, err));
+
+    // 合法调用：空白与冒号 / 逗号后的空格可有可无，可选参数可省略
+    assert(accepts(g, R"({"name": "fs.read_file", "arguments": {"path": "a.txt"}}</tool_call>)"));
+    assert(accepts(g, "\n{\"name\":\"fs.write_file\",\"arguments\":{\"path\":\"a\",\"content\":\"x\\\"y\\n\\u4e2d\"}}\n</tool_call>"));
+    assert(accepts(g, R"({"name": "shell.exec", "arguments": {"cmd": "ls"}}</tool_call>)"));
+    assert(accepts(g, R"({"name": "shell.exec", "arguments": {"cmd": "ls", "args": ["-l", "/tmp"], "timeout": -30}}</tool_call>)"));
+    assert(accepts(g, R"({"name": "shell.exec", "arguments": {"cmd": "ls", "timeout": 0}}</tool_call>)"));
+    assert(accepts(g, R"({"name": "calc", "arguments": {"x": -1.5e+3, "exact": true}}</tool_call>)"));
+    assert(accepts(g, "{\"name\": \"fs.read_file\", \"arguments\": {\"path\": \"中文路径\"}}</tool_call>"));
+
+    // 非法调用：未知工具、缺必需参数、乱序、类型不符、未转义控制字符、多余逗号、前导零
+    assert(!accepts(g, R"({"name": "rm", "arguments": {}}</tool_call>)"));
+    assert(!accepts(g, R"({"name": "fs.write_file", "arguments": {"path": "a"}}</tool_call>)"));
+    assert(!accepts(g, R"({"name": "fs.write_file", "arguments": {"content": "x", "path": "a"}}</tool_call>)"));
+    assert(!accepts(g, R"({"name": "shell.exec", "arguments": {"cmd": 1}}</tool_call>)"));
+    assert(!accepts(g, "{\"name\": \"fs.read_file\", \"arguments\": {\"path\": \"a\nb\"}}</tool_call>"));
+    assert(!accepts(g, R"({"name": "shell.exec", "arguments": {"cmd": "ls",}}</tool_call>)"));
+    assert(!accepts(g, R"({"name": "shell.exec", "arguments": {"cmd": "ls", "timeout": 01}}</tool_call>)"));
+    assert(!accepts(g, R"({"name": "fs.read_file", "arguments": {"path": "a"}})"));
+    assert(g.walk(g.start(), "{\"name\": \"rm") < 0);
+
+    // 假词表：单字节、常见片段与若干多字节 piece；空 piece 视为被排除的控制 token
+    std::vector<std::string> vocab;
+    for (int c = 32; c < 127; ++c) vocab.push_back(std::string(1, (char)c));
+    for (const char* p : {"", "\n", "{\"", "\":", "\": \"", "\", \"", "\"}}", "name", "arguments", "path", "content", "cmd", "args",
+                          "fs.", "read", "_file", "write", "shell", ".exec", "</tool_call>", "</", "tool", "_call", ">", "<|im_end|>",
+                          "\"}}</tool_call>", "txt", "a.txt", " \"", "\"]", "[\"", "true", "12", "\\n", "\\u", "中文", "\xe4\xb8"}) {
+        vocab.push_back(p);
+    }
+    std::vector<std::string_view> views(vocab.begin(), vocab.end());
+    inference::GrammarVocab gv;
+    gv.build(views);
+    inference::GrammarMasks masks(std::make_shared<ToolGrammar>(g), gv);
+    const int n = (int)vocab.size();
+
+    // 位图与逐 token 暴力判定一致
+    const std::string call = R"({"name": "shell.exec", "arguments": {"cmd": "ls", "args": ["-l"]}}</tool_call>)";
+    int s = g.start();
+    for (size_t i = 0; i <= call.size(); ++i) {
+        const uint64_t* bits = masks.allowed(s);
+        bool any = false;
+        for (int id = 0; id < n; ++id) {
+            const bool ok = !vocab[id].empty() && g.walk(s, vocab[id]) >= 0;
+            any |= ok;
+            assert(!bits || ok == (((bits[id >> 6] >> (id & 63)) & 1) != 0));
+        }
+        assert((bits != nullptr) == any);
+        if (i < call.size()) s = g.next(s, (unsigned char)call[i]);
+    }
+    assert(g.accepting(s) && !masks.allowed(s));
+    assert(masks.computed() > 0 && masks.computed() <= g.states());
+
+    // 随机 logits 下按掩码采样：每次生成的调用都合乎文法
+    inference::GenerateOptions o; o.temperature = 1.5f; o.top_k = 0; o.top_p = 1.0f; o.min_p = 0.0f; o.repeat_penalty = 1.0f;
+    inference::SamplerChain chain; chain.configure(o, n, 11);
+    inference::SamplerWorkspace ws; ws.reserve(n);
+    std::mt19937 rng(5);
+    std::normal_distribution<float> nd(0.0f, 3.0f);
+    std::vector<float> logits(n);
+    int finished = 0;
+    for (int run = 0; run < 50; ++run) {
+        std::string out;
+        s = g.start();
+        for (int step = 0; step < 400 && !g.accepting(s); ++step) {
+            for (auto& l : logits) l = nd(rng);
+            // 偏向闭合，避免字符串无限延长
+            if (step > 40) for (int id = 0; id < n; ++id) if (vocab[id].find('"') != std::string::npos || vocab[id].find('}') != std::string::npos) logits[id] += 6.0f;
+            const uint64_t* bits = masks.allowed(s);
+            assert(bits);
+            const int id = chain.sample(logits.data(), ws, bits);
+            out += vocab[id];
+            s = g.walk(s, vocab[id]);
+            assert(s >= 0);
+        }
+        if (g.accepting(s)) { ++finished; assert(accepts(g, out)); }
+    }
+    assert(finished > 0);
+
+    std::cout << "test_tool_grammar: ok\n";
+    return 0;
+}